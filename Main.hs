@@ -19,23 +19,31 @@ with this program.  If not, see <http://www.gnu.org/licenses/>.
 -- | Driver for the compiler.
 module Main (main) where
 
+import Control.Concurrent
+import Control.Exception (ErrorCall(..), SomeException, try)
 import Control.Monad.Error
 import Control.Monad.State
 import Control.Monad.Writer
 import Data.Either
+import Data.Generics (gsize)
 import Data.List
 import qualified Data.Map as Map
 import Data.Maybe
+import Data.Ord
 import qualified Data.Set as Set
+import Data.Time.Clock
 import System.Console.GetOpt
 import System.Directory
 import System.Environment
 import System.Exit
 import System.IO
 import System.Process
+import Text.Printf
 
 import AnalyseAsm
 import qualified AST as A
+import BuildGraph
+import CompilationCache
 import CompilerCommands
 import CompState
 import Errors
@@ -74,9 +82,13 @@ optionsNoWarnings =
   , Option [] ["run-indent"] (NoArg $ optRunIndent) "run indent on source before compilation (will full mode)"
   , Option [] ["frontend"] (ReqArg optFrontend "FRONTEND") "language frontend (options: occam, rain)"
   , Option ['u'] ["implicit-module"] (ReqArg optImplicitModule "MODULE") "implicitly use this module"
+  , Option [] ["cache-dir"] (ReqArg optCacheDir "DIR") "reuse the results of earlier full-mode compiles kept in DIR"
+  , Option ['j'] ["jobs"] (ReqArg optJobs "N") "compile this many modules at once (build mode only)"
+  , Option [] ["pass-stats"] (OptArg optPassStats "FILE")
+      "report time, allocation and AST size for each pass (and write them to FILE as JSON)"
   , Option [] ["include-path"] (NoArg $ optPrintPath tockIncludeDir) "print include path"
   , Option [] ["lib-path"] (NoArg $ optPrintPath tockLibDir) "print lib path"
-  , Option [] ["mode"] (ReqArg optMode "MODE") "select mode (options: flowgraph, lex, html, parse, compile, post-c, full)"
+  , Option [] ["mode"] (ReqArg optMode "MODE") "select mode (options: flowgraph, lex, html, parse, compile, post-c, full, build)"
   , Option [] ["module-path"] (NoArg $ optPrintPath tockModuleDir) "print module path"
   , Option ['c'] ["no-main"] (NoArg optNoMain) "file has no main process; do not link either"
   , Option ['o'] ["output"] (ReqArg optOutput "FILE") "output file (default \"-\")"
@@ -84,8 +96,21 @@ optionsNoWarnings =
   , Option ['I'] ["add-to-search-path"] (ReqArg optSearchPath "PATHS") "paths to search for #INCLUDE, #USE"
   , Option [] ["occam2-mobility"] (ReqArg optClassicOccamMobility "SETTING") "occam2 implicit mobility (EXPERIMENTAL) (options: on, off)"
   , Option [] ["usage-checking"] (ReqArg optUsageChecking "SETTING") "usage checking (options: on, off)"
+  , Option [] ["pass-fusion"] (ReqArg optPassFusion "SETTING") "run adjacent simple passes as one traversal (options: on, off)"
+  , Option [] ["line-directives"] (ReqArg optLineDirectives "SETTING") "give occam source positions in the generated code with #line (options: on, off)"
+  , Option [] ["gather-comms"] (ReqArg optGatherComms "SETTING") "send each sequential protocol or counted array communication as one message (options: on, off)"
   , Option [] ["unknown-stack-size"] (ReqArg optStackSize "BYTES")
     "stack amount to allocate for unknown C functions"
+  , Option [] ["stack-analysis"] (ReqArg optStackAnalysis "METHOD")
+    "how to find C stack sizes (options: asm, stack-usage)"
+  , Option [] ["stack-profile"] (ReqArg optStackProfile "FILE")
+    "use stack sizes measured by --instrument=stack (only where larger than the static estimate)"
+  , Option [] ["stack-profile-trust"] (NoArg optStackProfileTrust)
+    "let the --stack-profile sizes replace the static estimates, even where smaller"
+  , Option [] ["unchecked-sites"] (ReqArg optUncheckedSites "FILE")
+    "leave out the runtime checks at the positions listed (as in --instrument=checks output)"
+  , Option [] ["instrument"] (ReqArg optInstrument "KIND")
+    "compile in instrumentation (options: stack, comms, checks)"
   , Option ['v'] ["verbose"] (NoArg $ optVerbose) "be more verbose (use multiple times for more detail)"
   ]
 
@@ -103,6 +128,7 @@ optMode s ps
             "compile" -> return ModeCompile
             "flowgraph" -> return ModeFlowGraph
             "full" -> return ModeFull
+            "build" -> return ModeBuild
             "parse" -> return ModeParse
             "post-c" -> return ModePostC
             "lex" -> return ModeLex
@@ -121,6 +147,53 @@ optBackend s ps
             _ -> dieIO (Nothing, "Unknown backend: " ++ s)
           return $ ps { csBackend = backend }
 
+optStackAnalysis :: String -> OptFunc
+optStackAnalysis s ps
+    =  do analysis <- case s of
+            "asm" -> return StackAnalysisAsm
+            "stack-usage" -> return StackAnalysisUsage
+            _ -> dieIO (Nothing, "Unknown stack analysis method: " ++ s)
+          return $ ps { csStackAnalysis = analysis }
+
+optStackProfile :: String -> OptFunc
+optStackProfile fn ps
+    =  do contents <- liftIO $ readFile fn
+          sizes <- mapM readLine $ filter isEntry $ zip [1..] $ lines contents
+          return $ ps { csStackProfile = Map.unionWith max (csStackProfile ps)
+                                           (Map.fromListWith max sizes) }
+  where
+    isEntry :: (Int, String) -> Bool
+    isEntry (_, l) = case words l of
+                       [] -> False
+                       (('#':_):_) -> False
+                       _ -> True
+
+    readLine :: (Int, String) -> ErrorT String IO (String, Integer)
+    readLine (n, l) = case words l of
+      (name:used:_) | [(v, "")] <- reads used -> return (name, v)
+      _ -> dieIO (Just $ Meta (Just fn) n 1, "Cannot parse stack profile line: " ++ l)
+
+optStackProfileTrust :: OptFunc
+optStackProfileTrust ps = return $ ps { csStackProfileTrust = True }
+
+-- | Each line of the file gives a position, optionally followed by anything
+-- else; the report from --instrument=checks can be cut down and used as it is.
+optUncheckedSites :: String -> OptFunc
+optUncheckedSites fn ps
+    =  do contents <- liftIO $ readFile fn
+          let sites = [pos | (pos:_) <- map words $ lines contents, head pos /= '#']
+          return $ ps { csUncheckedSites = Set.union (csUncheckedSites ps)
+                                                     (Set.fromList sites) }
+
+optInstrument :: String -> OptFunc
+optInstrument s ps
+    =  do i <- case s of
+            "stack" -> return InstrumentStack
+            "comms" -> return InstrumentComms
+            "checks" -> return InstrumentChecks
+            _ -> dieIO (Nothing, "Unknown instrumentation: " ++ s)
+          return $ ps { csInstrument = Set.insert i (csInstrument ps) }
+
 optFrontend :: String -> OptFunc
 optFrontend s ps
     =  do frontend <- case s of
@@ -176,6 +249,18 @@ optNoMain ps = return $ ps { csHasMain = False }
 optStackSize :: String -> OptFunc
 optStackSize s ps = return $ ps { csUnknownStackSize = read s }
 
+optCacheDir :: String -> OptFunc
+optCacheDir s ps = return $ ps { csCacheDir = Just s }
+
+optJobs :: String -> OptFunc
+optJobs s ps
+    =  case reads s of
+         [(n, "")] | n >= 1 -> return $ ps { csJobs = n }
+         _ -> dieIO (Nothing, "Bad number of jobs: " ++ s)
+
+optPassStats :: Maybe String -> OptFunc
+optPassStats file ps = return $ ps { csRecordPassStats = True, csPassStatsFile = file }
+
 optOutput :: String -> OptFunc
 optOutput s ps = return $ ps { csOutputFile = s }
 
@@ -199,6 +284,15 @@ optOnOff (n, f) s ps
 optUsageChecking :: String -> OptFunc
 optUsageChecking = optOnOff ("usage checking", \m ps -> ps { csUsageChecking = m })
 
+optPassFusion :: String -> OptFunc
+optPassFusion = optOnOff ("pass fusion", \m ps -> ps { csPassFusion = m })
+
+optGatherComms :: String -> OptFunc
+optGatherComms = optOnOff ("gathered communications", \m ps -> ps { csGatherComms = m })
+
+optLineDirectives :: String -> OptFunc
+optLineDirectives = optOnOff ("#line directives", \m ps -> ps { csLineDirectives = m })
+
 optSanityCheck :: String -> OptFunc
 optSanityCheck = optOnOff ("sanity checking", \m ps -> ps { csSanityCheck = m })
 
@@ -217,7 +311,7 @@ getOpts argv =
   case getOpt RequireOrder (optionsNoWarnings ++ optionsWarnings) argv of
     (o,n,[]  ) -> return (o,n)
     (_,_,errs) -> error (concat errs ++ usageInfo header optionsNoWarnings)
-  where header = "Usage: tock [OPTION...] SOURCEFILE"
+  where header = "Usage: tock [OPTION...] SOURCEFILE...\n(more than one SOURCEFILE is only allowed in build mode)"
 
 main :: IO ()
 main = do
@@ -231,14 +325,9 @@ main = do
   -- Try to guess the filename from the extension.  Since this function is
   -- applied before the options are applied, it will be overriden by the
   -- --frontend=x command-line option
-  let (frontendGuess, fileStem)
-                    = if ".occ" `isSuffixOf` fn
-                        then (\ps -> ps {csFrontend = FrontendOccam},
-                              Just $ take (length fn - length ".occ") fn)
-                        else if ".rain" `isSuffixOf` fn
-                          then (\ps -> ps {csFrontend = FrontendRain},
-                                Just $ take (length fn - length ".rain") fn)
-                          else (id, Nothing)
+  let (frontendGuess, fileStem) = guessFrontend $ case args of
+                                    (firstFn:_) -> firstFn
+                                    [] -> fn
 
   res <- runErrorT $ foldl (>>=) (return $ frontendGuess emptyOpts) opts
   case res of
@@ -246,16 +335,173 @@ main = do
     Right initState -> do
       when (csVerboseLevel initState >= 3) $
          liftIO $ hPutStrLn stderr $ "Initial state with args: " ++ show initState
-      let operation = case csMode initState of
-            ModePostC -> useOutputOptions (postCAnalyse fn) >> return ()
-            ModeFull -> evalStateT (unwrapFilesPassM $ compileFull fn fileStem) []
-            mode -> useOutputOptions (compile mode fn)
-
-      -- Run the compiler.
-      v <- runPassM (emptyState { csOpts = initState}) operation
-      case v of
-        (Left e, cs) -> showWarnings (csWarnings cs) >> dieIO e
-        (Right r, cs) -> showWarnings (csWarnings cs)
+      case csMode initState of
+        ModeBuild -> buildModules initState args
+        _ -> do
+          let operation = case csMode initState of
+                ModePostC -> useOutputOptions (postCAnalyse fn) >> return ()
+                ModeFull -> evalStateT (unwrapFilesPassM $ compileFull fn fileStem) []
+                mode -> useOutputOptions (compile mode fn)
+
+          -- Run the compiler.
+          v <- runPassM (emptyState { csOpts = initState}) operation
+          case v of
+            (Left e, cs) -> showWarnings (csWarnings cs) >> dieIO e
+            (Right r, cs) -> do showWarnings (csWarnings cs)
+                                reportPassStats initState [(fn, csPassStats cs)]
+
+-- | Guess the frontend to use, and the stem of the output files, from the
+-- extension of a source file.
+guessFrontend :: String -> (CompOpts -> CompOpts, Maybe String)
+guessFrontend fn
+    = if ".occ" `isSuffixOf` fn
+        then (\ps -> ps {csFrontend = FrontendOccam},
+              Just $ take (length fn - length ".occ") fn)
+        else if ".rain" `isSuffixOf` fn
+          then (\ps -> ps {csFrontend = FrontendRain},
+                Just $ take (length fn - length ".rain") fn)
+          else (id, Nothing)
+
+-- | Build several source files, and the modules that they use, in dependency
+-- order.  Each of the given files is compiled as it would be in full mode;
+-- any module they @#USE@ that we can find the source for is compiled first
+-- (with no main process), as are the modules it uses in turn.  Modules that
+-- don't depend on each other are compiled at the same time, up to the number
+-- of jobs asked for.
+buildModules :: CompOpts -> [String] -> IO ()
+buildModules opts topFiles
+  =  do when (length topFiles > 1 && csOutputFile opts /= "-") $
+          dieIO (Nothing, "Cannot specify an output file when building more than one file")
+        topKeys <- mapM canonicalizePath topFiles
+        modules <- foldM addModule Map.empty topFiles
+        when (csVerboseLevel opts >= 1) $
+          hPutStrLn stderr $ "Building " ++ show (Map.size modules) ++ " modules with "
+            ++ show (csJobs opts) ++ " jobs"
+
+        outputLock <- newMVar ()
+        timings <- newMVar []
+        passStats <- newMVar []
+        startTime <- getCurrentTime
+        results <- runBuildGraph (csJobs opts) (Map.map snd modules) $ \key ->
+          buildModule outputLock timings passStats (fst $ modules Map.! key) (key `elem` topKeys)
+        endTime <- getCurrentTime
+        readMVar passStats >>= reportPassStats opts . reverse
+
+        times <- readMVar timings
+        let wallTime = realToFrac (diffUTCTime endTime startTime) :: Double
+            moduleTime = sum (map snd times)
+        when (csVerboseLevel opts >= 1) $
+          do sequence_ [hPutStrLn stderr $ printf "  %-50s %8.2fs" fn t
+                       | (fn, t) <- sortBy (comparing (negate . snd)) times]
+             hPutStrLn stderr $ printf
+               "Built %d modules in %.2fs (%.2fs compiling modules; speedup %.2fx)"
+               (length times) wallTime moduleTime
+               (if wallTime > 0 then moduleTime / wallTime else 1)
+
+        let problems = [(fst $ modules Map.! key, r)
+                       | (key, r) <- Map.toList results, r /= BuildOK]
+        sequence_ [hPutStrLn stderr $ "Not built: " ++ intercalate ", " (map (fst . (modules Map.!)) ks)
+                                      ++ (if length ks == 1 then " (it #USEs itself)"
+                                                            else " (they #USE each other in a cycle)")
+                  | ks <- findCycles (Map.map snd modules)]
+        sequence_ [hPutStrLn stderr $ "Not built: " ++ fn
+                                      ++ " (it uses a module that was not built)"
+                  | (fn, BuildSkipped) <- problems]
+        when (not $ null problems) $
+          exitWith $ ExitFailure 1
+  where
+    -- Add a module and everything it uses to the map, which goes from the
+    -- canonical path of each module to its path as we found it and the
+    -- modules that it uses.
+    addModule :: Map.Map FilePath (FilePath, [FilePath]) -> FilePath
+                 -> IO (Map.Map FilePath (FilePath, [FilePath]))
+    addModule mods fn
+      =  do key <- canonicalizePath fn
+            if key `Map.member` mods
+              then return mods
+              else do uses <- if ".occ" `isSuffixOf` fn
+                                then findUses [] [fn]
+                                else return []
+                      depFiles <- mapM (\(user, name) -> searchExisting user (dropTockInc name ++ ".occ")) uses
+                                    >>* catMaybes
+                      depKeys <- mapM canonicalizePath depFiles
+                      foldM addModule (Map.insert key (fn, nub depKeys) mods) depFiles
+
+    -- Find the modules that some files use, either directly or through
+    -- files that they include.  Each module name is paired with the file that
+    -- used it, since that's where the search for it starts.
+    findUses :: [FilePath] -> [FilePath] -> IO [(FilePath, String)]
+    findUses _ [] = return []
+    findUses seen (fn:fns)
+      | fn `elem` seen = findUses seen fns
+      | otherwise
+      =  do src <- maybeIO (readFile fn) >>* fromMaybe ""
+            let (includes, uses) = findDirectives src
+            includeFiles <- mapM (searchExisting fn) includes >>* catMaybes
+            rest <- findUses (fn : seen) (fns ++ includeFiles)
+            return $ [(fn, use) | use <- uses] ++ rest
+
+    -- Search for a file in the same way as the preprocessor does.
+    searchExisting :: FilePath -> String -> IO (Maybe FilePath)
+    searchExisting currentFile name
+      = findM doesFileExist $ joinPath currentFile name
+                                : [dir ++ "/" ++ name | dir <- csSearchPath opts]
+
+    findM :: (a -> IO Bool) -> [a] -> IO (Maybe a)
+    findM _ [] = return Nothing
+    findM f (x:xs) = do b <- f x
+                        if b then return (Just x) else findM f xs
+
+    dropTockInc :: String -> String
+    dropTockInc s
+      | ".tock.inc" `isSuffixOf` s = take (length s - length ".tock.inc") s
+      | otherwise = s
+
+    buildModule :: MVar () -> MVar [(FilePath, Double)] -> MVar [(FilePath, [PassStats])]
+                   -> FilePath -> Bool -> IO Bool
+    buildModule outputLock timings passStats fn top
+      =  do let (frontendGuess, fileStem) = guessFrontend fn
+                opts' = (frontendGuess opts)
+                          { csMode = ModeFull
+                          , csHasMain = top && csHasMain opts
+                          , csOutputFile = if top then csOutputFile opts else "-"
+                          }
+            startTime <- getCurrentTime
+            v <- try $ runPassM (emptyState { csOpts = opts' })
+                         (evalStateT (unwrapFilesPassM $ compileFull fn fileStem) [])
+            endTime <- getCurrentTime
+            modifyMVar_ timings $
+              return . ((fn, realToFrac $ diffUTCTime endTime startTime) :)
+            -- Don't let the messages from different modules get mixed up:
+            withMVar outputLock $ \_ ->
+              case v of
+                Left err ->
+                  do hPutStrLn stderr $ show (err :: SomeException)
+                     return False
+                Right (Left e, cs) ->
+                  do showWarnings (csWarnings cs)
+                     r <- try (dieIO e :: IO ())
+                     case r of
+                       Left (ErrorCall msg) -> hPutStr stderr msg
+                       Right () -> return ()
+                     return False
+                Right (Right _, cs) ->
+                  do showWarnings (csWarnings cs)
+                     modifyMVar_ passStats $ return . ((fn, csPassStats cs) :)
+                     return True
+
+-- | Print the statistics recorded by --pass-stats for some source files, and
+-- write them out as JSON if asked.
+reportPassStats :: CompOpts -> [(FilePath, [PassStats])] -> IO ()
+reportPassStats opts stats
+  = when (csRecordPassStats opts) $
+     do sequence_ [hPutStrLn stderr ("Pass statistics for " ++ fn ++ ":")
+                     >> hPutStr stderr (formatPassStats $ reverse ps)
+                  | (fn, ps) <- stats]
+        case csPassStatsFile opts of
+          Just file -> writeFile file $ "[" ++ intercalate ",\n "
+                         [passStatsJSON fn (reverse ps) | (fn, ps) <- stats] ++ "]\n"
+          Nothing -> return ()
 
 removeFiles :: [FilePath] -> IO ()
 removeFiles = mapM_ (\file -> catch (removeFile file) doNothing)
@@ -305,45 +551,94 @@ compileFull inputFile moutputFile
                             BackendCHP -> (".hs", error "CHP backend")
                             _ -> ("", "")
 
-          -- Translate input file to C/C++
           let cFile = outputFile ++ cExtension
               hFile = outputFile ++ hExtension
               iFile = outputFile ++ ".tock.inc"
-          modifyCompOpts $ \cs -> cs { csOutputIncFile = Just iFile }
-          withOutputFile cFile $ \hb ->
-            withOutputFile hFile $ \hh ->
-                FilesPassM $ lift $ compile ModeCompile inputFile ((hb, hh), hFile)
+              oFile = outputFile ++ ".tock.o"
+              sizesFile = outputFile ++ ".tock.sizes"
+              mapFile = outputFile ++ ".tock.map"
+          modifyCompOpts $ \cs -> cs { csOutputIncFile = Just iFile
+                                     , csOutputCodeFile = Just cFile
+                                     , csSymbolMapFile = Just mapFile }
+
+          -- Load the source, and see whether we've compiled it before
+          source <- FilesPassM $ lift $ loadSource inputFile
+          cacheOpts <- getCompOpts
+          let cacheEntry
+                = case csCacheDir cacheOpts of
+                    Just dir | csBackend cacheOpts `elem` [BackendC, BackendCPPCSP]
+                      -> Just (dir, cacheKey cacheOpts outputFile (sourceText source))
+                    _ -> Nothing
+              cachedFiles = [(cExtension, cFile), (hExtension, hFile)
+                            ,(".tock.inc", iFile), (".tock.o", oFile)
+                            ,(".tock.sizes", sizesFile), (".tock.map", mapFile)]
+              storeInCache = doMaybe $ do (dir, key) <- cacheEntry
+                                          return $ liftIO $ storeCache dir key cachedFiles
+          cached <- case cacheEntry of
+            Just (dir, key) -> liftIO $ lookupCache dir key cachedFiles
+            Nothing -> return False
+          when cached $
+            progress $ "Using cached compilation results for " ++ inputFile
+
+          -- Translate input file to C/C++
+          when (not cached) $ do
+            withOutputFile cFile $ \hb ->
+              withOutputFile hFile $ \hh ->
+                  FilesPassM $ lift $ compileSource ModeCompile inputFile source ((hb, hh), hFile)
+            when (csRunIndent optsPS) $
+              exec $ "indent " ++ cFile
           noteFile cFile
-          when (csRunIndent optsPS) $
-            exec $ "indent " ++ cFile
 
           cs <- getCompState
           case csBackend (csOpts cs) of
             BackendC ->
               let sFile = outputFile ++ ".tock.s"
-                  oFile = outputFile ++ ".tock.o"
-                  sizesFile = outputFile ++ ".tock.sizes"
+                  suFile = outputFile ++ ".tock.su"
+                  ciFile = outputFile ++ ".tock.ci"
                   postCFile = outputFile ++ ".tock_post.c"
                   postOFile = outputFile ++ ".tock_post.o"
+                  analysisFiles = case csStackAnalysis (csOpts cs) of
+                                    StackAnalysisAsm -> [sFile]
+                                    StackAnalysisUsage -> [suFile, ciFile]
               in
-              do sequence_ $ map noteFile $ [sFile, postCFile, postOFile]
+              do sequence_ $ map noteFile $ analysisFiles ++ [postCFile, postOFile]
                                ++ if csHasMain (csOpts cs) then [oFile] else []
                                -- The object file is a temporary to-be-removed
                                -- iff we are also linking the end product
 
-                 -- Compile the C into assembly, and assembly into an object file
-                 exec $ cAsmCommand cFile sFile (csCompilerFlags $ csOpts cs)
-                 exec $ cCommand sFile oFile (csCompilerFlags $ csOpts cs)
-                 -- Analyse the assembly for stack sizes, and output a
-                 -- "post" H file
-                 sizes <- withOutputFile sizesFile $ \h -> FilesPassM $ lift $
-                   postCAnalyse sFile ((h,intErr),intErr)
+                 sizes <- if cached
+                   then liftIO $ readFileStrictly sizesFile
+                   else
+                    do case csStackAnalysis (csOpts cs) of
+                         -- Compile the C into assembly, and assembly into an object file
+                         StackAnalysisAsm ->
+                           do exec $ cAsmCommand cFile sFile (csCompilerFlags $ csOpts cs)
+                              exec $ cCommand sFile oFile (csCompilerFlags $ csOpts cs)
+                         -- Compile the C straight into an object file, getting the
+                         -- compiler to tell us about stack usage as it goes
+                         StackAnalysisUsage ->
+                           exec $ cCommand cFile oFile
+                             (cStackUsageFlags ++ " " ++ csCompilerFlags (csOpts cs))
+                       -- Analyse the assembly (or stack usage) for stack sizes, and
+                       -- output a "post" H file
+                       sizes <- withOutputFile sizesFile $ \h -> FilesPassM $ lift $
+                         postCAnalyse (head analysisFiles) ((h,intErr),intErr)
+                       storeInCache
+                       return sizes
 
                  when (csHasMain $ csOpts cs) $ do
+                   staticSizes <- computeFinalStackSizeList searchReadFile
+                     (csUnknownStackSize $ csOpts cs) (Meta (Just sizesFile) 1 1) sizes
+                   -- Measured sizes from a stack profile can raise the static
+                   -- estimates (or replace them, with --stack-profile-trust):
+                   let finalSizes = [(nm, profiledStaticStackSize (csOpts cs) nm size)
+                                    | (nm, size) <- staticSizes]
+                   progress "Stack budgets (bytes):"
+                   progress $ concat [printf "  %-50s %8d\n" nm size
+                                     | (nm, size) <- sortBy (comparing (negate . snd)) finalSizes]
                    withOutputFile postCFile $ \h ->
-                     computeFinalStackSizes searchReadFile (csUnknownStackSize $ csOpts cs)
-                       (Meta (Just sizesFile) 1 1) sizes >>= (liftIO . hPutStr h)
-                     
+                     liftIO $ hPutStr h $ stackSizesToC finalSizes
+
                    -- Compile this new "post" C file into an object file
                    exec $ cCommand postCFile postOFile (csCompilerFlags $ csOpts cs)
 
@@ -360,12 +655,15 @@ compileFull inputFile moutputFile
                  if csHasMain $ csOpts cs
                    then let otherOFiles = [usedFile ++ ".tock.o"
                                           | usedFile <- Set.toList $ csUsedFiles cs]
-                     in exec $ cxxCommand cFile outputFile
-                          (concat (intersperse " " otherOFiles) ++ " "
-                            ++ csCompilerFlags (csOpts cs) ++ " "
-                            ++ csCompilerLinkFlags (csOpts cs))
-                   else exec $ cxxCommand cFile (outputFile ++ ".tock.o")
+                     in do when (not cached) storeInCache
+                           exec $ cxxCommand cFile outputFile
+                             (concat (intersperse " " otherOFiles) ++ " "
+                               ++ csCompilerFlags (csOpts cs) ++ " "
+                               ++ csCompilerLinkFlags (csOpts cs))
+                   else when (not cached) $
+                     do exec $ cxxCommand cFile oFile
                           ("-c " ++ csCompilerFlags (csOpts cs))
+                        storeInCache
 
             BackendCHP ->
               exec $ hCommand cFile outputFile
@@ -400,6 +698,11 @@ compileFull inputFile moutputFile
                     ExitSuccess -> return ()
                     ExitFailure n -> dieReport (Nothing, "Command \"" ++ cmd ++ "\" failed: exited with code: " ++ show n)
 
+    readFileStrictly :: FilePath -> IO String
+    readFileStrictly fn
+      = do s <- readFile fn
+           length s `seq` return s
+
     searchReadFile :: Meta -> String -> FilesPassM String
     searchReadFile m fn
       = do (h, _) <- searchFile m inputFile fn
@@ -410,6 +713,8 @@ compileFull inputFile moutputFile
 useOutputOptions :: (((Handle, Handle), String) -> PassM a) -> PassM a
 useOutputOptions func
   =  do optsPS <- getCompOpts
+        when (csOutputFile optsPS /= "-") $
+          modifyCompOpts $ \cs -> cs { csOutputCodeFile = Just $ csOutputFile optsPS }
         withHandleFor (csOutputFile optsPS) $ \hb ->
           withHandleFor (csOutputHeaderFile optsPS) $ \hh ->
               func ((hb, hh), csOutputHeaderFile optsPS)
@@ -459,26 +764,51 @@ showTokens html ts = evalState (mapM showToken ts >>* spaceOut) 0
                             else (" ", "\n", id)
 
 
+-- | A loaded source file: either preprocessed occam tokens, or Rain source.
+type Source = Either [Token] String
+
+-- | Load a source file.  occam sources are preprocessed, which pulls in any
+-- files they #INCLUDE or #USE; Rain sources are just read.
+loadSource :: String -> PassM Source
+loadSource fn
+  =  do optsPS <- getCompOpts
+        case csFrontend optsPS of
+          FrontendOccam -> recordPhase "Lex and preprocess" Nothing (Just . length)
+                             (preprocessOccamProgram fn) >>* (Left . fst)
+          FrontendRain -> liftIO (readFile fn) >>* Right
+
+-- | The text of a loaded source file, for hashing.
+sourceText :: Source -> String
+sourceText (Left toks) = unlines [show m ++ " " ++ show tt | Token m tt <- toks]
+sourceText (Right s) = s
+
 -- | Compile a file.
 -- This is written in the PassM monad -- as are most of the things it calls --
 -- because then it's very easy to pass the state around.
 compile :: CompMode -> String -> ((Handle, Handle), String) -> PassM ()
-compile mode fn (outHandles@(outHandle, _), headerName)
+compile mode fn outputs
+  =  do source <- loadSource fn
+        compileSource mode fn source outputs
+
+-- | Compile a source file that has already been loaded.
+compileSource :: CompMode -> String -> Source -> ((Handle, Handle), String) -> PassM ()
+compileSource mode fn source (outHandles@(outHandle, _), headerName)
   =  do optsPS <- getCompOpts
 
         debug "{{{ Parse"
         progress "Parse"
-        (ast1, lexed) <- case csFrontend optsPS of
-          FrontendOccam ->
-            do lexed <- preprocessOccamProgram fn
+        (ast1, lexed) <- case source of
+          Left lexed ->
                case mode of
                  -- In lex mode, don't parse, because it will probably fail anyway:
                  ModeLex -> return (A.Only emptyMeta (), lexed)
                  ModeHTML -> return (A.Only emptyMeta (), lexed)
-                 _ -> do parsed <- parseOccamProgram lexed
+                 _ -> do (parsed, _) <- recordPhase "Parse" (Just $ length lexed) (Just . gsize)
+                                          (parseOccamProgram lexed)
                          return (parsed, lexed)
-          FrontendRain -> do parsed <- liftIO (readFile fn) >>= parseRainProgram fn
-                             return (parsed, [])
+          Right src -> do (parsed, _) <- recordPhase "Lex and parse" Nothing (Just . gsize)
+                                           (parseRainProgram fn src)
+                          return (parsed, [])
         debugAST ast1
         debug "}}}"
 
@@ -522,22 +852,31 @@ compile mode fn (outHandles@(outHandle, _), headerName)
 
                            BackendDumpAST -> liftIO . hPutStr outHandle . pshow
                            BackendSource -> (liftIO . hPutStr outHandle) <.< showCode
-                 generator ast2
+                 recordPhase_ ("Backend: " ++ show (csBackend optsPS)) $ generator ast2
                  debug "}}}"
 
         progress "Done"
 
--- | Analyse an assembly file.
+-- | Analyse an assembly file, or a stack usage file (in which case the
+-- matching call graph file is read too).
 postCAnalyse :: String -> ((Handle, Handle), String) -> PassM String
 postCAnalyse fn ((outHandle, _), _)
-    =  do asm <- liftIO $ readFile fn
-
-          names <- needStackSizes
+    =  do names <- needStackSizes
           cs <- getCompState
 
-          progress "Analysing assembly"
-          output <- analyseAsm (Just $ map A.nameName names)
-            (map (basenamePath . (++ ".tock.sizes")) $ csExtraSizes cs ++ Set.toList (csUsedFiles cs)) asm
+          let procs = Just $ map A.nameName names
+              deps = map (basenamePath . (++ ".tock.sizes")) $
+                       csExtraSizes cs ++ Set.toList (csUsedFiles cs)
+          output <- case csStackAnalysis (csOpts cs) of
+            StackAnalysisAsm ->
+              do asm <- liftIO $ readFile fn
+                 progress "Analysing assembly"
+                 analyseAsm procs deps asm
+            StackAnalysisUsage ->
+              do su <- liftIO $ readFile fn
+                 ci <- liftIO $ readFile $ fst (splitExtension fn) ++ ".ci"
+                 progress "Analysing stack usage"
+                 analyseStackUsage procs deps su ci
 
           liftIO $ hPutStr outHandle output
 
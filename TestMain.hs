@@ -25,6 +25,8 @@ with this program.  If not, see <http://www.gnu.org/licenses/>.
 --
 -- * "BackendPassesTest"
 --
+-- * "BuildGraphTest"
+--
 -- * "CheckTest"
 --
 -- * "CommonTest"
@@ -67,6 +69,7 @@ import Test.HUnit
 import qualified AnalyseAsmTest (tests)
 import qualified ArrayUsageCheckTest (vioqcTests)
 import qualified BackendPassesTest (qcTests)
+import qualified BuildGraphTest (tests)
 import qualified CheckTest (viotests)
 import qualified CommonTest (tests)
 import qualified FlowGraphTest (qcTests)
@@ -189,6 +192,7 @@ main = do (opts, nonOpts, errs) <- getArgs >>* getOpt RequireOrder options
               noqc AnalyseAsmTest.tests
               ,ArrayUsageCheckTest.vioqcTests v
               ,return BackendPassesTest.qcTests
+              ,noqc BuildGraphTest.tests
               ,noqcButIO $ CheckTest.viotests v
               ,noqc CommonTest.tests
               ,return FlowGraphTest.qcTests
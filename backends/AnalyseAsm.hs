@@ -18,13 +18,20 @@ with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 -- | Analyse the assembly output from the C compiler for stack size
 -- information.
+--
+-- As an alternative to scraping assembly, this module can also read the
+-- per-function stack usage (@.su@) and call graph (@.ci@) files that GCC
+-- produces with @-fstack-usage -fcallgraph-info=su@; this works on any
+-- architecture and doesn't need a separate compile to assembly.
 
--- FIXME: This only works for x86 at the moment.
+-- FIXME: The assembly analysis only works for x86 at the moment.
 -- FIXME: This should have a "just use a huge fixed number" mode for debugging.
 
 module AnalyseAsm (
     AsmItem(..),
-    parseAsmLine, analyseAsm, computeFinalStackSizes
+    parseAsmLine, parseStackUsageLine, parseCallGraphLine,
+    analyseAsm, analyseStackUsage,
+    computeFinalStackSizeList, stackSizesToC
   ) where
 
 import Control.Arrow
@@ -51,6 +58,9 @@ data AsmItem =
   AsmLabel String
   | AsmStackInc Integer
   | AsmCall String
+  -- | The function allocates an amount of stack that can't be known statically
+  -- (e.g. with alloca or a variable-length array).
+  | AsmUnboundedStack
   deriving (Show, Eq, Data, Typeable)
 
 -- | Examine a line of the assembly source to see whether it's something we're
@@ -107,6 +117,59 @@ parseAsm :: String -> [AsmItem]
 parseAsm asm
   = catMaybes [parseAsmLine l | l <- lines asm]
 
+-- | Examine a line of a stack usage (@.su@) file.  Each line looks like
+-- @file.c:12:6:func\t48\tstatic@; we return the function name, the number of
+-- bytes, and whether that number is an upper bound.  This is the format GCC
+-- writes with @-fstack-usage@ (Clang's is the same), but the call graph comes
+-- from GCC's @-fcallgraph-info@, which Clang doesn't have.
+parseStackUsageLine :: String -> Maybe (String, Integer, Bool)
+parseStackUsageLine s
+    = case splitTabs s of
+        [loc, size, qual] ->
+          case (readDec size, reverse $ takeWhile (/= ':') $ reverse loc) of
+            ([(n, "")], func@(_:_)) -> Just (func, n, qual /= "dynamic")
+            _ -> Nothing
+        _ -> Nothing
+  where
+    splitTabs :: String -> [String]
+    splitTabs str = case break (== '\t') str of
+                      (x, []) -> [x]
+                      (x, _:rest) -> x : splitTabs rest
+
+-- | Examine a line of a GCC call graph (@.ci@) file, which is in VCG format.
+-- We're only interested in the edges, which look like
+-- @edge: { sourcename: \"foo\" targetname: \"bar\" ... }@.
+-- Indirect calls have a target of @__indirect_call@, and are ignored just
+-- like indirect calls in the assembly analysis.
+parseCallGraphLine :: String -> Maybe (String, String)
+parseCallGraphLine s
+    = case words s of
+        ("edge:":rest) ->
+          case (field "sourcename:" rest, field "targetname:" rest) of
+            (Just _, Just "__indirect_call") -> Nothing
+            (Just from, Just to) -> Just (from, to)
+            _ -> Nothing
+        _ -> Nothing
+  where
+    field :: String -> [String] -> Maybe String
+    field name ws
+        = case dropWhile (/= name) ws of
+            (_:('"':v):_) | not (null v) && last v == '"' -> Just $ init v
+            _ -> Nothing
+
+-- | Turn the contents of a stack usage file and a call graph file into a list
+-- of interesting things, in the same form as 'parseAsm' produces.
+parseStackUsage :: String -> String -> [AsmItem]
+parseStackUsage su ci
+    = concat [AsmLabel func : AsmStackInc n
+                : [AsmUnboundedStack | not bounded]
+                ++ map AsmCall (Map.findWithDefault [] func calls)
+             | (func, n, bounded) <- mapMaybe parseStackUsageLine $ lines su]
+  where
+    calls :: Map.Map String [String]
+    calls = Map.fromListWith (flip (++))
+              [(from, [to]) | (from, to) <- nub $ mapMaybe parseCallGraphLine $ lines ci]
+
 data Depends
   = DependsOnSizes String
   deriving (Show, Read)
@@ -158,6 +221,7 @@ data FunctionInfo = FunctionInfo {
     fiStack :: Integer
   , fiTotalStack :: Maybe StackInfo
   , fiCalls :: Set.Set String
+  , fiUnbounded :: Bool
   }
   deriving (Show, Data, Typeable)
 
@@ -166,6 +230,7 @@ emptyFI = FunctionInfo {
     fiStack = 0
   , fiTotalStack = Nothing
   , fiCalls = Set.empty
+  , fiUnbounded = False
   }
 
 -- | Monad for `AnalyseAsm` operations.
@@ -196,6 +261,10 @@ collectInfo ais = collectInfo' ais ""
                           (func, fi {
                                    fiCalls = Set.insert callFunc $ fiCalls fi
                                  })
+                        AsmUnboundedStack ->
+                          (func, fi {
+                                   fiUnbounded = True
+                                 })
               modify $ Map.insert func fi'
               collectInfo' ais func'
 
@@ -246,7 +315,12 @@ addCalls knownProcs
     userFunc fi
         =  do let localStack = fiStack fi + baseStackSize
               calledStacks <- mapM (computeStack False) $ Set.toList $ fiCalls fi
-              return $ foldl mergeStackInfo (StackInfo localStack Set.empty Set.empty) calledStacks
+              -- A function with a dynamically-sized frame is treated as if it
+              -- called an unknown function:
+              let unbounded = if fiUnbounded fi
+                                then Set.singleton "<dynamic stack>"
+                                else Set.empty
+              return $ foldl mergeStackInfo (StackInfo localStack Set.empty unbounded) calledStacks
      where
        mergeStackInfo (StackInfo n as bs) (StackInfo n' as' bs')
          = StackInfo (n + n') (as `Set.union` as') (bs `Set.union` bs')
@@ -327,11 +401,27 @@ substitutePartial origItems = substitute' [] origItems
 -- to mark as occam and which to mark as unknown external.
 --
 -- The return value is a string to be written to a file, that can later be read
--- in and understood by computeFinalStackSizes
+-- in and understood by computeFinalStackSizeList
 analyseAsm :: Maybe [String] -> [String] -> String -> PassM String
-analyseAsm mprocs deps asm
-  =  do let stream = parseAsm asm
-        veryDebug $ pshow stream
+analyseAsm mprocs deps asm = analyseItems mprocs deps (parseAsm asm)
+
+-- | Analyse the stack usage and call graph files produced by the C compiler,
+-- and return C source defining sizes.
+--
+-- The parameters and return value are as for 'analyseAsm', but rather than
+-- assembly source this takes the contents of the @.su@ and @.ci@ files.
+analyseStackUsage :: Maybe [String] -> [String] -> String -> String -> PassM String
+analyseStackUsage mprocs deps su ci
+  =  do let stream = parseStackUsage su ci
+        sequence_ [warnPlainP WarnInternal $ "Function " ++ func
+                     ++ " has a dynamically-sized stack frame; allocating arbitrary stack"
+                  | (func, _, False) <- mapMaybe parseStackUsageLine $ lines su]
+        analyseItems mprocs deps stream
+
+-- | Analyse a stream of interesting things, from either source.
+analyseItems :: Maybe [String] -> [String] -> [AsmItem] -> PassM String
+analyseItems mprocs deps stream
+  =  do veryDebug $ pshow stream
         cs <- getCompState
         info <- execStateT (collectInfo stream >> addCalls (fromMaybe [] mprocs)) Map.empty
         debug $ "Analysed function information:"
@@ -349,19 +439,25 @@ analyseAsm mprocs deps asm
       Nothing -> id
       Just m -> (`Map.intersection` (Map.fromList (zip m (repeat ()))))
 
+-- | Turn a list of final stack sizes into C source defining them.
+stackSizesToC :: [(String, Integer)] -> String
+stackSizesToC info = unlines [ "const int " ++ nm ++ "_stack_size = " ++ show s ++ ";\n"
+                             | (nm, s) <- info]
+
+-- | Work out the final stack size (in bytes) of each function; use
+-- 'stackSizesToC' to turn the result into C source.
+--
 -- The String is the contents of the stack sizes file for the last one in the chain,
 -- straight from analyseAsm.  The function is used to read in files when needed,
--- by looking in the search path.  The Int is the unknown-stack-size.
---
--- The output is the contents of a C file with all the stack sizes.
-computeFinalStackSizes :: forall m. (Monad m, Die m) => (Meta -> String -> m String) -> Integer -> Meta
-  -> String -> m String
-computeFinalStackSizes readSizesFor unknownSize m beginSizes
+-- by looking in the search path.  The Integer is the unknown-stack-size.
+computeFinalStackSizeList :: forall m. (Monad m, Die m) => (Meta -> String -> m String) -> Integer -> Meta
+  -> String -> m [(String, Integer)]
+computeFinalStackSizeList readSizesFor unknownSize m beginSizes
   = do infos <- evalStateT (readInAll m beginSizes) Set.empty
        let finalised = substituteFull unknownSize infos
        case finalised of
          Left err -> dieP emptyMeta err
-         Right x -> return $ toC x
+         Right x -> return x
   where
     readInAll :: Meta -> String -> StateT (Set.Set String) m [(String, StackInfo)]
     readInAll curFile contents
@@ -384,7 +480,3 @@ computeFinalStackSizes readSizesFor unknownSize m beginSizes
         liftM (transformPair ((m { metaLine = n}, dep):) id) $ split m ls
       ([], [(s, rest)]) | all isSpace rest -> liftM (transformPair id (s:)) $ split m ls
       _ -> dieP (m {metaLine = n}) $ "Cannot parse line: " ++ l
-
-    toC :: [(String, Integer)] -> String
-    toC info = unlines [ "const int " ++ nm ++ "_stack_size = " ++ show s ++ ";\n"
-                       | (nm, s) <- info]
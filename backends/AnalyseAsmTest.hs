@@ -64,7 +64,34 @@ testParse = TestList
     testLine n s exp = TestCase $ assertEqual ("testParse" ++ show n)
                                               exp (parseAsmLine s)
 
+testParseStackUsage :: Test
+testParseStackUsage = TestList
+    [ testSU   50 "" Nothing
+    , testSU   51 "foo.c:1:2:foo" Nothing
+    , testSU   52 "foo.c:1:2:foo\tabc\tstatic" Nothing
+
+    , testSU  100 "foo.c:12:6:foo\t48\tstatic" $ Just ("foo", 48, True)
+    , testSU  101 "foo.c:12:foo\t48\tstatic" $ Just ("foo", 48, True)
+    , testSU  102 "foo.c:12:6:foo\t48\tdynamic,bounded" $ Just ("foo", 48, True)
+    , testSU  103 "foo.c:12:6:foo\t48\tdynamic" $ Just ("foo", 48, False)
+
+    , testCI  200 "" Nothing
+    , testCI  201 "node: { title: \"foo\" label: \"foo\\nfoo.c:5:5\" }" Nothing
+    , testCI  202 "edge: { sourcename: \"foo\" targetname: \"bar\" label: \"foo.c:5:40\" }"
+                  $ Just ("foo", "bar")
+    , testCI  203 "edge: { sourcename: \"foo\" targetname: \"__indirect_call\" }" Nothing
+    ]
+  where
+    testSU :: Int -> String -> Maybe (String, Integer, Bool) -> Test
+    testSU n s exp = TestCase $ assertEqual ("testParseStackUsage" ++ show n)
+                                            exp (parseStackUsageLine s)
+
+    testCI :: Int -> String -> Maybe (String, String) -> Test
+    testCI n s exp = TestCase $ assertEqual ("testParseStackUsage" ++ show n)
+                                            exp (parseCallGraphLine s)
+
 tests :: Test
 tests = TestLabel "AnalyseAsmTest" $ TestList
     [ testParse
+    , testParseStackUsage
     ]
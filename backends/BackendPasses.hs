@@ -17,14 +17,15 @@ with this program.  If not, see <http://www.gnu.org/licenses/>.
 -}
 
 -- | Passes associated with the backends
-module BackendPasses (backendPasses, transformWaitFor, declareSizesArray) where
+module BackendPasses (backendPasses, bufferedChannelPasses, checkBufferedChannels, splitBufferedChannels, transformWaitFor, declareSizesArray, writeSymbolMap) where
 
 import Control.Monad.Error
 import Control.Monad.State
-import Data.Generics (Data)
+import Data.Generics (Data, listify)
 import Data.List
 import qualified Data.Map as Map
 import Data.Maybe
+import qualified Data.Set as Set
 
 import qualified AST as A
 import CompState
@@ -49,6 +50,7 @@ backendPasses =
   , fixMinInt
   , pullAllocMobile
   , fixMobileForkParams
+  , writeSymbolMap
 -- This is not needed unless forking:
 --  , mobileReturn
   ]
@@ -56,12 +58,156 @@ backendPasses =
 prereq :: [Property]
 prereq = Prop.agg_namesDone ++ Prop.agg_typesDone ++ Prop.agg_functionsGone ++ [Prop.subscriptsPulledUp, Prop.arrayLiteralsExpanded]
 
+-- | The passes for channels given buffers by #PRAGMA BUFFERED.  These run
+-- before PAR branches are turned into PROCs and free names into parameters,
+-- so that the channels those PROCs are given are already the writer's and
+-- the reader's, and nothing after that needs to know which are buffered.
+bufferedChannelPasses :: [Pass A.AST]
+bufferedChannelPasses =
+  [ checkBufferedChannels
+  , splitBufferedChannels
+  ]
+
+-- | Check that the channels given buffers by #PRAGMA BUFFERED are ones that
+-- the backends can buffer: unshared channels, declared locally, that carry
+-- fixed-size non-mobile data.  C++CSP2's buffers hold the tockSendableArray
+-- that the writer sends, which only points at the writer's array, so the C++
+-- backend can't buffer arrays at all.
+checkBufferedChannels :: Pass t
+checkBufferedChannels
+    = cOrCppOnlyPass "Check buffered channels"
+                     prereq
+                     []
+                     (\t -> checkNames >> return t)
+  where
+    checkNames :: PassM ()
+    checkNames
+      = do attrs <- getCompState >>* csNameAttr
+           sequence_ [checkName n | (n, as) <- Map.toList attrs
+                                  , NameBuffered _ <- Set.toList as]
+
+    checkName :: String -> PassM ()
+    checkName n
+      = do nd <- lookupName $ A.Name emptyMeta n
+           case A.ndSpecType nd of
+             A.Declaration _ (A.Chan (A.ChanAttributes A.Unshared A.Unshared) t)
+               -> checkProtocol (A.ndMeta nd) t
+             _ -> dieP (A.ndMeta nd) $ A.ndOrigName nd
+                    ++ " cannot be buffered: only unshared channel declarations can be"
+
+    checkProtocol :: Meta -> A.Type -> PassM ()
+    checkProtocol m t
+      = do mobile <- isMobileType t
+           when (mobile || not (fixedSize t)) $
+             diePC m $ formatCode "Channels carrying % cannot be buffered" t
+           backend <- getCompOpts >>* csBackend
+           when (backend == BackendCPPCSP && isArray t) $
+             diePC m $ formatCode "Channels carrying % cannot be buffered by the C++ backend" t
+
+    isArray :: A.Type -> Bool
+    isArray (A.Array {}) = True
+    isArray _ = False
+
+    fixedSize :: A.Type -> Bool
+    fixedSize (A.UserProtocol _) = False
+    fixedSize A.Any = False
+    fixedSize (A.Counted _ _) = False
+    fixedSize (A.Array ds _) = A.UnknownDimension `notElem` ds
+    fixedSize _ = True
+
+type BufferedChanOps = A.Process :-* A.Alternative :-* A.Variable :-* ExtOpMS BaseOpM
+
+-- | Give the reader of each buffered channel a channel of its own for the C
+-- backend, which connects the two through a tock_buffered_chan when it
+-- declares the original channel.  Everything that reads from the channel,
+-- directly or by taking its input end, is changed to use the reader's
+-- channel instead.  Anything that's given the whole channel could use either
+-- end, so that isn't allowed.
+splitBufferedChannels :: PassOnOps BufferedChanOps
+splitBufferedChannels
+    = cOnlyPass "Split buffered channels into writer and reader channels"
+                prereq
+                []
+                recurse
+  where
+    ops :: BufferedChanOps PassM
+    ops = doProcess :-* doAlternative :-* doVariable :-* opMS (ops, doStructured)
+
+    recurse :: RecurseM PassM BufferedChanOps
+    recurse = makeRecurseM ops
+    descend :: DescendM PassM BufferedChanOps
+    descend = makeDescendM ops
+
+    -- The reader's channel is declared outside the original, so that it's
+    -- still there when the buffer is freed.
+    doStructured :: TransformStructured' BufferedChanOps
+    doStructured (A.Spec m spec@(A.Specification m' n decl@(A.Declaration {})) body)
+      = do body' <- recurse body
+           size <- bufferedChanSize n
+           case size of
+             Nothing -> return $ A.Spec m spec body'
+             Just _ ->
+               do let reader = bufferedReaderName n
+                  nd <- lookupName n
+                  defineName reader $ nd { A.ndName = A.nameName reader }
+                  return $ A.Spec m (A.Specification m' reader decl) $
+                    A.Spec m spec body'
+    doStructured s@(A.Spec _ (A.Specification _ _ (A.Is _ _ _ (A.ActualVariable v))) _)
+      = do checkWhole "abbreviated" v
+           descend s
+    doStructured s = descend s
+
+    doProcess :: Transform A.Process
+    doProcess p
+      = do p' <- descend p
+           case p' of
+             A.Input m v im -> do v' <- readerOf v
+                                  return $ A.Input m v' im
+             A.ProcCall m n as -> do sequence_ [checkWhole "passed" v
+                                                | A.ActualVariable v <- as]
+                                     return p'
+             _ -> return p'
+
+    doAlternative :: Transform A.Alternative
+    doAlternative a
+      = do a' <- descend a
+           case a' of
+             A.Alternative m e v im body -> do v' <- readerOf v
+                                               return $ A.Alternative m e v' im body
+             _ -> return a'
+
+    doVariable :: Transform A.Variable
+    doVariable v
+      = do v' <- descend v
+           case v' of
+             A.DirectedVariable m A.DirInput cv -> liftM (A.DirectedVariable m A.DirInput) $
+                                                     readerOf cv
+             _ -> return v'
+
+    readerOf :: Transform A.Variable
+    readerOf v@(A.Variable m n)
+      = do size <- bufferedChanSize n
+           return $ if isJust size then A.Variable m (bufferedReaderName n) else v
+    readerOf v = return v
+
+    -- The wrappers that PAR branches are turned into don't exist yet, so
+    -- this only catches PROC calls and abbreviations in the program itself.
+    checkWhole :: String -> A.Variable -> PassM ()
+    checkWhole how (A.Variable m n)
+      = do size <- bufferedChanSize n
+           when (isJust size) $
+             do nd <- lookupName n
+                dieP m $ "Buffered channel " ++ A.ndOrigName nd
+                  ++ " must be " ++ how ++ " as one of its ends (c? or c!)"
+    checkWhole _ _ = return ()
+
 -- | Remove all variable directions for the C backend.
 -- They're unimportant in occam code once the directions have been checked,
 -- and this somewhat simplifies the work of the later passes.
 removeDirectionsForC :: PassOn A.Variable
 removeDirectionsForC
-    = occamAndCOnlyPass "Remove variable directions"
+    = fusible (noTransforms { ntVariable = return . doVariable }) $
+      occamAndCOnlyPass "Remove variable directions"
                     prereq
                     [Prop.directionsRemoved]
                     (applyBottomUpM (return . doVariable))
@@ -81,7 +227,8 @@ removeDirectionsForC
 -- arrays should already have been pulled up).
 removeUnneededDirections :: PassOn A.Variable
 removeUnneededDirections
-  = occamOnlyPass "Remove unneeded variable directions"
+  = fusible (noTransforms { ntVariable = doVariable }) $
+    occamOnlyPass "Remove unneeded variable directions"
                   prereq
                   []
                   (applyBottomUpM doVariable)
@@ -547,7 +694,8 @@ declareSizesArray = occamOnlyPass "Declare array-size arrays"
 
 -- | Transforms all slices into the FromFor form.
 simplifySlices :: PassOn A.Variable
-simplifySlices = occamOnlyPass "Simplify array slices"
+simplifySlices = fusible (noTransforms { ntVariable = doVariable }) $
+  occamOnlyPass "Simplify array slices"
   prereq
   [Prop.slicesSimplified]
   (applyBottomUpM doVariable)
@@ -603,6 +751,59 @@ fixMobileForkParams = cOnlyPass "Fix abbreviation modes of MOBILE params to FORK
                      return $ A.Formal A.Original t n
              else return f
 
+-- | Write out a map from the names of the C or C++ functions that will be
+-- generated for PROCs to what they came from in the occam source, so that
+-- profiles can be read in terms of the occam.  Each line gives the function
+-- name, what it is (proc, or par or fork for the wrapper around a branch of a
+-- PAR or a FORKed process), the occam PROC name and the source position.  For
+-- a wrapper, the name is that of the PROC it's inside.
+writeSymbolMap :: Pass A.AST
+writeSymbolMap = cOrCppOnlyPass "Write symbol map" [] []
+  (passOnlyOnAST "writeSymbolMap" (\t ->
+    do out <- getCompOpts >>* csSymbolMapFile
+       case out of
+         Just fn -> do ls <- mapM (symbolLine $ callers t) (procs t)
+                       liftIO $ writeFile fn $ unlines ls
+         Nothing -> return ()
+       return t
+  ))
+  where
+    procs :: A.AST -> [(A.Name, Meta, A.Process)]
+    procs t = [(n, m, p) | A.Specification _ n (A.Proc m _ _ (Just p)) <- listify isProc t]
+
+    isProc :: A.Specification -> Bool
+    isProc (A.Specification _ _ (A.Proc _ _ _ (Just _))) = True
+    isProc _ = False
+
+    -- Wrappers are only called from the process they were taken out of.
+    callers :: A.AST -> Map.Map String A.Name
+    callers t = Map.fromList [(A.nameName callee, n)
+                             | (n, _, p) <- procs t
+                             , A.ProcCall _ callee _ <- listify isCall p]
+
+    isCall :: A.Process -> Bool
+    isCall (A.ProcCall {}) = True
+    isCall _ = False
+
+    symbolLine :: Map.Map String A.Name -> (A.Name, Meta, A.Process) -> PassM String
+    symbolLine cs (n, m, _)
+      = do parProcs <- getCompState >>* csParProcs
+           let kind = case Map.lookup n parProcs of
+                        Just ParWrapper -> "par"
+                        Just ForkWrapper -> "fork"
+                        Nothing -> "proc"
+           origN <- occamName parProcs n
+           return $ unwords [[if c == '.' then '_' else c | c <- A.nameName n]
+                            , kind, origN, show m]
+      where
+        occamName :: Map.Map A.Name ParOrFork -> A.Name -> PassM String
+        occamName parProcs n'
+          | n' `Map.member` parProcs
+            = case Map.lookup (A.nameName n') cs of
+                Just caller -> occamName parProcs caller
+                Nothing -> return "?"
+          | otherwise = lookupName n' >>* A.ndOrigName
+
 -- | Finds all processes that have a MOBILE parameter passed in Abbrev mode, and
 -- add the communication back at the end of the process.
 {-
@@ -25,6 +25,9 @@ module BackendPassesTest (qcTests) where
 import Control.Monad.State
 import Data.Generics (Data)
 import qualified Data.Map as Map
+import qualified Data.Set as Set
+import System.Directory
+import System.IO
 import Test.HUnit hiding (State)
 import Test.QuickCheck
 
@@ -332,6 +335,70 @@ qcTestDeclareSizes =
         label = "testDeclareSizes " ++ show n
 
 
+-- | Set up a buffered channel c carrying the given type.
+bufferedChan :: A.Type -> State CompState ()
+bufferedChan t
+  = do defineTestName "c" (A.Declaration m $ A.Chan (A.ChanAttributes A.Unshared A.Unshared) t) A.Original
+       modify $ \cs -> cs { csNameAttr = Map.singleton "c" (Set.singleton $ NameBuffered 8) }
+
+-- | Test that arrays can be buffered for the C backend:
+testBufferedChannels0 :: Test
+testBufferedChannels0 = TestCase $ testPass "testBufferedChannels0" orig checkBufferedChannels orig
+  (bufferedChan $ A.Array [dimension 4] A.Int)
+  where
+    orig = A.Skip m
+
+-- | Test that arrays can't be buffered for the C++ backend, whose buffers would
+-- only hold a pointer to the writer's array:
+testBufferedChannels1 :: Test
+testBufferedChannels1 = TestCase $ testPassShouldFail "testBufferedChannels1" checkBufferedChannels (A.Skip m)
+  (do bufferedChan $ A.Array [dimension 4] A.Int
+      modifyCompOpts $ \o -> o { csBackend = BackendCPPCSP })
+
+-- | Test that a buffered channel can't be abbreviated whole:
+testBufferedChannels2 :: Test
+testBufferedChannels2 = TestCase $ testPassShouldFail "testBufferedChannels2" splitBufferedChannels orig
+  (bufferedChan A.Int)
+  where
+    t = A.Chan (A.ChanAttributes A.Unshared A.Unshared) A.Int
+    orig = A.Seq m $ A.Spec m (A.Specification m (simpleName "c2") $ A.Is m A.Abbrev t $ A.ActualVariable $ variable "c") $
+             A.Only m $ A.Skip m
+
+-- | Test that the symbol map gives a PAR wrapper the name of the PROC it was
+-- taken out of:
+testWriteSymbolMap :: Test
+testWriteSymbolMap = TestCase $
+  do dir <- getTemporaryDirectory
+     (fn, h) <- openTempFile dir "symbols.tock.map"
+     hClose h
+     testPass "testWriteSymbolMap" ast writeSymbolMap ast (startState fn)
+     contents <- readFile fn
+     length contents `seq` removeFile fn
+     assertEqual "testWriteSymbolMap" exp contents
+  where
+    procMeta = m { metaFile = Just "foo.occ", metaLine = 3, metaColumn = 1 }
+    wrapperMeta = m { metaFile = Just "foo.occ", metaLine = 5, metaColumn = 5 }
+
+    wrapper = A.Proc wrapperMeta (A.PlainSpec, A.PlainRec) [] (Just $ A.Skip m)
+    proc = A.Proc procMeta (A.PlainSpec, A.PlainRec) []
+             (Just $ A.ProcCall m (simpleName "wrapper_proc_n0") [])
+
+    ast :: A.AST
+    ast = A.Spec m (A.Specification m (simpleName "wrapper_proc_n0") wrapper) $
+            A.Spec m (A.Specification m (simpleName "foo.bar") proc) $
+              A.Only m ()
+
+    startState :: String -> State CompState ()
+    startState fn
+      = do defineTestName "foo.bar" proc A.Original
+           defineTestName "wrapper_proc_n0" wrapper A.Original
+           modify $ \cs -> cs { csParProcs = Map.singleton (simpleName "wrapper_proc_n0") ParWrapper }
+           modifyCompOpts $ \o -> o { csSymbolMapFile = Just fn }
+
+    exp = unlines [ "wrapper_proc_n0 par foo.bar foo.occ:5:5"
+                  , "foo_bar proc foo.bar foo.occ:3:1"
+                  ]
+
 defineTestName :: String -> A.SpecType -> A.AbbrevMode -> State CompState ()
 defineTestName n sp am
   = defineName (simpleName n) $ A.NameDef {
@@ -429,6 +496,10 @@ qcTests = (TestLabel "BackendPassesTest" $ TestList
   ,testTransformWaitFor3
   ,testTransformWaitFor4
   ,testTransformWaitFor5
+  ,testBufferedChannels0
+  ,testBufferedChannels1
+  ,testBufferedChannels2
+  ,testWriteSymbolMap
  ]
  ,qcTestDeclareSizes {- ++ qcTestSizeParameters -})
 
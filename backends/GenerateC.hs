@@ -27,9 +27,14 @@ module GenerateC
   , cremoveSpec
   , genCPasses
   , genDynamicDim
+  , genGatherItems
+  , gatheredDests
+  , genProcCounted
   , generate
   , generateC
+  , genCheckedFunction
   , genLeftB
+  , genLineReset
   , genMeta
   , genName
   , genRightB
@@ -109,6 +114,7 @@ cgenOps = GenOps {
     genGetTime = cgenGetTime,
     genIf = cgenIf,
     genInput = cgenInput,
+    genInputGathered = cgenInputGathered,
     genInputItem = cgenInputItem,
     genIntrinsicFunction = cgenIntrinsicFunction,
     genIntrinsicProc = cgenIntrinsicProc,
@@ -122,6 +128,7 @@ cgenOps = GenOps {
     genMissingC = (\x -> x >>= cgenMissing),
     genOutput = cgenOutput,
     genOutputCase = cgenOutputCase,
+    genOutputGathered = cgenOutputGathered,
     genOutputItem = cgenOutputItem,
     genOverArray = cgenOverArray,
     genPar = cgenPar,
@@ -179,6 +186,12 @@ needStackSizes
 cgenTopLevel :: String -> A.AST -> CGen ()
 cgenTopLevel headerName s
     =  do tell ["#define occam_INT_size ", show cIntSize,"\n"]
+          profStack <- instrumenting InstrumentStack
+          when profStack $ tell ["#define TOCK_STACK_PROFILE\n"]
+          profComms <- instrumenting InstrumentComms
+          when profComms $ tell ["#define TOCK_COMMS_PROFILE\n"]
+          profChecks <- instrumenting InstrumentChecks
+          when profChecks $ tell ["#define TOCK_CHECK_PROFILE\n"]
           tell ["#include <tock_support_cif.h>\n"]
           cs <- getCompState
 
@@ -221,6 +234,7 @@ cgenTopLevel headerName s
                     | (n, ExternalOldStyle) <- csExternals cs]
 
           call genStructured TopLevel s (\m _ -> tell ["\n#error Invalid top-level item: ", show m])
+          genLineReset
 
           when (csHasMain $ csOpts cs) $ do
             (tlpName, tlpChans) <- tlpInterface
@@ -228,6 +242,11 @@ cgenTopLevel headerName s
             killChans <- sequence [csmLift $ makeNonce emptyMeta "tlp_channel_kill" | _ <- tlpChans]
             workspaces <- sequence [csmLift $ makeNonce emptyMeta "tlp_channel_ws" | _ <- tlpChans]
 
+            when profStack $
+              tell ["extern char** kroc_argv;\n\
+                    \static tock_stack_profile tock_main_stack_profile\
+                    \ = TOCK_STACK_PROFILE_INIT (\"tock_main\");\n"]
+
             tell ["void tock_main (Workspace wptr) {\n"]
             sequence_ [do tell ["    Channel ", c, ";\n"]
                           tell ["    ChanInit (wptr, &", c, ");\n"]
@@ -255,18 +274,39 @@ cgenTopLevel headerName s
 
             let uses_stdin = if TLPIn `elem` (map snd tlpChans) then "true" else "false"
             tell ["    LightProcBarrierWait (wptr, &bar);\n\
-                  \\n\
-                  \    Shutdown (wptr);\n\
+                  \\n"]
+            when profStack $
+              do sequence_ [tell ["    tock_stack_profile_end_once (&", ws, "_stack_profile);\n"]
+                           | ws <- workspaces]
+                 tell ["    tock_stack_profile_end_once (&tock_main_stack_profile);\n\
+                       \    tock_stack_profile_dump (kroc_argv[0]);\n"]
+            tell ["    Shutdown (wptr);\n\
                   \}\n\
                   \int kroc_argc;char** kroc_argv;\n\
                   \int main (int argc, char *argv[]) {\n\
                   \    kroc_argc=argc;kroc_argv=argv;\n\
-                  \    tock_init_ccsp (", uses_stdin, ");\n\
-                  \\n\
+                  \    tock_init_ccsp (", uses_stdin, ");\n"]
+            when profComms $
+              tell ["    tock_comms_profile_init (argv[0]);\n"]
+            when profChecks $
+              tell ["    tock_check_profile_init (argv[0]);\n"]
+            tell ["\n\
                   \    Workspace p = ProcAllocInitial (0, "]
-            genName tlpName
-            tell ["_stack_size + 512);\n\
-                  \    ProcStartInitial (p, tock_main);\n\
+            let staticSize = genName tlpName >> tell ["_stack_size + 512"]
+            case profiledStackSize (csOpts cs) "tock_main" of
+              -- The static size isn't known until link time, so this applies
+              -- the same rule as profiledStaticStackSize in the C code:
+              Just size | csStackProfileTrust (csOpts cs) -> tell [show size]
+              Just size -> do tell ["(", show size, " > "]
+                              staticSize
+                              tell [" ? ", show size, " : "]
+                              staticSize
+                              tell [")"]
+              Nothing -> staticSize
+            tell [");\n"]
+            when profStack $
+              tell ["    tock_stack_profile_start_once (&tock_main_stack_profile, p, 0);\n"]
+            tell ["    ProcStartInitial (p, tock_main);\n\
                   \\n\
                   \    // NOTREACHED\n\
                   \    return 0;\n\
@@ -284,11 +324,18 @@ cgenTopLevel headerName s
     -- implements it.
     genTLPHandler :: (Maybe A.Direction, TLPChannel) -> String -> String -> String -> CGen String
     genTLPHandler (_, tc) c kc ws
-        =  do tell ["    Workspace ", ws, " = ProcAlloc (wptr, 3, 1024);\n\
+        =  do cs <- getCompState
+              let stack = profiledStaticStackSize (csOpts cs) func 1024
+              tell ["    Workspace ", ws, " = ProcAlloc (wptr, 3, ", show stack, ");\n\
                     \    ProcParam (wptr, ", ws, ", 0, &", c, ");\n\
                     \    ProcParam (wptr, ", ws, ", 1, &", kc, ");\n\
-                    \    ProcParam (wptr, ", ws, ", 2, ", fp, ");\n\
-                    \\n"]
+                    \    ProcParam (wptr, ", ws, ", 2, ", fp, ");\n"]
+              profStack <- instrumenting InstrumentStack
+              when profStack $
+                tell ["    static tock_stack_profile ", ws, "_stack_profile\
+                      \ = TOCK_STACK_PROFILE_INIT (\"", func, "\");\n\
+                      \    tock_stack_profile_start_once (&", ws, "_stack_profile, ", ws, ", 3);\n"]
+              tell ["\n"]
               return func
       where
         (fp, func) = case tc of
@@ -341,7 +388,8 @@ cgenOverArray m var func
 
 -- | Generate code for one of the Structured types.
 cgenStructured :: Data a => Level -> A.Structured a -> (Meta -> a -> CGen b) -> CGen [b]
-cgenStructured lvl (A.Spec _ spec s) def = call genSpec lvl spec (call genStructured lvl s def)
+cgenStructured lvl (A.Spec m spec s) def
+  = genLineDirective m >> call genSpec lvl spec (call genStructured lvl s def)
 cgenStructured lvl (A.ProcThen _ p s) def = call genProcess p >> call genStructured lvl s def
 cgenStructured lvl (A.Several _ ss) def
   = sequence [call genStructured lvl s def | s <- ss] >>* concat
@@ -354,6 +402,46 @@ cgenStructured _ (A.Only m s) def = def m s >>* singleton
 -- expecting a const char * argument.
 genMeta :: Meta -> CGen ()
 genMeta m = tell ["\"", show m, "\""]
+
+-- | With --line-directives, tell the C compiler which line of the occam source
+-- the code that follows came from, so that debuggers and profilers can show
+-- it.
+genLineDirective :: Meta -> CGen ()
+genLineDirective m
+    =  do lineDirectives <- getCompOpts >>* csLineDirectives
+          when lineDirectives $
+            case metaFile m of
+              Just fn -> tell ["\n#line ", show (metaLine m), " \""
+                              , concatMap convByte fn, "\"\n"]
+              Nothing -> return ()
+
+-- | With --line-directives, point the C compiler back at the generated code
+-- itself, so that code that doesn't correspond to any occam (closing braces,
+-- PROC epilogues, the TLP handlers and main) isn't put down to the last line
+-- of occam before it.  This needs to know the name of the generated file.
+genLineReset :: CGen ()
+genLineReset
+    =  do lineDirectives <- getCompOpts >>* csLineDirectives
+          out <- getCompOpts >>* csOutputCodeFile
+          written <- gets cgenBodyLines
+          case (lineDirectives, out, written) of
+            -- The directive goes on the line after the next, and gives the
+            -- number of the line after that:
+            (True, Just fn, Just n) -> tell ["\n#line ", show (n + 3), " \""
+                                            , concatMap convByte fn, "\"\n"]
+            _ -> return ()
+
+-- | Generate the position to pass to a runtime check.  With
+-- --instrument=checks, this also counts the times the check is made, under
+-- the kind of check and the code being checked.
+genCheckMeta :: Meta -> String -> CGen String -> CGen ()
+genCheckMeta m kind genText
+    =  do profChecks <- instrumenting InstrumentChecks
+          if profChecks
+            then do text <- genText
+                    tell ["TOCK_CHECK_SITE(\"", show m, "\",\"", kind, "\",\""
+                         , concatMap convByte text, "\")"]
+            else genMeta m
 --}}}
 
 --{{{  names
@@ -471,10 +559,11 @@ cgenDecl lvl am t n
 --{{{  conversions
 cgenCheckedConversion :: Meta -> A.Type -> A.Type -> CGen () -> CGen ()
 cgenCheckedConversion m fromT toT exp
-    =  do tell ["(("]
+    =  do unchecked <- uncheckedSite m
+          tell ["(("]
           genType toT
           tell [") "]
-          if isSafeConversion fromT toT
+          if unchecked || isSafeConversion fromT toT
             then exp
             else do call genTypeSymbol "range_check" fromT
                     tell [" ("]
@@ -484,7 +573,7 @@ cgenCheckedConversion m fromT toT exp
                     tell [", "]
                     exp
                     tell [", "]
-                    genMeta m
+                    genCheckMeta m "range" (formatCode "% to %" fromT toT)
                     tell [")"]
           tell [")"]
 
@@ -782,8 +871,9 @@ cgenVariableWithAM checkValid v am fct
                   return (do let check = if checkValid then subCheck else A.NoCheck
                              tell ["(&("]
                              cgenVariableWithAM checkValid v A.Original id
+                             unchecked <- uncheckedSite m'
                              call genArraySubscript A.NoCheck v [(m',
-                               case check of
+                               case (if unchecked then A.NoCheck else check) of
                                   A.NoCheck -> call genExpression start
                                   _ -> do tell ["occam_check_slice("]
                                           call genExpression start
@@ -793,7 +883,7 @@ cgenVariableWithAM checkValid v am fct
                                           call genVariable (specificDimSize 0 v)
                                             A.Original
                                           genComma
-                                          genMeta m'
+                                          genCheckMeta m' "slice" (showCode v)
                                           tell [")"]
                                )]
                              tell ["))"]
@@ -952,30 +1042,32 @@ cgenArraySubscript check v es
       where
         gen = sequence_ $ intersperse (tell ["*"]) $ genSub : genChunks
         genSub
-            = case check of
-                A.NoCheck -> e
-                A.CheckBoth ->
-                     do tell ["occam_check_index("]
-                        e
-                        tell [","]
-                        genDim sub
-                        tell [","]
-                        genMeta m
-                        tell [")"]
-                A.CheckUpper ->
-                     do tell ["occam_check_index_upper("]
-                        e
-                        tell [","]
-                        genDim sub
-                        tell [","]
-                        genMeta m
-                        tell [")"]
-                A.CheckLower ->
-                     do tell ["occam_check_index_lower("]
-                        e
-                        tell [","]
-                        genMeta m
-                        tell [")"]
+            = do unchecked <- uncheckedSite m
+                 case (if unchecked then A.NoCheck else check) of
+                   A.NoCheck -> e
+                   A.CheckBoth ->
+                        do tell ["occam_check_index("]
+                           e
+                           tell [","]
+                           genDim sub
+                           tell [","]
+                           genIndexMeta
+                           tell [")"]
+                   A.CheckUpper ->
+                        do tell ["occam_check_index_upper("]
+                           e
+                           tell [","]
+                           genDim sub
+                           tell [","]
+                           genIndexMeta
+                           tell [")"]
+                   A.CheckLower ->
+                        do tell ["occam_check_index_lower("]
+                           e
+                           tell [","]
+                           genIndexMeta
+                           tell [")"]
+        genIndexMeta = genCheckMeta m "index" (showCode v)
         genChunks = map genDim subs
 --}}}
 
@@ -1012,13 +1104,39 @@ cgenExpression t = call genMissing $ "genExpression " ++ show t
 cgenFunctionCall :: Meta -> A.Name -> [A.Expression] -> CGen ()
 cgenFunctionCall m n es
   = do A.Function _ _ _ fs _ <- specTypeOfName n
-       genName n
+       (genFunc, genPos) <- genCheckedFunction m n es
+       genFunc
        tell ["(wptr,"]
        call genActuals genComma fs (map A.ActualExpression es)
        tell [","]
-       genMeta m
+       genPos
        tell [")"]
 
+-- | The operators that check for integer overflow, and the operators that do
+-- the same thing without the check.
+overflowCheckedOperators :: [(String, String)]
+overflowCheckedOperators = [("+", "PLUS"), ("-", "MINUS"), ("*", "TIMES")]
+
+-- | Work out how to generate the name of a function being called, and the
+-- position to pass to it.  Integer +, - and * are check sites: they're
+-- counted with --instrument=checks, and listing them in --unchecked-sites
+-- turns them into PLUS, MINUS and TIMES.
+genCheckedFunction :: Meta -> A.Name -> [A.Expression] -> CGen (CGen (), CGen ())
+genCheckedFunction m n es
+  = do mOp <- builtInOperator n
+       ts <- mapM astTypeOf es
+       case (mOp >>= flip lookup overflowCheckedOperators, ts) of
+         (Just unchecked, [t, _]) | isIntegerType t && t /= A.Time ->
+           do skip <- uncheckedSite m
+              let Just op = mOp
+                  types = drop (length $ occamDefaultOperator op []) (A.nameName n)
+                  n' = n { A.nameName = occamDefaultOperator unchecked [] ++ types }
+              return $ if skip
+                then (genName n', genMeta m)
+                else (genName n, genCheckMeta m "overflow"
+                                   (formatCode "%" $ A.FunctionCall m n es))
+         _ -> return (genName n, genMeta m)
+
 
 cgenTypeSymbol :: String -> A.Type -> CGen ()
 cgenTypeSymbol s t
@@ -1097,19 +1215,7 @@ cgenInputItem c (A.InVariable m v) mp
                    tell [");"]
  where
   cgenInputItem' x
-    =  do case v of
-            -- If we are reading into a dereferenced mobile, we must make sure
-            -- that something is in that mobile first:
-            A.DerefVariable _ v' -> do
-                 tell ["if ("]
-                 call genVariable v' A.Original
-                 tell ["==NULL){"]
-                 call genVariable v' A.Original
-                 tell ["="]
-                 t <- astTypeOf v'
-                 call genAllocMobile m t Nothing
-                 tell [";}"]
-            _ -> return ()
+    =  do genEnsureAllocated m v
           t <- astTypeOf v
           isMobile <- isMobileType t
           let rhs = genDest (if isMobile then Pointer else id) v
@@ -1130,6 +1236,20 @@ cgenInputItem c (A.InVariable m v) mp
                  call genBytesIn m t (Right v)
                  tell [");"]
 
+-- | If we are reading into a dereferenced mobile, we must make sure that
+-- something is in that mobile first.
+genEnsureAllocated :: Meta -> A.Variable -> CGen ()
+genEnsureAllocated m (A.DerefVariable _ v)
+  =  do tell ["if ("]
+        call genVariable v A.Original
+        tell ["==NULL){"]
+        call genVariable v A.Original
+        tell ["="]
+        t <- astTypeOf v
+        call genAllocMobile m t Nothing
+        tell [";}"]
+genEnsureAllocated _ _ = return ()
+
 cgenOutputItem :: A.Type -> A.Variable -> A.OutputItem -> CGen ()
 cgenOutputItem _ c (A.OutCounted m ce ae)
     =  do tce <- astTypeOf ce
@@ -1292,10 +1412,22 @@ cgenFlatArraySize ds
 
 -- | Initialise an item being declared.
 cdeclareInit :: Meta -> A.Type -> A.Variable -> Maybe (CGen ())
-cdeclareInit _ (A.Chan (A.ChanAttributes A.Unshared A.Unshared) _) var
+cdeclareInit m (A.Chan (A.ChanAttributes A.Unshared A.Unshared) t) var
     = Just $ do tell ["ChanInit(wptr,"]
                 call genVariableUnchecked var A.Abbrev
                 tell [");"]
+                withBuffer var $ \n size ->
+                  do tell ["tock_buffered_chan "]
+                     genName n
+                     tell ["_buffer;tock_buffered_chan_init(wptr,&"]
+                     genName n
+                     tell ["_buffer,"]
+                     call genVariableUnchecked var A.Abbrev
+                     tell [","]
+                     call genVariableUnchecked (A.Variable m $ bufferedReaderName n) A.Abbrev
+                     tell [",", show size, ","]
+                     call genBytesIn m t (Left False)
+                     tell [");"]
 cdeclareInit _ (A.Chan (A.ChanAttributes shW shR) _) var
   | shW == A.Shared || shR == A.Shared
     = Just $ do call genVariable' var A.Original (const $ Pointer $ Plain "mt_cb_t")
@@ -1344,8 +1476,21 @@ cdeclareInit _ _ _ = Nothing
 -- | Free a declared item that's going out of scope.
 cdeclareFree :: Meta -> A.Type -> A.Variable -> Maybe (CGen ())
 cdeclareFree m (A.Mobile {}) v = Just $ call genClearMobile m v
+cdeclareFree _ (A.Chan (A.ChanAttributes A.Unshared A.Unshared) _) var
+    = Just $ withBuffer var $ \n _ ->
+        do tell ["tock_buffered_chan_free(wptr,&"]
+           genName n
+           tell ["_buffer);"]
 cdeclareFree _ _ _ = Nothing
 
+-- | Generate something for a channel that's been given a buffer by
+-- #PRAGMA BUFFERED.
+withBuffer :: A.Variable -> (A.Name -> Integer -> CGen ()) -> CGen ()
+withBuffer (A.Variable _ n) f
+    = do size <- bufferedChanSize n
+         doMaybe $ fmap (f n) size
+withBuffer _ _ = return ()
+
 {-
                   Original        Abbrev
 INT x IS y:       int *x = &y;    int *x = &(*y);
@@ -1631,7 +1776,7 @@ genProcSpec lvl n (A.Proc _ (sm, rm) fs (Just p)) forwardDecl
             then tell [";\n"]
             else do tell ["{\n"]
                     params
-                    call genProcess p
+                    genProcCounted n $ call genProcess p
                     tell ["}\n"]
   where
     rfs = concatMap realFormals fs
@@ -1699,9 +1844,20 @@ cgenProcAlloc forking n fs as
                 | (f@(A.Formal am t _), a) <- zip fs as]
 
           ws <- csmLift $ makeNonce (A.nameMeta n) "workspace"
-          tell ["Workspace ", ws, " = ", if forking then "ProcAlloc" else "TockProcAlloc"," (wptr, ", show $ length ras, ", "]
+          -- Workspaces from ProcAlloc are freed by CCSP, so only the ones we
+          -- allocate ourselves can be profiled:
+          profStack <- instrumenting InstrumentStack >>* (&& not forking)
+          when profStack $
+            tell ["static tock_stack_profile ", ws, "_stack_profile = TOCK_STACK_PROFILE_INIT (\""
+                 , nameString n, "\");\n"]
+          tell ["Workspace ", ws, " = ", if forking then "ProcAlloc"
+                                          else if profStack then "TockProcAllocProfiled"
+                                          else "TockProcAlloc"
+               , " (wptr, ", show $ length ras, ", "]
           genName n
-          tell ["_stack_size);\n"]
+          tell ["_stack_size"]
+          when profStack $ tell [", &", ws, "_stack_profile"]
+          tell [");\n"]
 
           sequence_ [do tell [pc, " (wptr, ", ws, ", ", show num, ", "]
                         ra
@@ -1711,15 +1867,78 @@ cgenProcAlloc forking n fs as
           return (ws, genName n)
 --}}}
 
+--{{{  communication profiling
+-- | With --instrument=comms, wrap the code for a communication or a PROC body
+-- with a counter (see tock_comms_counter).  The bytes are worked out after the
+-- code has run, so that they can depend upon counts that have been input.
+genCommsCounted :: Meta -> String -> Maybe A.Name -> CGen () -> CGen () -> CGen ()
+genCommsCounted m kind name bytes body
+    =  do profComms <- instrumenting InstrumentComms
+          if profComms
+            then do site <- csmLift $ makeNonce m "comms_site"
+                    tell ["{static tock_comms_counter ", site, "=TOCK_COMMS_COUNTER_INIT("]
+                    genMeta m
+                    tell [",\"", kind, "\","]
+                    case name of
+                      Just n -> do orig <- lookupName n >>* A.ndOrigName
+                                   tell ["\"", orig, "\""]
+                      Nothing -> tell ["NULL"]
+                    tell [");uint64_t ", site, "_t0=tock_comms_now();\n"]
+                    body
+                    tell ["tock_comms_record(&", site, ","]
+                    bytes
+                    tell [",tock_comms_now()-", site, "_t0);}\n"]
+            else body
+
+-- | Count the activations and run time of a PROC.  This also ends the PROC's
+-- occam line directives.
+genProcCounted :: A.Name -> CGen () -> CGen ()
+genProcCounted n body
+  = genCommsCounted (A.nameMeta n) "proc" (Just n) (tell ["0"]) (body >> genLineReset)
+
+genInputBytes :: [A.InputItem] -> CGen ()
+genInputBytes [] = tell ["0"]
+genInputBytes iis = sequence_ $ intersperse (tell ["+"]) $ map itemBytes iis
+  where
+    itemBytes (A.InVariable m v)
+      = do t <- astTypeOf v
+           call genBytesIn m t (Right v)
+    itemBytes (A.InCounted m cv av)
+      = do A.Array _ t <- astTypeOf av
+           tell ["("]
+           call genVariable cv A.Original
+           tell [")*"]
+           call genBytesIn m t (Left False)
+
+genOutputBytes :: [A.OutputItem] -> CGen ()
+genOutputBytes [] = tell ["0"]
+genOutputBytes ois = sequence_ $ intersperse (tell ["+"]) $ map itemBytes ois
+  where
+    itemBytes (A.OutExpression m e)
+      = do t <- astTypeOf e
+           call genBytesIn m t $ case e of
+             A.ExprVariable _ v -> Right v
+             _ -> Left False
+    itemBytes (A.OutCounted m ce ae)
+      = do A.Array _ t <- astTypeOf ae
+           tell ["("]
+           call genExpression ce
+           tell [")*"]
+           call genBytesIn m t (Left False)
+--}}}
+
 --{{{  processes
 cgenProcess :: A.Process -> CGen ()
-cgenProcess p = case p of
+cgenProcess p = genLineDirective (findMeta p) >> case p of
   A.Assign m vs es -> call genAssign m vs es
   A.Input m c im -> call genInput c im
   A.Output m c ois ->
     do Left ts <- protocolItems m c
-       call genOutput c $ zip ts ois
-  A.OutputCase m c t ois -> call genOutputCase c t ois
+       genCommsCounted m "output" Nothing (genOutputBytes ois) $
+         call genOutput c $ zip ts ois
+  A.OutputCase m c t ois ->
+    genCommsCounted m "output" Nothing (genOutputBytes ois) $
+      call genOutputCase c t ois
   A.Skip m -> tell ["/* skip */\n"]
   A.Stop m -> call genStop m "STOP process"
   A.Seq _ s -> call genSeq s
@@ -1808,8 +2027,9 @@ cgenAssign m [v] (A.FunctionCallList _ n es)
          tell ["="]
          call genFunctionCall m n es
          tell [";"]
-cgenAssign m (v:vs) (A.IntrinsicFunctionCallList _ n es)
+cgenAssign m (v:vs) (A.IntrinsicFunctionCallList _ n' es')
     = do call genVariable v A.Original
+         (n, es) <- specialiseIntrinsic n' es'
          let (funcName, giveMeta) = case lookup n simpleFloatIntrinsics of
                 Just (_,cName) -> (cName, False)
                 Nothing -> ("occam_" ++ [if c == '.' then '_' else c | c <- n], True)
@@ -1836,6 +2056,23 @@ cgenAssign m [vA, vB] (A.AllocChannelBundle _ n)
          tell [";"]
 cgenAssign m _ _ = call genMissing "Cannot perform assignment with multiple destinations or multiple sources"
 
+-- | IEEE32OP and IEEE64OP change the rounding mode for just one operation.
+-- When the mode is a constant (as it nearly always is), call the version of
+-- the function specialised for that mode, which doesn't need to look up and
+-- restore the current mode at runtime.
+specialiseIntrinsic :: String -> [A.Expression] -> CGen (String, [A.Expression])
+specialiseIntrinsic n es@[x, rm, op, y]
+  | n `elem` ["IEEE32OP", "IEEE64OP"] && isConstant rm
+    = do mode <- evalIntExpression rm
+         return $ case lookup mode roundingModes of
+                    Just suffix -> (n ++ "." ++ suffix, [x, op, y])
+                    Nothing -> (n, es)
+  where
+    -- In the order of the Rm argument (appendix M of the occam 2 manual):
+    roundingModes :: [(Int, String)]
+    roundingModes = zip [0..] ["zero", "nearest", "up", "down"]
+specialiseIntrinsic n es = return (n, es)
+
 isPOD :: A.Type -> Bool
 isPOD = isJust . cgetScalarType
 
@@ -1846,9 +2083,43 @@ cgenInput c im
     =  do case im of
             A.InputTimerRead m (A.InVariable m' v) -> call genTimerRead c v
             A.InputTimerAfter m e -> call genTimerWait e
-            A.InputSimple m [ii] mp -> call genInputItem c ii mp
+            A.InputSimple m iis mp ->
+              do gathered <- gatheredInput iis
+                 genCommsCounted m "input" Nothing (genInputBytes iis) $
+                   case (gathered, iis) of
+                     (True, _) -> call genInputGathered c iis mp
+                     (False, [ii]) -> call genInputItem c ii mp
+                     _ -> call genMissing $ "genInput " ++ show im
             _ -> call genMissing $ "genInput " ++ show im
 
+-- | Generates a gathered input (see 'gatheredInput'): the items are copied
+-- out of the sender's list in order, so that a later item's destination may
+-- depend upon an earlier one, and the sender is only released once they've
+-- all been copied (and the extended process, if any, has run).
+cgenInputGathered :: A.Variable -> [A.InputItem] -> Maybe A.Process -> CGen ()
+cgenInputGathered c iis mp
+    =  do tell ["{const occam_gather_item*gather=tock_chan_in_gather(wptr,"]
+          genChan c
+          tell [");"]
+          sequence_ [scatter m v | (m, v) <- gatheredDests iis]
+          maybe (return ()) (call genProcess) mp
+          tell ["ChanXEnd(wptr,"]
+          genChan c
+          tell [");}"]
+  where
+    scatter m v
+      =  do genEnsureAllocated m v
+            tell ["occam_scatter(&gather,"]
+            genDest id v
+            tell [");"]
+
+-- | The variables a gathered input copies into, in order.
+gatheredDests :: [A.InputItem] -> [(Meta, A.Variable)]
+gatheredDests = concatMap dests
+  where
+    dests (A.InCounted m cv av) = [(m, cv), (m, av)]
+    dests (A.InVariable m v) = [(m, v)]
+
 cgenTimerRead :: A.Variable -> A.Variable -> CGen ()
 cgenTimerRead _ v = cgenGetTime v
 
@@ -1866,7 +2137,50 @@ cgenGetTime v
 --}}}
 --{{{  output
 cgenOutput :: A.Variable -> [(A.Type, A.OutputItem)] -> CGen ()
-cgenOutput c tois = sequence_ [call genOutputItem t c oi | (t, oi) <- tois]
+cgenOutput c tois
+    =  do gathered <- gatheredOutput ois
+          if gathered
+            then call genOutputGathered c ois
+            else sequence_ [call genOutputItem t c oi | (t, oi) <- tois]
+  where
+    ois = map snd tois
+
+-- | Generates a gathered output (see 'gatheredOutput').
+cgenOutputGathered :: A.Variable -> [A.OutputItem] -> CGen ()
+cgenOutputGathered c ois
+    =  do tell ["{"]
+          genGatherItems (\v -> call genVariable v A.Abbrev) ois
+          tell ["tock_chan_out_gather(wptr,"]
+          genChan c
+          tell [",gather);}"]
+
+-- | Declares the list of items for a gathered output, called @gather@.  Each
+-- item is a pointer to its data (generated by the given function) and its
+-- size in bytes; a counted array is its count followed by its data.
+genGatherItems :: (A.Variable -> CGen ()) -> [A.OutputItem] -> CGen ()
+genGatherItems point ois
+    =  do tell ["const occam_gather_item gather[]={"]
+          seqComma $ concatMap items ois
+          tell ["};"]
+  where
+    items (A.OutExpression m (A.ExprVariable _ v))
+      = [item v $ do t <- astTypeOf v
+                     call genBytesIn m t (Right v)]
+    items (A.OutCounted m ce@(A.ExprVariable _ cv) (A.ExprVariable _ av))
+      = [item cv $ do t <- astTypeOf cv
+                      call genBytesIn m t (Right cv)
+        ,item av $ do t <- astTypeOf av
+                      subT <- trivialSubscriptType m t
+                      call genExpression ce
+                      tell ["*"]
+                      call genBytesIn m subT (Right av)]
+
+    item v size
+      =  do tell ["{"]
+            point v
+            tell [","]
+            size
+            tell ["}"]
 
 cgenOutputCase :: A.Variable -> A.Name -> [A.OutputItem] -> CGen ()
 cgenOutputCase c tag ois
@@ -1889,9 +2203,9 @@ cgenOutputCase c tag ois
 --{{{  stop
 cgenStop :: Meta -> String -> CGen ()
 cgenStop m s
-    =  do tell ["occam_stop("]
+    =  do tell ["occam_stop_cold(wptr,"]
           genMeta m
-          tell [",1,\"", s, "\");"]
+          tell [",\"", s, "\");"]
 --}}}
 --{{{  seq
 cgenSeq :: A.Structured A.Process -> CGen ()
@@ -2013,12 +2327,33 @@ cgenPar pm s
               tell [wss,"[",wss,"_count++]=", ws,";"]
 --}}}
 --{{{  alt
+-- Guards are numbered by their position in the ALT, whether or not they're
+-- enabled, so that the guard a replicated ALT fired can be found directly from
+-- its number.
+--
+-- If the ALT only has channel and SKIP guards, they're polled in order first:
+-- if one is already ready, its process is run without enabling and disabling
+-- all the others.  This is what makes an ALT over a large array of channels
+-- (a server with many clients, say) cheap when it's busy.  A ready guard is
+-- jumped to straight out of the scopes that the ALT's specifications open, so
+-- the guards aren't polled if any of those has something to do at the end of
+-- its scope (such as freeing a mobile or a channel's buffer).
 cgenAlt :: Bool -> A.Structured A.Alternative -> CGen ()
 cgenAlt isPri s
     =  do id <- csmLift $ makeNonce emptyMeta "alt_id"
           tell ["int ", id, " = 0;\n"]
+          fired <- csmLift $ makeNonce emptyMeta "alt_fired"
+          tell ["int ", fired, ";\n"]
+          ready <- csmLift $ makeNonce emptyMeta "alt_ready"
 
           let isTimerAlt = containsTimers s
+          poll <- if isTimerAlt then return False else scopesEndQuietly s
+          when poll $
+            do tell ["{\n"]
+               genAltPoll id fired ready s
+               tell ["}\n"]
+               tell [id, " = 0;\n"]
+
           tell [if isTimerAlt then "TimerAlt" else "Alt", " (wptr);\n"]
           tell ["{\n"]
           genAltEnable id s
@@ -2031,8 +2366,9 @@ cgenAlt isPri s
           genAltDisable id s
           tell ["}\n"]
 
-          fired <- csmLift $ makeNonce emptyMeta "alt_fired"
-          tell ["int ", fired, " = AltEnd (wptr);\n"]
+          tell [fired, " = AltEnd (wptr);\n"]
+          when poll $
+            tell [ready, ":\n"]
           tell [id, " = 0;\n"]
           label <- csmLift $ makeNonce emptyMeta "alt_end"
           tell ["{\n"]
@@ -2050,23 +2386,63 @@ cgenAlt isPri s
             _ -> False
     containsTimers (A.Several _ ss) = or $ map containsTimers ss
 
+    scopesEndQuietly :: A.Structured A.Alternative -> CGen Bool
+    scopesEndQuietly (A.Spec _ spec s) = liftM2 (&&) (endsQuietly spec) (scopesEndQuietly s)
+    scopesEndQuietly (A.ProcThen _ _ s) = scopesEndQuietly s
+    scopesEndQuietly (A.Only _ _) = return True
+    scopesEndQuietly (A.Several _ ss) = mapM scopesEndQuietly ss >>* and
+
+    -- The cases here are the ones that removeSpec does something for.
+    endsQuietly :: A.Specification -> CGen Bool
+    endsQuietly (A.Specification m n st)
+        = case st of
+            A.Declaration _ t -> nothingToFree t
+            A.Is _ _ t (A.ActualExpression _) -> nothingToFree t
+            A.Is _ _ _ (A.ActualClaim _) -> return False
+            A.Forking _ -> return False
+            _ -> return True
+      where
+        nothingToFree t
+            = do fdeclareFree <- fget declareFree
+                 return $ isNothing $ fdeclareFree m t (A.Variable m n)
+
+    nextGuard :: String -> CGen ()
+    nextGuard id = tell [id, "++;\n"]
+
+    genAltPoll :: String -> String -> String -> A.Structured A.Alternative -> CGen ()
+    genAltPoll id fired ready s = call genStructured NotTopLevel s doA >> return ()
+      where
+        doA _ alt
+            = do case alt of
+                   A.Alternative _ e c _ _ -> withIf e $
+                     do tell ["if (tock_chan_ready ("]
+                        call genVariable c A.Abbrev
+                        tell [")) {\n"]
+                        found
+                        tell ["}\n"]
+                   A.AlternativeSkip _ e _ -> withIf e found
+                 nextGuard id
+
+        found = tell [fired, " = ", id, ";\ngoto ", ready, ";\n"]
+
     genAltEnable :: String -> A.Structured A.Alternative -> CGen ()
     genAltEnable id s = call genStructured NotTopLevel s doA >> return ()
       where
         doA _ alt
-            = case alt of
-                A.Alternative _ e c im _ -> withIf e $ doIn c im
-                A.AlternativeSkip _ e _ -> withIf e $ tell ["AltEnableSkip (wptr,", id, "++);\n"]
+            = do case alt of
+                   A.Alternative _ e c im _ -> withIf e $ doIn c im
+                   A.AlternativeSkip _ e _ -> withIf e $ tell ["AltEnableSkip (wptr,", id, ");\n"]
+                 nextGuard id
 
         doIn c im
             = do case im of
                    A.InputTimerRead _ _ -> call genMissing "timer read in ALT"
                    A.InputTimerAfter _ time ->
-                     do tell ["AltEnableTimer (wptr,", id, "++,"]
+                     do tell ["AltEnableTimer (wptr,", id, ","]
                         call genExpression time
                         tell [");\n"]
                    _ ->
-                     do tell ["AltEnableChannel (wptr,", id, "++,"]
+                     do tell ["AltEnableChannel (wptr,", id, ","]
                         call genVariable c A.Abbrev
                         tell [");\n"]
 
@@ -2074,38 +2450,69 @@ cgenAlt isPri s
     genAltDisable id s = call genStructured NotTopLevel s doA >> return ()
       where
         doA _ alt
-            = case alt of
-                A.Alternative _ e c im _ -> withIf e $ doIn c im
-                A.AlternativeSkip _ e _ -> withIf e $ tell ["AltDisableSkip (wptr,", id, "++);\n"]
+            = do case alt of
+                   A.Alternative _ e c im _ -> withIf e $ doIn c im
+                   A.AlternativeSkip _ e _ -> withIf e $ tell ["AltDisableSkip (wptr,", id, ");\n"]
+                 nextGuard id
 
         doIn c im
             = do case im of
                    A.InputTimerRead _ _ -> call genMissing "timer read in ALT"
                    A.InputTimerAfter _ time ->
-                     do tell ["AltDisableTimer (wptr,", id, "++, "]
+                     do tell ["AltDisableTimer (wptr,", id, ", "]
                         call genExpression time
                         tell [");\n"]
                    _ ->
-                     do tell ["AltDisableChannel (wptr,", id, "++, "]
+                     do tell ["AltDisableChannel (wptr,", id, ", "]
                         call genVariable c A.Abbrev
                         tell [");\n"]
 
+    -- A replicator over a single guard is dispatched by working out the
+    -- index of the guard that fired, rather than by looping over them all.
     genAltProcesses :: String -> String -> String -> A.Structured A.Alternative -> CGen ()
-    genAltProcesses id fired label s = call genStructured NotTopLevel s doA >> return ()
+    genAltProcesses id fired label s = doStructured s
       where
+        doStructured :: A.Structured A.Alternative -> CGen ()
+        doStructured (A.Spec _ (A.Specification _ n (A.Rep _ (A.For _ base count step))) body)
+          | singleGuard body
+            = do tell ["if (", fired, " >= ", id, " && ", fired, " < ", id, " + ("]
+                 call genExpression count
+                 tell [")) {\nint "]
+                 genName n
+                 tell [" = "]
+                 call genExpression base
+                 tell [" + (", fired, " - ", id, ") * ("]
+                 call genExpression step
+                 tell [");\n"]
+                 call genStructured NotTopLevel body doA
+                 tell ["goto ", label, ";\n}\n"]
+                 tell [id, " += "]
+                 call genExpression count
+                 tell [";\n"]
+        doStructured (A.Spec _ spec body) = call genSpec NotTopLevel spec (doStructured body)
+        doStructured (A.ProcThen _ p body) = call genProcess p >> doStructured body
+        doStructured (A.Several _ ss) = mapM_ doStructured ss
+        doStructured (A.Only m alt) = doCheck (doA m alt) >> nextGuard id
+
+        singleGuard :: A.Structured A.Alternative -> Bool
+        singleGuard (A.Spec _ (A.Specification _ _ (A.Rep {})) _) = False
+        singleGuard (A.Spec _ _ body) = singleGuard body
+        singleGuard (A.Only {}) = True
+        singleGuard _ = False
+
         doA _ alt
             = case alt of
-                A.Alternative _ e c im p -> withIf e $ doIn c im p
-                A.AlternativeSkip _ e p -> withIf e $ doCheck (call genProcess p)
+                A.Alternative _ _ c im p -> doIn c im p
+                A.AlternativeSkip _ _ p -> call genProcess p
 
         doIn c im p
             = do case im of
                    A.InputTimerRead _ _ -> call genMissing "timer read in ALT"
-                   A.InputTimerAfter _ _ -> doCheck (call genProcess p)
-                   _ -> doCheck (call genInput c im >> call genProcess p)
+                   A.InputTimerAfter _ _ -> call genProcess p
+                   _ -> call genInput c im >> call genProcess p
 
         doCheck body
-            = do tell ["if (", id, "++ == ", fired, ") {\n"]
+            = do tell ["if (", id, " == ", fired, ") {\n"]
                  body
                  tell ["goto ", label, ";\n"]
                  tell ["}\n"]
@@ -26,6 +26,7 @@ import Data.Generics (Data)
 import Data.HashTable (hashString)
 import Data.Int (Int32)
 import Data.List
+import Data.Maybe
 import System.IO
 
 import qualified AST as A
@@ -56,10 +57,27 @@ cCppCommonPreReq =
  ,Prop.typesResolvedInState
  ]
 
-type CGenOutput = Either [String] Handle
+-- | Generated code that's being kept in memory rather than written out.  This
+-- is a difference list, so that appending to it takes constant time however
+-- much is already there.
+newtype CGenBuffer = CGenBuffer ([String] -> [String])
+
+emptyBuffer :: CGenBuffer
+emptyBuffer = CGenBuffer id
+
+appendBuffer :: CGenBuffer -> [String] -> CGenBuffer
+appendBuffer (CGenBuffer f) x = CGenBuffer (f . (x ++))
+
+bufferContents :: CGenBuffer -> [String]
+bufferContents (CGenBuffer f) = f []
+
+type CGenOutput = Either CGenBuffer Handle
 data CGenOutputs = CGenOutputs
   { cgenBody :: CGenOutput
   , cgenHeader :: CGenOutput
+  -- | With --line-directives, the number of lines written to the body so far,
+  -- so that a #line directive can point back into the generated code.
+  , cgenBodyLines :: Maybe Int
   }
 
 --{{{  monad definition
@@ -78,10 +96,11 @@ instance CSMR CGen where
 tellToHeader :: String -> CGen a -> CGen a
 tellToHeader stem act
   = do st <- get
-       put $ st { cgenBody = Left [] }
+       put $ st { cgenBody = Left emptyBuffer }
        x <- act
        st' <- get
-       let Left mainBit = cgenBody st'
+       let Left mainBuffer = cgenBody st'
+           mainBit = bufferContents mainBuffer
            nonce = "_" ++ stem ++ "_" ++ show (makePosInteger $ hashString $ concat mainBit)
            contents =
              "#ifndef " ++ nonce ++ "\n" ++
@@ -90,9 +109,12 @@ tellToHeader stem act
              "#endif\n"
        case cgenHeader st of
          Right h -> do liftIO $ hPutStr h contents
-                       put $ st' { cgenBody = cgenBody st }
+                       put $ st' { cgenBody = cgenBody st
+                                 , cgenBodyLines = cgenBodyLines st
+                                 }
          Left ls -> do put $ st' { cgenBody = cgenBody st
-                                 , cgenHeader = Left $ ls ++ [contents]
+                                 , cgenBodyLines = cgenBodyLines st
+                                 , cgenHeader = Left $ appendBuffer ls [contents]
                                  }
        return x
   where
@@ -102,8 +124,16 @@ tellToHeader stem act
 tell :: [String] -> CGen ()
 tell x = do st <- get
             case cgenBody st of
-              Left prev -> put $ st { cgenBody = Left (prev ++ x) }
-              Right h -> liftIO $ mapM_ (hPutStr h) x
+              Left prev -> put $ countLines $ st { cgenBody = Left (appendBuffer prev x) }
+              Right h -> do liftIO $ mapM_ (hPutStr h) x
+                            when (isJust $ cgenBodyLines st) $ put $ countLines st
+  where
+    countLines :: CGenOutputs -> CGenOutputs
+    countLines st
+      = case cgenBodyLines st of
+          Just n -> let n' = n + sum [length $ filter (== '\n') s | s <- x]
+                    in n' `seq` st { cgenBodyLines = Just n' }
+          Nothing -> st
 
 csmLift :: PassM a -> CGen a
 csmLift = lift . lift
@@ -166,6 +196,10 @@ data GenOps = GenOps {
     -- | Generates an IF statement (which can have replicators, specifications and such things inside it).
     genIf :: Meta -> A.Structured A.Choice -> CGen (),
     genInput :: A.Variable -> A.InputMode -> CGen (),
+    -- | Generates an input of several items (or a counted array) received as
+    -- a single message, with the extended process to run before the sender
+    -- is released.
+    genInputGathered :: A.Variable -> [A.InputItem] -> Maybe A.Process -> CGen (),
     genInputItem :: A.Variable -> A.InputItem -> Maybe A.Process -> CGen (),
     genIntrinsicFunction :: Meta -> String -> [A.Expression] -> CGen (),
     genIntrinsicProc :: Meta -> String -> [A.Actual] -> CGen (),
@@ -181,6 +215,9 @@ data GenOps = GenOps {
     genOutput :: A.Variable -> [(A.Type, A.OutputItem)] -> CGen (),
     -- | Generates an output statement for a tagged protocol.
     genOutputCase :: A.Variable -> A.Name -> [A.OutputItem] -> CGen (),
+    -- | Generates an output of several items (or a counted array) sent as a
+    -- single message.
+    genOutputGathered :: A.Variable -> [A.OutputItem] -> CGen (),
     -- | Generates an output for an individual item.
     genOutputItem :: A.Type -> A.Variable -> A.OutputItem -> CGen (),
     -- | Generates a loop that maps over every element in a (potentially multi-dimensional) array
@@ -264,8 +301,12 @@ fget = asks
 -- Handles are body, header, occam-inc
 generate :: GenOps -> (Handle, Handle) -> String -> A.AST -> PassM ()
 generate ops (hb, hh) hname ast
-  = evalStateT (runReaderT (call genTopLevel hname ast) ops)
-      (CGenOutputs (Right hb) (Right hh))
+  =  do -- The generator writes lots of small strings; make sure they're
+        -- written out in large chunks rather than as they come:
+        liftIO $ mapM_ (\h -> hSetBuffering h (BlockBuffering (Just 65536))) [hb, hh]
+        lineDirectives <- getCompOpts >>* csLineDirectives
+        evalStateT (runReaderT (call genTopLevel hname ast) ops)
+          (CGenOutputs (Right hb) (Right hh) (if lineDirectives then Just 0 else Nothing))
 
 genComma :: CGen ()
 genComma = tell [","]
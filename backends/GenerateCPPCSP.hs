@@ -40,7 +40,8 @@ import System.IO
 import qualified AST as A
 import CompState
 import GenerateC (cgenOps, cgenReplicatorLoop, cgetCType, cintroduceSpec, cremoveSpec,
-  genDynamicDim, generate, genLeftB, genMeta, genName, genRightB, genStatic, justOnly, nameString, withIf)
+  genCheckedFunction, genDynamicDim, generate, genGatherItems, gatheredDests, genLeftB, genLineReset, genProcCounted, genMeta, genName, genRightB, genStatic,
+  justOnly, nameString, withIf)
 import GenerateCBased
 import Errors
 import Metadata
@@ -67,12 +68,14 @@ cppgenOps = cgenOps {
     genFunctionCall = cppgenFunctionCall,
     genGetTime = cppgenGetTime,
     genIf = cppgenIf,
+    genInputGathered = cppgenInputGathered,
     genInputItem = cppgenInputItem,
     genListAssign = cppgenListAssign,
     genListConcat = cppgenListConcat,
     genListSize = cppgenListSize,
     genListLiteral = cppgenListLiteral,
     genOutputCase = cppgenOutputCase,
+    genOutputGathered = cppgenOutputGathered,
     genOutputItem = cppgenOutputItem,
     genPar = cppgenPar,
     genPoison = cppgenPoison,
@@ -95,6 +98,12 @@ cppgenOps = cgenOps {
 genCPPCSPPasses :: [Pass A.AST]
 genCPPCSPPasses = [chansToAny]
 
+-- | Channels carrying a fixed-size type become C++CSP channels of that type
+-- (see 'cppgetCType'), so that communicating on them is just an assignment.
+-- Everything else (counted arrays, mobiles, and so on) becomes a channel of
+-- ANY, which carries a pointer and does a memcpy of however many bytes the
+-- receiver asks for.  Channels of protocols are left alone; they also carry
+-- bytes, but the backend needs to know the protocol.
 chansToAny :: PassOn A.Type
 chansToAny = cppOnlyPass "Transform channels to ANY"
   [Prop.processTypesChecked]
@@ -108,10 +117,29 @@ chansToAny = cppOnlyPass "Transform channels to ANY"
   where
     chansToAny' :: A.Type -> PassM A.Type
     chansToAny' c@(A.Chan _ (A.UserProtocol {})) = return c
-    chansToAny' (A.Chan b _) = return $ A.Chan b A.Any
+    chansToAny' c@(A.Chan b t)
+      = do direct <- sentDirectly t
+           return $ if direct then c else A.Chan b A.Any
     chansToAny' c@(A.ChanEnd _ _ (A.UserProtocol {})) = return c
-    chansToAny' (A.ChanEnd a b _) = return $ A.ChanEnd a b A.Any
+    chansToAny' c@(A.ChanEnd a b t)
+      = do direct <- sentDirectly t
+           return $ if direct then c else A.ChanEnd a b A.Any
     chansToAny' t = return t
+
+    -- C++CSP channels copy what they carry by assignment, so they can carry
+    -- scalars, records and fixed-size arrays of them, as long as there are no
+    -- mobiles inside.
+    sentDirectly :: A.Type -> PassM Bool
+    sentDirectly (A.Timer _) = return False
+    sentDirectly t@(A.Record _)
+      = do fs <- recordFields emptyMeta t
+           liftM and $ mapM (sentDirectly . snd) fs
+    sentDirectly (A.Array ds t)
+      | all isDimension ds = sentDirectly t
+      where
+        isDimension (A.Dimension _) = True
+        isDimension _ = False
+    sentDirectly t = return $ isJust $ cppgetScalarType t
     
     chansToAnyM :: PassTypeOn A.Type
     chansToAnyM = applyBottomUpM chansToAny'
@@ -135,6 +163,10 @@ cppcspPrereq = cCppCommonPreReq ++ [Prop.allChansToAnyOrProtocol]
 cppgenTopLevel :: String -> A.AST -> CGen ()
 cppgenTopLevel headerName s
     =  do tell ["#define occam_INT_size ", show cxxIntSize,"\n"]
+          profComms <- instrumenting InstrumentComms
+          when profComms $ tell ["#define TOCK_COMMS_PROFILE\n"]
+          profChecks <- instrumenting InstrumentChecks
+          when profChecks $ tell ["#define TOCK_CHECK_PROFILE\n"]
           tell ["#include <tock_support_cppcsp.h>\n"]
 
 
@@ -164,17 +196,18 @@ cppgenTopLevel headerName s
                     | usedFile <- Set.toList $ csUsedFiles cs]
 
           call genStructured TopLevel s (\m _ -> tell ["\n#error Invalid top-level item: ",show m])
+          genLineReset
 
           when (csHasMain $ csOpts cs) $ do
             (name, chans) <- tlpInterface
             tell ["int main (int argc, char** argv) { csp::Start_CPPCSP();"]
+            when profComms $ tell ["tock_comms_profile_init (argv[0]);"]
+            when profChecks $ tell ["tock_check_profile_init (argv[0]);"]
             (chanTypeRead, chanTypeWrite, writer, reader) <- 
                       do st <- getCompState
                          case csFrontend $ csOpts st of
-                           FrontendOccam -> return ("tockSendableArrayOfBytes",
-                                                    "tockSendableArrayOfBytes",
-                                                    "StreamWriterByteArray",
-                                                    "StreamReaderByteArray")
+                           FrontendOccam -> return ("uint8_t", "uint8_t",
+                                                    "StreamWriter", "StreamReader")
                            _ -> return ("uint8_t", "tockList<uint8_t>/**/","StreamWriterList", "StreamReader")
           
             tell ["csp::One2OneChannel<",chanTypeRead,"> in;"]
@@ -208,12 +241,14 @@ cppgenTopLevel headerName s
 
 -- | CIF has a stop function for stopping processes.
 --In C++CSP I use the exception handling to make a stop call throw a StopException,
---and the catch is placed so that catching a stop exception immediately finishes the process
+--and the catch is placed so that catching a stop exception immediately finishes the process.
+--The exception is built and thrown by occam_stop_cold, so that the code to do
+--it isn't repeated at every STOP.
 cppgenStop :: Meta -> String -> CGen ()
 cppgenStop m s 
-  = do tell ["throw StopException("]
+  = do tell ["occam_stop_cold("]
        genMeta m
-       tell [" \"",s,"\");"]
+       tell [",\"",s,"\");"]
 
 --{{{ Two helper functions to aggregate some common functionality in this file.
 
@@ -329,7 +364,29 @@ cppgenTimerWait e
           tell ["csp::SleepUntil(",time,");"]
 
 cppgenInputItem :: A.Variable -> A.InputItem -> Maybe A.Process -> CGen ()
-cppgenInputItem c dest Nothing
+cppgenInputItem c dest@(A.InVariable _ v) Nothing
+  = do direct <- isDirectChannel c
+       if direct
+         then do t <- astTypeOf v
+                 case t of
+                   A.Array {} -> do tell ["tockRecvArray("]
+                                    chan'
+                                    tell [","]
+                                    call genVariable v A.Original
+                                    tell [");"]
+                   _ -> do chan'
+                           tell [">>"]
+                           derefRecord t
+                           call genVariable v A.Original
+                           tell [";"]
+         else cppgenInputItemBytes c dest
+  where
+    chan' = genCPPCSPChannelInput c
+cppgenInputItem c dest Nothing = cppgenInputItemBytes c dest
+
+-- | Input on a channel of ANY or a protocol.
+cppgenInputItemBytes :: A.Variable -> A.InputItem -> CGen ()
+cppgenInputItemBytes c dest
   = case dest of
       (A.InCounted m cv av) -> 
         do call genInputItem c (A.InVariable m cv) Nothing
@@ -356,7 +413,29 @@ cppgenInputItem c dest Nothing
                        tell ["));"]
 
 cppgenOutputItem :: A.Type -> A.Variable -> A.OutputItem -> CGen ()
-cppgenOutputItem _ chan item
+cppgenOutputItem _ chan item@(A.OutExpression _ (A.ExprVariable _ sv))
+  = do direct <- isDirectChannel chan
+       if direct
+         then do t <- astTypeOf sv
+                 case t of
+                   A.Array {} -> do tell ["tockSendArray("]
+                                    chan'
+                                    tell [","]
+                                    call genVariable sv A.Original
+                                    tell [");"]
+                   _ -> do chan'
+                           tell ["<<"]
+                           derefRecord t
+                           call genVariable sv A.Original
+                           tell [";"]
+         else cppgenOutputItemBytes chan item
+  where
+    chan' = genCPPCSPChannelOutput chan
+cppgenOutputItem _ chan item = cppgenOutputItemBytes chan item
+
+-- | Output on a channel of ANY or a protocol.
+cppgenOutputItemBytes :: A.Variable -> A.OutputItem -> CGen ()
+cppgenOutputItemBytes chan item
   = case item of
       (A.OutCounted m (A.ExprVariable _ cv) (A.ExprVariable _ av)) -> (sendBytes cv) >> (sendBytes av)
       (A.OutExpression _ (A.ExprVariable _ sv)) ->
@@ -372,6 +451,49 @@ cppgenOutputItem _ chan item
                      genPoint v
                      tell ["));"]
 
+-- | A gathered input holds on to the sender (with an extended input inside
+-- 'tockScatter') until the end of the block.
+cppgenInputGathered :: A.Variable -> [A.InputItem] -> Maybe A.Process -> CGen ()
+cppgenInputGathered c iis mp
+  = do tell ["{tockScatter gather("]
+       genCPPCSPChannelInput c
+       tell [");"]
+       sequence_ [do tell ["gather("]
+                     genPoint v
+                     tell [");"]
+                 | (_, v) <- gatheredDests iis]
+       maybe (return ()) (call genProcess) mp
+       tell ["}"]
+
+cppgenOutputGathered :: A.Variable -> [A.OutputItem] -> CGen ()
+cppgenOutputGathered c ois
+  = do tell ["{"]
+       genGatherItems genPoint ois
+       tell ["tockSendGather("]
+       genCPPCSPChannelOutput c
+       tell [",gather);}"]
+
+-- | Does a channel carry its values directly, rather than as bytes?  See
+-- 'chansToAny'.
+isDirectChannel :: A.Variable -> CGen Bool
+isDirectChannel c
+  = do t <- astTypeOf c
+       return $ case t of
+                  A.Chan _ inner -> direct inner
+                  A.ChanEnd _ _ inner -> direct inner
+                  _ -> False
+  where
+    direct A.Any = False
+    direct (A.Counted {}) = False
+    direct (A.UserProtocol {}) = False
+    direct _ = True
+
+-- | Records are referred to by pointer, so they need dereferencing to be
+-- sent or received directly.
+derefRecord :: A.Type -> CGen ()
+derefRecord (A.Record _) = tell ["*"]
+derefRecord _ = return ()
+
 genPoint :: A.Variable -> CGen()
 genPoint v = do t <- astTypeOf v
                 when (not $ isPoint t) $ tell ["&"]
@@ -599,7 +721,7 @@ cppintroduceSpec lvl (A.Specification _ n (A.Proc _ (sm, _) fs (Just p)))
           tell [" ("]
           cppgenFormals (\x -> x) fs
           tell [") {\n"]
-          call genProcess p
+          genProcCounted n $ call genProcess p
           tell ["}\n"]                                                                          
 
           --And generate its CSProcess wrapper:
@@ -645,6 +767,16 @@ cppintroduceSpec _ (A.Specification _ n (A.Forking _))
         tell ["="]
         genName n
         tell ["__.enrolledEnd();"]
+--Channels given a buffer by #PRAGMA BUFFERED use C++CSP2's own buffered channels:
+cppintroduceSpec lvl spec@(A.Specification _ n (A.Declaration m t@(A.Chan {})))
+   = do size <- bufferedChanSize n
+        case size of
+          Nothing -> cintroduceSpec lvl spec
+          Just size' ->
+            do Template _ [Left innerCT] <- call getCType m t A.Original
+               tell ["csp::BufferedOne2OneChannel<", show innerCT, "> "]
+               genName n
+               tell ["(csp::FIFOBuffer<", show innerCT, ">::Factory(", show size', "));"]
 
 --For all other cases, use the C implementation:
 cppintroduceSpec lvl n = cintroduceSpec lvl n
@@ -908,11 +1040,12 @@ cppgenReschedule = tell ["csp::CPPCSP_Yield();"]
 cppgenFunctionCall :: Meta -> A.Name -> [A.Expression] -> CGen ()
 cppgenFunctionCall m n es
   = do A.Function _ _ _ fs _ <- specTypeOfName n
-       genName n
+       (genFunc, genPos) <- genCheckedFunction m n es
+       genFunc
        tell ["("]
        call genActuals genComma fs (map A.ActualExpression es)
        tell [","]
-       genMeta m
+       genPos
        tell [")"]
 
 -- Changed because we don't need the mobile descriptor stuff:
@@ -36,7 +36,9 @@ import Control.Monad.Reader
 import Control.Monad.Writer hiding (tell)
 import Data.Generics (Data)
 import Data.List (isInfixOf, intersperse)
+import qualified Data.Map as Map
 import Data.Maybe (fromMaybe)
+import qualified Data.Set as Set
 import Test.HUnit hiding (State)
 import Text.Regex
 
@@ -115,8 +117,8 @@ evalCGen act ops state = evalCGen' (runReaderT act ops) state
 evalCGen' :: CGen' () -> CompState -> IO (Either Errors.ErrorReport [String])
 evalCGen' act state = runPassM state pass >>* fst
   where
-    pass = execStateT act (CGenOutputs (Left []) (Left []))
-      >>* (\(CGenOutputs (Left x) _) -> x)
+    pass = execStateT act (CGenOutputs (Left emptyBuffer) (Left emptyBuffer) (Just 0))
+      >>* (\(CGenOutputs (Left x) _ _) -> bufferContents x)
 
 -- | Checks that running the test for the C and C++ backends produces the right output for each.
 testBothS :: 
@@ -303,7 +305,7 @@ testGenType = TestList
 
 testStop :: Test
 testStop =
-  testBoth "Stop" "occam_stop(\"foo:4:9\",1,\"bar\");" "throw StopException(\"foo:4:9\" \"bar\");" (tcall2 genStop (Meta (Just "foo") 4 9) "bar") 
+  testBoth "Stop" "occam_stop_cold(wptr,\"foo:4:9\",\"bar\");" "occam_stop_cold(\"foo:4:9\",\"bar\");" (tcall2 genStop (Meta (Just "foo") 4 9) "bar") 
 
 testArraySizes :: Test
 testArraySizes = TestList
@@ -372,12 +374,28 @@ testArraySubscript = TestList
   ,testBothSameS "genArraySubscript 5"
     ("[occam_check_index(5,7," ++ m ++ ")*8*9+occam_check_index(6,8," ++ m ++ ")*9+occam_check_index(7,9," ++ m ++ ")]")
     (tcall3 genArraySubscript A.CheckBoth (A.Variable emptyMeta foo) [lit 5, lit 6, lit 7]) stateTrans
-    
+
+  -- Counted with --instrument=checks:
+  ,testBothSameS "genArraySubscript 6"
+    ("[occam_check_index(5,7,TOCK_CHECK_SITE(" ++ m ++ ",\"index\",\"foo\"))*8*9]")
+    (tcall3 genArraySubscript A.CheckBoth (A.Variable emptyMeta foo) [lit 5])
+    (stateTrans >> setOpts (\o -> o { csInstrument = Set.singleton InstrumentChecks }))
+  -- Left out with --unchecked-sites:
+  ,testBothSameS "genArraySubscript 7"
+    ("[5*8*9+occam_check_index(6,8," ++ m ++ ")*9]")
+    (tcall3 genArraySubscript A.CheckBoth (A.Variable emptyMeta foo) [(fileMeta, tell ["5"]), lit 6])
+    (stateTrans >> setOpts (\o -> o { csUncheckedSites = Set.singleton (show fileMeta) }))
  ]
  where
    stateTrans :: CSM m => m ()
    stateTrans = defineName (simpleName "foo") $ simpleDefDecl "foo" (A.Array [dimension 7,dimension 8,dimension 9] A.Int)
    m = "\"" ++ show emptyMeta ++ "\""
+
+   setOpts :: (CompOpts -> CompOpts) -> State CompState ()
+   setOpts f = modify $ \cs -> cs { csOpts = f (csOpts cs) }
+
+   fileMeta :: Meta
+   fileMeta = emptyMeta { metaFile = Just "foo.occ", metaLine = 3, metaColumn = 5 }
    
    lit :: Int -> (Meta, CGen ())
    lit n = (emptyMeta, tell [show n])
@@ -525,6 +543,42 @@ testDeclaration = TestList
  where
    stateR t = defRecord "REC" "bar" t
 
+testCommsProfile :: Test
+testCommsProfile = TestList
+ [
+  testBothSameS "testCommsProfile 0"
+    (counted "output" "^")
+    (over (tcall genProcess $ A.Output emptyMeta c [A.OutExpression emptyMeta $ exprVariable "x"])) (state True)
+  ,testBothSameS "testCommsProfile 1"
+    (counted "input" "^")
+    (over (tcall2 genInput c $ A.InputSimple emptyMeta [A.InVariable emptyMeta $ variable "x"] Nothing)) (state True)
+  -- Nothing extra without the option:
+  ,testBothSameS "testCommsProfile 2" "^"
+    (over (tcall genProcess $ A.Output emptyMeta c [A.OutExpression emptyMeta $ exprVariable "x"])) (state False)
+ ]
+ where
+   c = A.Variable emptyMeta $ simpleName "c"
+
+   counted :: String -> String -> String
+   counted kind body
+     = "{static tock_comms_counter " ++ site ++ "=TOCK_COMMS_COUNTER_INIT(\"no source position\",\""
+       ++ kind ++ "\",NULL);uint64_t " ++ site ++ "_t0=tock_comms_now();\n"
+       ++ body
+       ++ "tock_comms_record(&" ++ site ++ ",$,tock_comms_now()-" ++ site ++ "_t0);}\n"
+
+   site = "comms_siteno_source_position_n0"
+
+   state :: Bool -> State CompState ()
+   state profile
+     = do defineName (simpleName "c") $ simpleDefDecl "c" $
+            A.Chan (A.ChanAttributes A.Unshared A.Unshared) A.Int
+          defineName (simpleName "x") $ simpleDefDecl "x" A.Int
+          when profile $
+            modify $ \cs -> cs { csOpts = (csOpts cs) { csInstrument = Set.singleton InstrumentComms } }
+
+   over :: Override
+   over = local $ \ops -> ops {genOutput = override2 caret, genInputItem = override3 caret, genBytesIn = override3 dollar}
+
 testDeclareInitFree :: Test
 testDeclareInitFree = TestLabel "testDeclareInitFree" $ TestList
  [
@@ -908,6 +962,16 @@ testAssign = TestList
     (state $ A.Chan (A.ChanAttributes A.Unshared A.Unshared) A.Int)
   ,testBothFailS "testAssign 201" (over (tcall3 genAssign emptyMeta [A.Variable emptyMeta foo] (A.ExpressionList emptyMeta [e])))
     (state $ A.Record bar)
+
+  -- IEEE32OP and IEEE64OP use a specialised function when the rounding mode is constant:
+  ,testBothSameS "testAssign 300" "@=occam_IEEE32OP_up($,$,$,@,\"foo:4:9\");"
+    (overActual (tcall3 genAssign m [foo', foo'] (A.IntrinsicFunctionCallList emptyMeta "IEEE32OP" [e, intLiteral 2, e, e]))) (state A.Real32)
+  ,testBothSameS "testAssign 301" "@=occam_IEEE64OP_zero($,$,$,@,\"foo:4:9\");"
+    (overActual (tcall3 genAssign m [foo', foo'] (A.IntrinsicFunctionCallList emptyMeta "IEEE64OP" [e, intLiteral 0, e, e]))) (state A.Real64)
+  ,testBothSameS "testAssign 302" "@=occam_IEEE32OP($,$,$,$,@,\"foo:4:9\");"
+    (overActual (tcall3 genAssign m [foo', foo'] (A.IntrinsicFunctionCallList emptyMeta "IEEE32OP" [e, A.ExprVariable emptyMeta foo', e, e]))) (state A.Real32)
+  ,testBothSameS "testAssign 303" "@=occam_IEEE32OP($,$,$,$,@,\"foo:4:9\");"
+    (overActual (tcall3 genAssign m [foo', foo'] (A.IntrinsicFunctionCallList emptyMeta "IEEE32OP" [e, intLiteral 7, e, e]))) (state A.Real32)
  ]
  where
    --The expression won't be examined so we can use what we like:
@@ -915,6 +979,10 @@ testAssign = TestList
    state t = defineName (simpleName "foo") $ simpleDefDecl "foo" t
    over :: Override
    over = local $ \ops -> ops {genVariable' = override3 at, genExpression = override1 dollar}
+   overActual :: Override
+   overActual = local $ \ops -> ops {genVariable' = override3 at, genExpression = override1 dollar, genActual = override3 at}
+   m = Meta (Just "foo") 4 9
+   foo' = A.Variable emptyMeta foo
 
 testCase :: Test
 testCase = TestList
@@ -970,6 +1038,92 @@ testWhile = testBothSame "testWhile 0" "while($){@}" (over (tcall2 genWhile unde
     over :: Override
     over = local $ \ops -> ops {genExpression = override1 dollar, genProcess = override1 at}
 
+testAlt :: Test
+testAlt = TestList
+ [
+  testAlt' 0 (altCode (poll single) (enable single) (disable single) (dispatch single)) $
+    A.Only emptyMeta alt
+  ,testAlt' 1 (altCode (poll double) (enable double) (disable double) (dispatch double)) $
+    A.Several emptyMeta [A.Only emptyMeta alt, A.Only emptyMeta alt]
+
+  -- A replicator over a single guard is dispatched directly:
+  ,testAlt' 2 (altCode (rep $ poll single) (rep $ enable single) (rep $ disable single) (repDispatch "i")) $
+    repSpec i $ A.Only emptyMeta alt
+  -- ... and so is the inner one of two:
+  ,testAlt' 3 (altCode (rep $ rep $ poll single) (rep $ rep $ enable single) (rep $ rep $ disable single)
+                       (rep $ repDispatch "j")) $
+    repSpec i $ repSpec j $ A.Only emptyMeta alt
+
+  -- The guards aren't polled if a scope in the ALT has to be closed properly:
+  ,TestCase $ testRS "testAlt 4" ("^" ++ toRegex "int %1 = 0;\nint %2;\nAlt (wptr);\n")
+     (runReaderT (over $ tcall2 genAlt False $
+        A.Spec emptyMeta (A.Specification emptyMeta x $ A.Declaration emptyMeta $ A.Mobile A.Int) $
+          A.Only emptyMeta alt) cgenOps)
+     (defineName x $ simpleDefDecl "x" $ A.Mobile A.Int)
+     >> return ()
+ ]
+ where
+   testAlt' :: Int -> String -> A.Structured A.Alternative -> Test
+   testAlt' n exp s
+     = TestCase $ testRS ("testAlt " ++ show n) ("^" ++ toRegex exp ++ "$")
+                    (runReaderT (over $ tcall2 genAlt False s) cgenOps) (return ())
+                  >> return ()
+
+   alt = A.Alternative emptyMeta (A.True emptyMeta) (variable "c")
+           (A.InputSimple emptyMeta [] Nothing) (A.Skip emptyMeta)
+   i = simpleName "i"
+   j = simpleName "j"
+   x = simpleName "x"
+   repSpec n = A.Spec emptyMeta $ A.Specification emptyMeta n $ A.Rep emptyMeta $
+                 A.For emptyMeta (intLiteral 0) (intLiteral 10) (intLiteral 1)
+
+   -- The code for each phase, given the code for each guard.  %1 to %4 are
+   -- the ALT's nonce names: the single number, the fired single, and the labels
+   -- after the disabling and the dispatching.
+   altCode :: String -> String -> String -> String -> String
+   altCode p e d f
+     = "int %1 = 0;\nint %2;\n{\n" ++ p ++ "}\n%1 = 0;\n"
+       ++ "Alt (wptr);\n{\n" ++ e ++ "}\n"
+       ++ "AltWait (wptr);\n%1 = 0;\n{\n" ++ d ++ "}\n"
+       ++ "%2 = AltEnd (wptr);\n%3:\n%1 = 0;\n{\n" ++ f ++ "}\n%4:\n;\n"
+
+   single, double :: [String] -> String
+   single = concat
+   double g = concat g ++ concat g
+   rep :: String -> String
+   rep code = "`" ++ code ++ "#"
+
+   poll, enable, disable, dispatch :: ([String] -> String) -> String
+   poll g = g ["if ($) {\nif (tock_chan_ready (c)) {\n%2 = %1;\ngoto %3;\n}\n}\n", "%1++;\n"]
+   enable g = g ["if ($) {\nAltEnableChannel (wptr,%1,c);\n}\n", "%1++;\n"]
+   disable g = g ["if ($) {\nAltDisableChannel (wptr,%1, c);\n}\n", "%1++;\n"]
+   dispatch g = g ["if (%1 == %2) {\n^@goto %4;\n}\n", "%1++;\n"]
+
+   repDispatch :: String -> String
+   repDispatch n = "if (%2 >= %1 && %2 < %1 + ($)) {\nint " ++ n ++ " = $ + (%2 - %1) * ($);\n"
+                   ++ "^@goto %4;\n}\n%1 += $;\n"
+
+   -- Escapes the expected code, capturing each %n the first time it appears
+   -- (which must be in order) and matching it again after that.
+   toRegex :: String -> String
+   toRegex = go []
+     where
+       go seen ('%':n:cs)
+         | n `elem` seen = '\\' : n : go seen cs
+         | otherwise = "([[:alnum:]_]+)" ++ go (n : seen) cs
+       go seen (c:cs)
+         | c `elem` "\\^$.[]|()*+?{}" = '\\' : c : go seen cs
+         | otherwise = c : go seen cs
+       go _ [] = []
+
+   over :: Override
+   over = local $ \ops -> ops { genExpression = override1 dollar
+                              , genVariable' = override3 (tell ["c"])
+                              , genInput = override2 caret
+                              , genProcess = override1 at
+                              , introduceSpec = override2 backq
+                              , removeSpec = override1 hash}
+
 testInput :: Test
 testInput = TestList
  [
@@ -978,28 +1132,29 @@ testInput = TestList
   ,testBothSame "testInput 1" "^" (overInputItemCase (tcall2 genInput undefined $ A.InputSimple undefined [undefined] Nothing))
   ,testBothSame "testInput 2" "^^^" (overInputItemCase (tcall2 genInput undefined $ A.InputSimple undefined [undefined, undefined, undefined] Nothing))
   
-  -- Reading an integer (special case in the C backend):
-  ,testInputItem 100 "ChanInInt(wptr,#,&x);" "tockRecvArrayOfBytes(#,tockSendableArrayOfBytes(^(Int),&x));"
+  -- Reading an integer (special case in the C backend; in C++, channels of
+  -- fixed-size types carry them directly):
+  ,testInputItem 100 "ChanInInt(wptr,#,&x);" "#>>x;"
      (A.InVariable emptyMeta $ variable "x") A.Int
   -- Reading a other plain types:
-  ,testInputItem 101 "ChanIn(wptr,#,&x,^(Int8));" "tockRecvArrayOfBytes(#,tockSendableArrayOfBytes(^(Int8),&x));"
+  ,testInputItem 101 "ChanIn(wptr,#,&x,^(Int8));" "#>>x;"
      (A.InVariable emptyMeta $ variable "x") A.Int8
   ,testInputItem 102 ("ChanIn(wptr,#,&x,^(" ++ show (A.Record foo) ++ "));")
-     ("tockRecvArrayOfBytes(#,tockSendableArrayOfBytes(^(" ++ show (A.Record foo) ++ "),(&x)));")
+     "#>>*(&x);"
      (A.InVariable emptyMeta $ variable "x") (A.Record foo)
   -- Reading into a fixed size array:
   ,testInputItem 103 "ChanIn(wptr,#,x,^(Array [Dimension 8] Int));"
-      "tockRecvArrayOfBytes(#,tockSendableArrayOfBytes(^(Array [Dimension 8] Int),x));"
+      "tockRecvArray(#,x);"
        (A.InVariable emptyMeta $ variable "x") $ A.Array [dimension 8] A.Int
     
   -- Reading into subscripted variables:
-  ,testInputItem 110 "ChanInInt(wptr,#,&(xs)$);" "tockRecvArrayOfBytes(#,tockSendableArrayOfBytes(^(Int),&xs$));"
+  ,testInputItem 110 "ChanInInt(wptr,#,&(xs)$);" "#>>xs$;"
      (A.InVariable emptyMeta $ sub0 $ variable "xs") A.Int
   -- Reading a other plain types:
-  ,testInputItem 111 "ChanIn(wptr,#,&(xs)$,^(Int8));" "tockRecvArrayOfBytes(#,tockSendableArrayOfBytes(^(Int8),&xs$));"
+  ,testInputItem 111 "ChanIn(wptr,#,&(xs)$,^(Int8));" "#>>xs$;"
      (A.InVariable emptyMeta $ sub0 $ variable "xs") A.Int8  
   ,testInputItem 112 ("ChanIn(wptr,#,&(xs)$,^(" ++ show (A.Record foo) ++ "));")
-    ("tockRecvArrayOfBytes(#,tockSendableArrayOfBytes(^(" ++ show (A.Record foo) ++ "),(&xs$)));")
+    "#>>*(&xs$);"
     (A.InVariable emptyMeta $ sub0 $ variable "xs") (A.Record foo)
   
   -- A counted array of Int:
@@ -1087,22 +1242,22 @@ testOutput = TestList
   
   --Integers are a special case in the C backend:
   ,testOutputItem 201 "ChanOutInt(wptr,#,x);"
-    "tockSendArrayOfBytes(#,tockSendableArrayOfBytes(&x));"
+    "#<<x;"
     (A.OutExpression emptyMeta $ exprVariable "x") A.Int
   --A plain type on the channel of the right type:
   ,testOutputItem 202 "ChanOut(wptr,#,&x,^);"
-    "tockSendArrayOfBytes(#,tockSendableArrayOfBytes(&x));"
+    "#<<x;"
     (A.OutExpression emptyMeta $ exprVariable "x") A.Int64
   --A record type on the channel of the right type (because records are always referenced by pointer):
   ,testOutputItem 203 "ChanOut(wptr,#,&x,^);"
-    "tockSendArrayOfBytes(#,tockSendableArrayOfBytes((&x)));"
+    "#<<*(&x);"
     (A.OutExpression emptyMeta $ exprVariable "x") (A.Record foo)
   --A fixed size array on the channel of the right type:
   ,testOutputItem 204 "ChanOut(wptr,#,x,^);"
-     "tockSendArrayOfBytes(#,tockSendableArrayOfBytes(x));"
+     "tockSendArray(#,x);"
      (A.OutExpression emptyMeta $ exprVariable "x") (A.Array [dimension 6] A.Int)
   ,testOutputItem 205 "ChanOut(wptr,#,x,^);"
-    "tockSendArrayOfBytes(#,tockSendableArrayOfBytes(x));"
+    "tockSendArray(#,x);"
     (A.OutExpression emptyMeta $ exprVariable "x") (A.Array [dimension 6, dimension 7, dimension 8] A.Int)
 
   --A counted array:
@@ -1194,6 +1349,93 @@ testOutput = TestList
    overOutput = local $ \ops -> ops {genOutput = override2 caret}
    over = local $ \ops -> ops {genBytesIn = override3 caret}
 
+testGathered :: Test
+testGathered = TestList
+ [
+  -- Several items go as one message:
+  testBothS "testGathered 0"
+    "{const occam_gather_item gather[]={{&x,^},{&y,^}};tock_chan_out_gather(wptr,&c,gather);}"
+    "{const occam_gather_item gather[]={{&x,^},{&y,^}};tockSendGather((c).writer(),gather);}"
+    (over (tcall2 genOutput c [(A.Int, outX), (A.Int64, outY)])) (state True)
+  -- So does a counted array, with the sender's count giving the size:
+  ,testBothS "testGathered 1"
+    "{const occam_gather_item gather[]={{&x,^},{xs,x*^}};tock_chan_out_gather(wptr,&c,gather);}"
+    "{const occam_gather_item gather[]={{&x,^},{xs,x*^}};tockSendGather((c).writer(),gather);}"
+    (over (tcall2 genOutput c [(A.Counted A.Int A.Int, outXs)])) (state True)
+  -- Not without the option:
+  ,testBothSameS "testGathered 2" "^^"
+    (overOutputItem (tcall2 genOutput c [(A.Int, outX), (A.Int64, outY)])) (state False)
+
+  ,testBothS "testGathered 100"
+    "{const occam_gather_item*gather=tock_chan_in_gather(wptr,&c);occam_scatter(&gather,&x);occam_scatter(&gather,&y);ChanXEnd(wptr,&c);}"
+    "{tockScatter gather((c).reader());gather(&x);gather(&y);}"
+    (over (tcall2 genInput c $ A.InputSimple emptyMeta [inX, inY] Nothing)) (state True)
+  ,testBothS "testGathered 101"
+    "{const occam_gather_item*gather=tock_chan_in_gather(wptr,&c);occam_scatter(&gather,&x);occam_scatter(&gather,xs);ChanXEnd(wptr,&c);}"
+    "{tockScatter gather((c).reader());gather(&x);gather(xs);}"
+    (over (tcall2 genInput c $ A.InputSimple emptyMeta [inXs] Nothing)) (state True)
+  -- The extended process runs before the sender is released:
+  ,testBothS "testGathered 102"
+    "{const occam_gather_item*gather=tock_chan_in_gather(wptr,&c);occam_scatter(&gather,&x);occam_scatter(&gather,&y);@ChanXEnd(wptr,&c);}"
+    "{tockScatter gather((c).reader());gather(&x);gather(&y);@}"
+    (over (tcall2 genInput c $ A.InputSimple emptyMeta [inX, inY] (Just $ A.Skip emptyMeta))) (state True)
+  ,testBothSameS "testGathered 103" "^"
+    (overInputItem (tcall2 genInput c $ A.InputSimple emptyMeta [inXs] Nothing)) (state False)
+ ]
+ where
+   c = A.Variable emptyMeta $ simpleName "c"
+   outX = A.OutExpression emptyMeta $ exprVariable "x"
+   outY = A.OutExpression emptyMeta $ exprVariable "y"
+   outXs = A.OutCounted emptyMeta (exprVariable "x") (exprVariable "xs")
+   inX = A.InVariable emptyMeta $ variable "x"
+   inY = A.InVariable emptyMeta $ variable "y"
+   inXs = A.InCounted emptyMeta (variable "x") (variable "xs")
+
+   state :: Bool -> State CompState ()
+   state gather
+     = do defineName (simpleName "c") $ simpleDefDecl "c" $
+            A.Chan (A.ChanAttributes A.Unshared A.Unshared) (A.UserProtocol foo)
+          defineName (simpleName "x") $ simpleDefDecl "x" A.Int
+          defineName (simpleName "y") $ simpleDefDecl "y" A.Int64
+          defineName (simpleName "xs") $ simpleDefDecl "xs" (A.Array [dimension 6] A.Int)
+          defineName foo $ simpleDef "foo" $ A.Protocol emptyMeta [A.Int, A.Int64]
+          modify $ \cs -> cs { csOpts = (csOpts cs) { csGatherComms = gather } }
+
+   over, overOutputItem, overInputItem :: Override
+   over = local $ \ops -> ops {genBytesIn = override3 caret, genProcess = override1 at}
+   overOutputItem = local $ \ops -> ops {genOutputItem = override3 caret}
+   overInputItem = local $ \ops -> ops {genInputItem = override3 caret}
+
+testBuffered :: Test
+testBuffered = TestList
+ [
+  testBothS "testBuffered 0"
+    "Channel foo;ChanInit(wptr,&foo);tock_buffered_chan foo_buffer;tock_buffered_chan_init(wptr,&foo_buffer,&foo,&foo_reader,8,^);"
+    "csp::BufferedOne2OneChannel<int32_t> foo(csp::FIFOBuffer<int32_t>::Factory(8));"
+    (over (tcall introduceSpec NotTopLevel spec)) state
+  ,testBothS "testBuffered 1" "tock_buffered_chan_free(wptr,&foo_buffer);" ""
+    (over (tcall removeSpec spec)) state
+  -- Channels without the pragma are unchanged:
+  ,testBothS "testBuffered 2" "Channel foo;ChanInit(wptr,&foo);" "csp::One2OneChannel<int32_t> foo;"
+    (over (tcall introduceSpec NotTopLevel spec)) (defineChan "foo")
+  ,testBothSameS "testBuffered 3" ""
+    (over (tcall removeSpec spec)) (defineChan "foo")
+ ]
+ where
+   t = A.Chan (A.ChanAttributes A.Unshared A.Unshared) A.Int32
+   spec = A.Specification emptyMeta foo (A.Declaration emptyMeta t)
+
+   defineChan :: String -> State CompState ()
+   defineChan n = defineName (simpleName n) $ simpleDefDecl n t
+
+   state :: State CompState ()
+   state = do defineChan "foo"
+              defineChan "foo_reader"
+              modify $ \cs -> cs { csNameAttr = Map.singleton "foo" (Set.singleton $ NameBuffered 8) }
+
+   over :: Override
+   over = local $ \ops -> ops {genBytesIn = override3 caret}
+
 testBytesIn :: Test
 testBytesIn = TestList
  [
@@ -1225,6 +1467,34 @@ testBytesIn = TestList
    over :: Override
    over = local $ \ops -> ops {genVariable' = override3 dollar}
 
+testLineDirectives :: Test
+testLineDirectives = TestList
+ [
+  testBothSameS "testLineDirectives 0" "/* skip */\n"
+    (tcall genProcess $ A.Skip fileMeta) (return ())
+  ,testBothSameS "testLineDirectives 1" "\n#line 3 \"foo.occ\"\n/* skip */\n"
+    (tcall genProcess $ A.Skip fileMeta) lineDirectives
+  -- No directive without a source file:
+  ,testBothSameS "testLineDirectives 2" "/* skip */\n"
+    (tcall genProcess $ A.Skip emptyMeta) lineDirectives
+  -- Resetting to the generated code gives the line after the directive:
+  ,testBothSameS "testLineDirectives 3"
+    "\n#line 3 \"foo.occ\"\n/* skip */\n\n#line 6 \"foo.tock.c\"\n"
+    (tcall genProcess (A.Skip fileMeta) >> genLineReset) (lineDirectives >> codeFile)
+  -- ... but only with --line-directives:
+  ,testBothSameS "testLineDirectives 4" "/* skip */\n"
+    (tcall genProcess (A.Skip fileMeta) >> genLineReset) codeFile
+ ]
+ where
+   fileMeta :: Meta
+   fileMeta = emptyMeta { metaFile = Just "foo.occ", metaLine = 3, metaColumn = 5 }
+
+   lineDirectives :: State CompState ()
+   lineDirectives = modify $ \cs -> cs { csOpts = (csOpts cs) { csLineDirectives = True } }
+
+   codeFile :: State CompState ()
+   codeFile = modify $ \cs -> cs { csOpts = (csOpts cs) { csOutputCodeFile = Just "foo.tock.c" } }
+
 testMobile :: Test
 testMobile = TestList
  [
@@ -1248,18 +1518,23 @@ tests :: Test
 tests = TestLabel "GenerateCTest" $ TestList
  [
    testActuals
+   ,testAlt
    ,testArraySizes
    ,testArraySlice
    ,testArraySubscript
    ,testAssign
    ,testBytesIn
    ,testCase
+   ,testCommsProfile
    ,testDeclaration
+   ,testBuffered
    ,testDeclareInitFree
+   ,testGathered
    ,testGenType
    ,testGenVariable
    ,testIf
    ,testInput
+   ,testLineDirectives
    ,testMobile
    ,testOutput
    ,testOverArray
@@ -0,0 +1,109 @@
+{-
+Tock: a compiler for parallel languages
+Copyright (C) 2007, 2008, 2009  University of Kent
+
+This program is free software; you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 2 of the License, or (at your
+option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+-}
+
+-- | A module containing the 'main' function for the Tock benchmarks.  It
+-- currently runs benchmarks from the following modules:
+--
+-- * "FlowBench"
+--
+-- * "GenerateCBench"
+--
+-- * "PassListBench"
+--
+-- * "PreprocessOccamBench"
+--
+-- * "UsageCheckBench"
+module BenchMain (main) where
+
+import Control.Monad
+import Data.List
+import System.Console.GetOpt
+import System.Environment
+import System.IO
+import Text.Printf
+
+import Benchmark
+import qualified FlowBench (benchmarks)
+import qualified GenerateCBench (benchmarks)
+import qualified PassListBench (benchmarks)
+import qualified PreprocessOccamBench (benchmarks)
+import qualified UsageCheckBench (benchmarks)
+
+data BenchOption =
+  ListBenchmarks
+  | RunJust String
+  | Sizes [Int]
+  deriving (Eq)
+
+main :: IO ()
+main = do argv <- getArgs
+          opts <- case getOpt RequireOrder options argv of
+                    (opts, [], []) -> return opts
+                    (_, nonOpts, errs) -> err $ concat errs ++ concat nonOpts
+
+          let selected = case [name | RunJust name <- opts] of
+                           [] -> allBenchmarks
+                           names -> [b | b <- allBenchmarks
+                                       , any (`isInfixOf` benchName b) names]
+
+          if ListBenchmarks `elem` opts
+            then mapM_ (putStrLn . benchName) allBenchmarks
+            else do putStrLn $ printf "%-40s %10s %10s %12s %8s"
+                                 "Benchmark" "Size" "Time (s)" "us/unit" "Growth"
+                    forM_ selected $ \b ->
+                      runAt b $ case [ns | Sizes ns <- opts] of
+                                  [] -> benchSizes b
+                                  nss -> last nss
+  where
+    err msg = ioError (userError (msg ++ usageInfo header options))
+    header = "Usage: tockbench [OPTION..]"
+    options = [ Option ['l'] ["list"] (NoArg ListBenchmarks) "list the benchmarks"
+              , Option ['f'] ["filter"] (ReqArg RunJust "NAME")
+                  "run just the benchmarks that have this in their name"
+              , Option ['s'] ["sizes"] (ReqArg (Sizes . read . ("[" ++) . (++ "]")) "N,N,...")
+                  "run at these sizes rather than the default ones"
+              ]
+
+    allBenchmarks :: [Benchmark]
+    allBenchmarks = concat
+      [ FlowBench.benchmarks
+      , GenerateCBench.benchmarks
+      , PassListBench.benchmarks
+      , PreprocessOccamBench.benchmarks
+      , UsageCheckBench.benchmarks
+      ]
+
+    -- Run a benchmark at each size, showing how the time per unit of size
+    -- changes; the growth column is the time relative to the previous size,
+    -- divided by the growth in size, so it stays near 1 for a linear
+    -- algorithm.
+    runAt :: Benchmark -> [Int] -> IO ()
+    runAt b sizes = foldM_ runOne Nothing sizes
+      where
+        runOne :: Maybe (Int, Double) -> Int -> IO (Maybe (Int, Double))
+        runOne prev n
+          =  do t <- benchRun b n
+                let perUnit = t * 1000000 / fromIntegral n
+                    growth = case prev of
+                               Just (n', t') | t' > 0 ->
+                                 printf "%8.2f" $ (t / t') / (fromIntegral n / fromIntegral n')
+                               _ -> ""
+                putStrLn $ printf "%-40s %10d %10.3f %12.3f %8s"
+                             (benchName b) n t (perUnit :: Double) (growth :: String)
+                hFlush stdout
+                return $ Just (n, t)
@@ -0,0 +1,45 @@
+{-
+Tock: a compiler for parallel languages
+Copyright (C) 2007, 2008, 2009  University of Kent
+
+This program is free software; you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 2 of the License, or (at your
+option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+-}
+
+-- | Definitions shared by the benchmarks run by "BenchMain".
+module Benchmark (Benchmark(..), timeIO) where
+
+import Control.Monad.Trans (MonadIO, liftIO)
+import Data.Time.Clock
+
+-- | A benchmark: something that can be run at several different sizes, to
+-- see how its running time grows.
+data Benchmark = Benchmark {
+    benchName :: String
+    -- | The sizes to run it at if none are given on the command line.
+  , benchSizes :: [Int]
+    -- | Run the benchmark at the given size, returning the time taken in
+    -- seconds.  The benchmark decides what's timed, so that setting up its
+    -- input needn't be counted.
+  , benchRun :: Int -> IO Double
+  }
+
+-- | Time an action, returning its result and the wall-clock time it took.
+-- The result should already have been forced by the action if the work of
+-- producing it is to be counted.
+timeIO :: MonadIO m => m a -> m (a, Double)
+timeIO act
+  =  do start <- liftIO getCurrentTime
+        x <- act
+        end <- liftIO getCurrentTime
+        return (x, realToFrac $ diffUTCTime end start)
@@ -0,0 +1,228 @@
+{-
+Tock: a compiler for parallel languages
+Copyright (C) 2007, 2008, 2009  University of Kent
+
+This program is free software; you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 2 of the License, or (at your
+option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+-}
+
+-- | A module containing the 'main' function for the corpus benchmark.  This
+-- writes out the programs from "SyntheticPrograms" at each of their sizes,
+-- and runs @tock@ on each one in each mode, with @--pass-stats@ and the
+-- runtime system's statistics turned on.  It prints the time and peak
+-- memory use of each run, how they grow with the size of the program, and
+-- any passes whose time grows noticeably faster than the program does.
+--
+-- The programs, the statistics for each run, and a summary of all the runs
+-- (@summary.json@) are left in the output directory.
+module CorpusMain (main) where
+
+import Control.Monad
+import Data.List
+import Data.Maybe
+import Data.Time.Clock
+import System.Console.GetOpt
+import System.Directory
+import System.Environment
+import System.Exit
+import System.IO
+import System.Process
+import Text.Printf
+import Text.Regex
+
+import SyntheticPrograms
+
+data CorpusOption =
+  Tock String
+  | OutputDir String
+  | JustShape String
+  | JustMode String
+  | GenerateOnly
+  deriving (Eq)
+
+-- | The modes to run @tock@ in, with the options for each.  The modes that
+-- need a C compiler aren't included, so that only Tock's own time is seen.
+modes :: [(String, [String])]
+modes =
+  [ ("lex", ["--mode=lex"])
+  , ("parse", ["--mode=parse"])
+  , ("flowgraph", ["--mode=flowgraph"])
+  , ("c", ["--mode=compile", "--backend=c"])
+  , ("cppcsp", ["--mode=compile", "--backend=cppcsp"])
+  ]
+
+-- | The result of one run of @tock@.
+data Run = Run {
+    runShape :: Shape,
+    runSize :: Int,
+    runMode :: String,
+    runTime :: Double,
+    -- The peak live data, if the runtime system reported it:
+    runMaxBytes :: Maybe Integer,
+    -- The time taken by each pass:
+    runPasses :: [(String, Double)],
+    runStatsFile :: FilePath
+  }
+
+main :: IO ()
+main = do argv <- getArgs
+          opts <- case getOpt RequireOrder options argv of
+                    (opts, [], []) -> return opts
+                    (_, nonOpts, errs) -> err $ concat errs ++ concat nonOpts
+
+          let tock = last $ "./tock" : [t | Tock t <- opts]
+              dir = last $ "corpus" : [d | OutputDir d <- opts]
+              shapes = select (JustShape . shapeName) allShapes
+              runModes = select (JustMode . fst) modes
+              select f xs = case [x | x <- xs, f x `elem` opts] of
+                              [] -> xs
+                              xs' -> xs'
+
+          createDirectoryIfMissing True dir
+          files <- sequence [writeProgram dir s n | s <- shapes, n <- snd $ shapeProgram s]
+          if GenerateOnly `elem` opts
+            then mapM_ putStrLn files
+            else do putStrLn $ printf "%-10s %8s %-10s %10s %10s %8s"
+                                 "Program" "Size" "Mode" "Time (s)" "Peak (MB)" "Growth"
+                    runs <- liftM concat $ sequence
+                      [runSeries tock dir s m | s <- shapes, m <- runModes]
+                    writeFile (dir ++ "/summary.json") $
+                      "[" ++ intercalate ",\n " (map runJSON runs) ++ "]\n"
+  where
+    err msg = ioError (userError (msg ++ usageInfo header options))
+    header = "Usage: tockcorpus [OPTION..]"
+    options = [ Option ['t'] ["tock"] (ReqArg Tock "PATH")
+                  "the tock to run (default ./tock)"
+              , Option ['o'] ["output"] (ReqArg OutputDir "DIR")
+                  "directory for the programs and statistics (default corpus)"
+              , Option ['s'] ["shape"] (ReqArg JustShape "SHAPE")
+                  ("only use this shape of program (options: "
+                     ++ intercalate ", " (map shapeName allShapes) ++ ")")
+              , Option ['m'] ["mode"] (ReqArg JustMode "MODE")
+                  ("only run in this mode (options: " ++ intercalate ", " (map fst modes) ++ ")")
+              , Option ['g'] ["generate-only"] (NoArg GenerateOnly)
+                  "just write out the programs"
+              ]
+
+programFile :: FilePath -> Shape -> Int -> FilePath
+programFile dir s n = dir ++ "/" ++ shapeName s ++ "-" ++ show n ++ ".occ"
+
+writeProgram :: FilePath -> Shape -> Int -> IO FilePath
+writeProgram dir s n
+  =  do let file = programFile dir s n
+        writeFile file $ fst (shapeProgram s) n
+        return file
+
+-- | Run @tock@ on one shape of program in one mode, at each of its sizes.
+-- Once all the sizes have been done, the passes whose time grew much faster
+-- than the size of the program between the last two sizes are listed.
+runSeries :: FilePath -> FilePath -> Shape -> (String, [String]) -> IO [Run]
+runSeries tock dir s mode
+  =  do runs <- liftM catMaybes $ mapM (runTock tock dir s mode) (snd $ shapeProgram s)
+        forM_ (zip (Nothing : map Just runs) runs) $ \(prev, r) ->
+          putStrLn $ printf "%-10s %8d %-10s %10.3f %10s %8s"
+            (shapeName s) (runSize r) (runMode r) (runTime r)
+            (maybe "" (printf "%.1f" . megabytes) (runMaxBytes r) :: String)
+            (maybe "" (\p -> printf "%.2f" $ growth (runSize p, runTime p) (runSize r, runTime r)) prev :: String)
+        case reverse runs of
+          (r : p : _) ->
+            sequence_ [putStrLn $ printf "    %-50s %8.2f" name g
+                      | (name, g) <- superlinear p r]
+          _ -> return ()
+        hFlush stdout
+        return runs
+  where
+    megabytes :: Integer -> Double
+    megabytes b = fromIntegral b / (1024 * 1024)
+
+-- | The time at the second size relative to that at the first, divided by
+-- the growth in size; it stays near 1 for something linear.
+growth :: (Int, Double) -> (Int, Double) -> Double
+growth (n, t) (n', t')
+  | t > 0 = (t' / t) / (fromIntegral n' / fromIntegral n)
+  | otherwise = 0
+
+-- | The passes that took a noticeable part of the time in the later run, and
+-- grew by more than half as much again as the program did.
+superlinear :: Run -> Run -> [(String, Double)]
+superlinear p r
+  = [ (name, g)
+    | (name, t') <- runPasses r
+    , t' > runTime r / 100
+    , Just t <- [lookup name (runPasses p)]
+    , let g = growth (runSize p, t) (runSize r, t')
+    , g > 1.5
+    ]
+
+-- | Run @tock@ once, returning Nothing (and saying why) if it fails.
+runTock :: FilePath -> FilePath -> Shape -> (String, [String]) -> Int -> IO (Maybe Run)
+runTock tock dir s (mode, args) n
+  =  do let file = programFile dir s n
+            base = dir ++ "/" ++ shapeName s ++ "-" ++ show n ++ "." ++ mode
+            statsFile = base ++ ".json"
+            rtsFile = base ++ ".rts"
+        start <- getCurrentTime
+        (code, _, errs) <- readProcessWithExitCode tock
+          (args ++ ["--pass-stats=" ++ statsFile, "--output=/dev/null", file
+                   , "+RTS", "-t" ++ rtsFile, "--machine-readable", "-RTS"]) ""
+        end <- getCurrentTime
+        case code of
+          ExitFailure _ ->
+            do putStrLn $ printf "%-10s %8d %-10s failed: %s" (shapeName s) n mode
+                            (takeWhile (/= '\n') errs)
+               return Nothing
+          ExitSuccess ->
+            do rts <- readFile rtsFile
+               passes <- readFile statsFile
+               return $ Just $ Run
+                 { runShape = s
+                 , runSize = n
+                 , runMode = mode
+                 , runTime = realToFrac $ diffUTCTime end start
+                 , runMaxBytes = rtsStat "max_bytes_used" rts
+                 , runPasses = passTimes passes
+                 , runStatsFile = statsFile
+                 }
+
+-- | Get a statistic from the output of @+RTS -t --machine-readable@, which is
+-- the command line followed by a list of pairs of strings.
+rtsStat :: String -> String -> Maybe Integer
+rtsStat name s
+  = case reads (dropWhile (/= '\n') s) of
+      [(stats, _)] -> lookup name stats >>= readInteger
+      _ -> Nothing
+  where
+    readInteger :: String -> Maybe Integer
+    readInteger v = case reads v of
+                      [(i, "")] -> Just i
+                      _ -> Nothing
+
+-- | Get the name and time of each pass from the JSON written by
+-- @--pass-stats@ (see 'Pass.passStatsJSON').
+passTimes :: String -> [(String, Double)]
+passTimes s
+  = case matchRegexAll phaseRE s of
+      Just (_, _, rest, [name, secs]) -> (name, read secs) : passTimes rest
+      _ -> []
+  where
+    phaseRE = mkRegex "\"name\": \"([^\"]*)\", \"seconds\": ([0-9.]+)"
+
+runJSON :: Run -> String
+runJSON r = "{" ++ intercalate ", "
+              [ "\"shape\": \"" ++ shapeName (runShape r) ++ "\""
+              , "\"size\": " ++ show (runSize r)
+              , "\"mode\": \"" ++ runMode r ++ "\""
+              , "\"seconds\": " ++ printf "%.6f" (runTime r)
+              , "\"max_bytes_used\": " ++ maybe "null" show (runMaxBytes r)
+              , "\"pass_stats\": \"" ++ runStatsFile r ++ "\""
+              ] ++ "}"
@@ -0,0 +1,64 @@
+{-
+Tock: a compiler for parallel languages
+Copyright (C) 2007, 2008, 2009  University of Kent
+
+This program is free software; you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 2 of the License, or (at your
+option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+-}
+
+-- | Benchmarks for the data-flow analyses done on the flow graph.  These use
+-- a program made of WHILE loops and IFs nested to the given depth (see
+-- 'nestedProgram').
+module FlowBench (benchmarks) where
+
+import Control.Exception (evaluate)
+import Control.Monad.Trans (liftIO)
+import Data.Generics (gsize)
+
+import qualified AST as A
+import Benchmark
+import Check
+import CompState
+import Errors
+import ParseOccam
+import Pass
+import PassList
+import PreprocessOccam
+import SyntheticPrograms (nestedProgram)
+
+benchmarks :: [Benchmark]
+benchmarks =
+  [ Benchmark "Flow usage checking" sizes $ benchFlow (passCode . usageCheck)
+  , Benchmark "Flow checkInitVar" sizes $ benchFlow (const $ passCode checkInitVarPass)
+  ]
+  where
+    sizes = [25, 50, 100]
+    usageCheck = head . filter ((== "Usage checking") . passName)
+
+-- | Time the given pass on the nested program, after the passes that come
+-- before usage checking.
+benchFlow :: ([Pass A.AST] -> A.AST -> PassM A.AST) -> Int -> IO Double
+benchFlow check depth
+  =  do let source = nestedProgram depth
+            passes = getPassList emptyOpts
+            before = takeWhile ((/= "Usage checking") . passName) passes
+        _ <- evaluate $ length source
+        (r, _) <- runPassM emptyState $
+          do ast <- preprocessOccamSource source >>= parseOccamProgram >>= runPasses before
+             liftIO $ evaluate $ gsize ast
+             (ast', t) <- timeIO $ check passes ast
+             liftIO $ evaluate $ gsize ast'
+             return t
+        case r of
+          Left e -> dieIO e
+          Right t -> return t
@@ -0,0 +1,66 @@
+{-
+Tock: a compiler for parallel languages
+Copyright (C) 2007, 2008, 2009  University of Kent
+
+This program is free software; you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 2 of the License, or (at your
+option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+-}
+
+-- | Benchmarks for the C and C++ code generators.  These compile a synthetic
+-- program with the given number of PROCs (see "SyntheticPrograms") as far as
+-- the backend, and then time just the code generation, writing the output to
+-- @\/dev\/null@.
+module GenerateCBench (benchmarks) where
+
+import Control.Exception (evaluate)
+import Control.Monad.Trans (liftIO)
+import Data.Generics (gsize)
+import System.IO
+
+import qualified AST as A
+import Benchmark
+import CompState
+import Errors
+import GenerateC
+import GenerateCPPCSP
+import ParseOccam
+import Pass
+import PassList
+import PreprocessOccam
+import SyntheticPrograms (syntheticProgram)
+
+benchmarks :: [Benchmark]
+benchmarks =
+  [ Benchmark "GenerateC" sizes $ benchGenerate BackendC generateC
+  , Benchmark "GenerateCPPCSP" sizes $ benchGenerate BackendCPPCSP generateCPPCSP
+  ]
+  where
+    sizes = [10000, 30000, 100000]
+
+benchGenerate :: CompBackend -> ((Handle, Handle) -> String -> A.AST -> PassM ()) -> Int -> IO Double
+benchGenerate backend generator n
+  =  do let opts = emptyOpts { csBackend = backend }
+        (r, _) <- runPassM (emptyState { csOpts = opts }) $
+          do ast <- preprocessOccamSource (syntheticProgram n)
+                      >>= parseOccamProgram
+                      >>= runPasses (getPassList opts)
+             -- Make sure the passes have finished before we start timing:
+             liftIO $ evaluate $ gsize ast
+             hb <- liftIO $ openFile "/dev/null" WriteMode
+             hh <- liftIO $ openFile "/dev/null" WriteMode
+             (_, t) <- timeIO $ do generator (hb, hh) "bench.h" ast
+                                   liftIO $ hClose hb >> hClose hh
+             return t
+        case r of
+          Left e -> dieIO e
+          Right t -> return t
@@ -0,0 +1,65 @@
+{-
+Tock: a compiler for parallel languages
+Copyright (C) 2007, 2008, 2009  University of Kent
+
+This program is free software; you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 2 of the License, or (at your
+option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+-}
+
+-- | Benchmarks for the pass list, with and without pass fusion, on the
+-- synthetic programs from "GenerateCBench".  The name of each benchmark says
+-- how many passes are run, so the number of traversals that fusion saves can
+-- be seen.
+module PassListBench (benchmarks) where
+
+import Control.Exception (evaluate)
+import Control.Monad.Trans (liftIO)
+import Data.Generics (gsize)
+
+import Benchmark
+import CompState
+import Errors
+import GenerateCBench (syntheticProgram)
+import ParseOccam
+import Pass
+import PassList
+import PreprocessOccam
+
+benchmarks :: [Benchmark]
+benchmarks =
+  [ Benchmark (name opts) sizes $ benchPasses opts
+  | backend <- [BackendC, BackendCPPCSP]
+  , fusion <- [True, False]
+  , let opts = emptyOpts { csBackend = backend, csPassFusion = fusion }
+  ]
+  where
+    sizes = [3000, 10000, 30000]
+
+    name :: CompOpts -> String
+    name opts = "Passes " ++ show (csBackend opts)
+                  ++ (if csPassFusion opts then " fused" else "")
+                  ++ " (" ++ show (length $ getPassList opts) ++ ")"
+
+benchPasses :: CompOpts -> Int -> IO Double
+benchPasses opts n
+  =  do let passes = getPassList opts
+        (r, _) <- runPassM (emptyState { csOpts = opts }) $
+          do ast <- preprocessOccamSource (syntheticProgram n) >>= parseOccamProgram
+             liftIO $ evaluate $ gsize ast
+             -- The size is taken inside the timed region so that the passes
+             -- have all finished by the time it stops:
+             (_, t) <- timeIO $ runPasses passes ast >>= liftIO . evaluate . gsize
+             return t
+        case r of
+          Left e -> dieIO e
+          Right t -> return t
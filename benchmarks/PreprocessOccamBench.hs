@@ -0,0 +1,67 @@
+{-
+Tock: a compiler for parallel languages
+Copyright (C) 2007, 2008, 2009  University of Kent
+
+This program is free software; you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 2 of the License, or (at your
+option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+-}
+
+-- | Benchmarks for the occam lexer and preprocessor, using the same synthetic
+-- programs as "GenerateCBench" (about ten lines per PROC).  Run with
+-- @+RTS -s@ to see the memory used as well.
+module PreprocessOccamBench (benchmarks) where
+
+import Control.Exception (evaluate)
+import Control.Monad.Trans (liftIO)
+import qualified Data.ByteString.Lazy.Char8 as ByteString
+
+import Benchmark
+import CompState
+import Errors
+import LexOccam
+import Pass
+import PreprocessOccam
+import SyntheticPrograms (syntheticProgram)
+
+benchmarks :: [Benchmark]
+benchmarks =
+  [ Benchmark "LexOccam" sizes benchLex
+  , Benchmark "PreprocessOccam" sizes benchPreprocess
+  ]
+  where
+    sizes = [10000, 30000, 100000]
+
+-- | Time just the lexer.
+benchLex :: Int -> IO Double
+benchLex n
+  =  do source <- evaluate $ ByteString.pack $ syntheticProgram n
+        _ <- evaluate $ ByteString.length source
+        (r, _) <- runPassM emptyState $ timeIO $
+          do toks <- runLexer "<bench>" source
+             liftIO $ evaluate $ length toks
+        case r of
+          Left e -> dieIO e
+          Right (_, t) -> return t
+
+-- | Time lexing, preprocessing and structuring together, as they're done for
+-- a source file.
+benchPreprocess :: Int -> IO Double
+benchPreprocess n
+  =  do let source = syntheticProgram n
+        _ <- evaluate $ length source
+        (r, _) <- runPassM emptyState $ timeIO $
+          do toks <- preprocessOccamSource source
+             liftIO $ evaluate $ length toks
+        case r of
+          Left e -> dieIO e
+          Right (_, t) -> return t
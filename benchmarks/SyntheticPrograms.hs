@@ -0,0 +1,223 @@
+{-
+Tock: a compiler for parallel languages
+Copyright (C) 2007, 2008, 2009  University of Kent
+
+This program is free software; you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 2 of the License, or (at your
+option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+-}
+
+-- | Synthetic occam programs of a given size, for the benchmarks.  Each shape
+-- of program stresses a different part of the compiler, and the size is a
+-- count of whatever the shape has lots of.
+module SyntheticPrograms (Shape(..), allShapes, nestedProgram, shapeName, shapeProgram, syntheticProgram) where
+
+import Data.List
+
+data Shape =
+  -- | Lots of small PROCs ('syntheticProgram').
+  ManyProcs
+  -- | WHILE loops and IFs nested to the given depth ('nestedProgram').
+  | DeepNesting
+  -- | Lots of replicated PARs with array accesses, which the usage checker
+  -- has to prove safe.
+  | WideRepPars
+  -- | Constant tables with the given number of elements.
+  | ConstTables
+  -- | Lots of variant protocols, each used over its own channel.
+  | Protocols
+  deriving (Eq, Show, Enum, Bounded)
+
+allShapes :: [Shape]
+allShapes = [minBound .. maxBound]
+
+shapeName :: Shape -> String
+shapeName ManyProcs = "procs"
+shapeName DeepNesting = "nesting"
+shapeName WideRepPars = "reppars"
+shapeName ConstTables = "tables"
+shapeName Protocols = "protocols"
+
+-- | The program of the given shape and size, and the sizes it's worth trying
+-- it at (each three times the one before, so growth is easy to see).
+shapeProgram :: Shape -> (Int -> String, [Int])
+shapeProgram ManyProcs = (syntheticProgram, [1000, 3000, 10000])
+shapeProgram DeepNesting = (nestedProgram, [20, 60, 180])
+shapeProgram WideRepPars = (repParProgram, [100, 300, 1000])
+shapeProgram ConstTables = (tableProgram, [1000, 3000, 10000])
+shapeProgram Protocols = (protocolProgram, [100, 300, 1000])
+
+-- | The top-level process used by all the programs; it runs the given
+-- process, then outputs a byte computed from @x@ so that nothing can be
+-- thrown away.
+mainProc :: [String] -> [String]
+mainProc body
+  = [ "PROC main (CHAN BYTE kyb?, scr!, err!)"
+    , "  INT x:"
+    , "  SEQ"
+    , "    x := 0"
+    ] ++ map ("    " ++) body ++
+    [ "    scr ! BYTE (x \\ 256)"
+    , ":"
+    ]
+
+-- | A program with the given number of PROCs.  Each PROC does a little
+-- arithmetic and communication, and calls the one before it, so that none of
+-- them can be thrown away.
+syntheticProgram :: Int -> String
+syntheticProgram n = unlines $ concatMap proc [0 .. n - 1] ++ main
+  where
+    proc :: Int -> [String]
+    proc i
+      = [ "PROC p" ++ show i ++ " (VAL INT x, CHAN INT out!)"
+        , "  INT y:"
+        , "  SEQ"
+        , "    y := (x * " ++ show (i + 1) ++ ") + " ++ show i
+        , "    IF"
+        , "      y > 100"
+        , "        out ! y"
+        , "      TRUE"
+        , if i == 0 then "        out ! x" else "        p" ++ show (i - 1) ++ " (y, out!)"
+        , ":"
+        ]
+
+    main :: [String]
+    main
+      = [ "PROC main (CHAN BYTE kyb?, scr!, err!)"
+        , "  CHAN INT c:"
+        , "  PAR"
+        , "    p" ++ show (n - 1) ++ " (1, c!)"
+        , "    INT v:"
+        , "    c ? v"
+        , ":"
+        ]
+
+-- | A program with loops nested to the given depth, with a variable declared
+-- at each level, which gives the flow analyses lots of back edges to go
+-- round and large sets of variables to carry.
+nestedProgram :: Int -> String
+nestedProgram depth = unlines $ mainProc $
+  [ "INT y:"
+  , "SEQ"
+  , "  y := " ++ show (depth * depth)
+  ] ++ map ("  " ++) (level depth)
+  where
+    level :: Int -> [String]
+    level 0 = ["x := x + 1"]
+    level d
+      = [ "INT " ++ v ++ ":"
+        , "SEQ"
+        , "  " ++ v ++ " := " ++ show d
+        , "  WHILE x < " ++ v
+        , "    IF"
+        , "      y > " ++ v
+        , "        SEQ"
+        , "          y := y - 1"
+        ] ++ map ("          " ++) (level (d - 1)) ++
+        [ "      TRUE"
+        , "        x := x + 1"
+        ]
+      where
+        v = "v" ++ show d
+
+-- | A program with the given number of PROCs that each contain a replicated
+-- PAR.  The PARs write to alternate elements of one array while reading the
+-- others, so each one gives the usage checker a problem to solve; the
+-- replicator counts vary so that they aren't all the same problem.
+repParProgram :: Int -> String
+repParProgram n = unlines $ concatMap proc [0 .. n - 1] ++ mainProc body
+  where
+    proc :: Int -> [String]
+    proc i
+      = [ "PROC r" ++ show i ++ " ([100]INT a, [50]INT b, c)"
+        , "  PAR j = 0 FOR " ++ show (50 - (i `mod` 10))
+        , "    SEQ"
+        , "      a[2 * j] := b[j] + " ++ show i
+        , "      c[j] := a[(2 * j) + 1]"
+        , ":"
+        ]
+
+    body :: [String]
+    body
+      = [ "[100]INT a:"
+        , "[50]INT b, c:"
+        , "SEQ"
+        , "  SEQ i = 0 FOR 100"
+        , "    a[i] := i"
+        , "  SEQ i = 0 FOR 50"
+        , "    b[i] := i"
+        ] ++ ["  r" ++ show i ++ " (a, b, c)" | i <- [0 .. n - 1]] ++
+        [ "  x := c[0]"
+        ]
+
+-- | A program with constant tables of the given number of elements: one of
+-- integers, and one of strings.
+tableProgram :: Int -> String
+tableProgram n = unlines $
+  [ "VAL [" ++ show n ++ "]INT ints IS [" ++ intercalate ", " (map show ints) ++ "]:"
+  , "VAL [" ++ show n ++ "][8]BYTE names IS [" ++ intercalate ", " (map name [0 .. n - 1]) ++ "]:"
+  ] ++ mainProc
+  [ "SEQ i = 0 FOR " ++ show n
+  , "  x := (x + ints[i]) + (INT names[i][7])"
+  ]
+  where
+    ints = [(i * 7919) `mod` 65521 | i <- [0 .. n - 1]]
+
+    name :: Int -> String
+    name i = "\"name" ++ replicate (4 - length (show i')) '0' ++ show i' ++ "\""
+      where
+        i' = i `mod` 10000
+
+-- | A program with the given number of variant protocols.  Each has a
+-- sender and a receiver for it, which are run in parallel over a channel.
+protocolProgram :: Int -> String
+protocolProgram n = unlines $ concatMap proto [0 .. n - 1] ++ mainProc body
+  where
+    proto :: Int -> [String]
+    proto i
+      = [ "PROTOCOL P" ++ s
+        , "  CASE"
+        , "    a" ++ s ++ "; INT; INT"
+        , "    b" ++ s ++ "; BYTE; [4]INT"
+        , "    c" ++ s
+        , ":"
+        , "PROC send" ++ s ++ " (CHAN P" ++ s ++ " out!)"
+        , "  SEQ"
+        , "    out ! a" ++ s ++ "; " ++ s ++ "; 1"
+        , "    out ! b" ++ s ++ "; 'x'; [1, 2, 3, " ++ s ++ "]"
+        , "    out ! c" ++ s
+        , ":"
+        , "PROC recv" ++ s ++ " (CHAN P" ++ s ++ " in?, INT total)"
+        , "  SEQ i = 0 FOR 3"
+        , "    in ? CASE"
+        , "      INT p, q:"
+        , "      a" ++ s ++ "; p; q"
+        , "        total := total + (p + q)"
+        , "      BYTE p:"
+        , "      [4]INT q:"
+        , "      b" ++ s ++ "; p; q"
+        , "        total := total + (INT p)"
+        , "      c" ++ s
+        , "        SKIP"
+        , ":"
+        , "PROC pair" ++ s ++ " (INT total)"
+        , "  CHAN P" ++ s ++ " c:"
+        , "  PAR"
+        , "    send" ++ s ++ " (c!)"
+        , "    recv" ++ s ++ " (c?, total)"
+        , ":"
+        ]
+      where
+        s = show i
+
+    body :: [String]
+    body = ["SEQ"] ++ ["  pair" ++ show i ++ " (x)" | i <- [0 .. n - 1]]
@@ -0,0 +1,87 @@
+{-
+Tock: a compiler for parallel languages
+Copyright (C) 2007, 2008, 2009  University of Kent
+
+This program is free software; you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 2 of the License, or (at your
+option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+-}
+
+-- | Benchmarks for the usage checker.  These take the passing cases from the
+-- array usage-check tests in @testcases\/automatic@, and build programs
+-- containing the given number of copies of them (each in its own PROC), so
+-- that the checker sees lots of PARs giving the same Omega test problems.
+-- They must be run from the top of the source tree.
+module UsageCheckBench (benchmarks) where
+
+import Control.Exception (evaluate)
+import Control.Monad.Trans (liftIO)
+import Data.Generics (gsize)
+import Data.List
+
+import Benchmark
+import CompState
+import Errors
+import ParseOccam
+import Pass
+import PassList
+import PreprocessOccam
+
+benchmarks :: [Benchmark]
+benchmarks =
+  [ Benchmark ("UsageCheck " ++ name) [100, 300, 1000] $ benchUsageCheck name
+  | name <- ["usage-check-1", "usage-check-2", "usage-check-4"]
+  ]
+
+-- | Make a program from a test file, with the given number of copies of the
+-- passing cases (cycling through them as many times as needed).  The test
+-- files used all have a @PROC p@ that the cases are substituted into, followed
+-- by a @PROC m@; these are numbered so that each copy has its own.
+usageCheckProgram :: String -> Int -> String
+usageCheckProgram test n
+  = unlines $ concat [instantiate i body | (i, body) <- zip [0 .. n - 1] (cycle passing)]
+  where
+    (template, cases) = break isCase $ dropWhile ("--" `isPrefixOf`) $ lines test
+    passing = [body | ("%PASS", body) <- splitCases cases]
+
+    isCase :: String -> Bool
+    isCase l = "%" `isPrefixOf` l && l /= "%%"
+
+    splitCases :: [String] -> [(String, [String])]
+    splitCases [] = []
+    splitCases (l:ls) = (takeWhile (/= ' ') l, body) : splitCases rest
+      where
+        (body, rest) = break isCase ls
+
+    instantiate :: Int -> [String] -> [String]
+    instantiate i body = concat [if l == "%%" then body else [rename l] | l <- template]
+      where
+        rename l
+          | "PROC p(" `isPrefixOf` l = "PROC p" ++ show i ++ "(" ++ drop 7 l
+          | "PROC m()" `isPrefixOf` l = "PROC m" ++ show i ++ "()" ++ drop 8 l
+          | otherwise = l
+
+-- | Time the usage checking pass (and not the passes before it).
+benchUsageCheck :: String -> Int -> IO Double
+benchUsageCheck name n
+  =  do test <- readFile $ "testcases/automatic/" ++ name ++ ".occ.test"
+        let source = usageCheckProgram test n
+            (before, usageCheck:_) = break ((== "Usage checking") . passName) $ getPassList emptyOpts
+        _ <- evaluate $ length source
+        (r, _) <- runPassM emptyState $
+          do ast <- preprocessOccamSource source >>= parseOccamProgram >>= runPasses before
+             liftIO $ evaluate $ gsize ast
+             (_, t) <- timeIO $ passCode usageCheck ast
+             return t
+        case r of
+          Left e -> dieIO e
+          Right t -> return t
@@ -70,8 +70,8 @@ type BK' = [Map.Map Var (Either String (EqualityProblem, InequalityProblem))]
 --
 -- Returns Nothing if no solutions, a String with a counter-example if there
 -- are solutions
-findRepSolutions :: (CSMR m, MonadIO m) => [(A.Name, A.Replicator)] -> [BK] -> m (Maybe String)
-findRepSolutions reps bks
+findRepSolutions :: (CSMR m, MonadIO m) => OmegaMemo -> [(A.Name, A.Replicator)] -> [BK] -> m (Maybe String)
+findRepSolutions memo reps bks
   -- To get the right comparison, we create a SeqItems with all the accesses
   -- Because they are inside a PAR replicator, they will all get compared to each
   -- other with one set of BK applied to i and one applied to i', but they will
@@ -85,7 +85,8 @@ findRepSolutions reps bks
             Right problems -> do
               probs <- formatProblems [(vm, prob) | (_,vm,prob) <- problems]
               debug $ "Problems in findRepSolutions:\n" ++ probs
-              case catMaybes [fmap ((,) i) $ solve p | (i::Integer, p) <- zip [0..] problems] of
+              sols <- mapM (solve memo) problems
+              case catMaybes [fmap ((,) i) sol | (i::Integer, sol) <- zip [0..] sols] of
                 [] -> return Nothing -- No solutions, safe
                 xs -> liftM (Just . unlines) $ mapM format xs
             res -> error $ "Unexpected reachability result"
@@ -99,8 +100,8 @@ findRepSolutions reps bks
 
 -- | A check-pass that checks the given ParItems (usually generated from a control-flow graph)
 -- for any overlapping array indices.
-checkArrayUsage :: forall m. (Die m, CSMR m, MonadIO m) => NameAttr -> (Meta, ParItems (BK, UsageLabel)) -> m ()
-checkArrayUsage sharedAttr (m,p)
+checkArrayUsage :: forall m. (Die m, CSMR m, MonadIO m) => OmegaMemo -> NameAttr -> (Meta, ParItems (BK, UsageLabel)) -> m ()
+checkArrayUsage memo sharedAttr (m,p)
   = do indexes <- groupArrayIndexes $ fmap (transformPair id nodeVars) p
        let filteredIndexes = Map.toList $ Map.filter
              ((>= 1) . length . map (\(_,w,r) -> w++r) . F.toList) indexes
@@ -180,10 +181,11 @@ checkArrayUsage sharedAttr (m,p)
                Right problems -> do
                  probs <- formatProblems [(vm, prob) | (_,vm,prob) <- problems]
                  debug $ "Problems in checkArrayUsage" ++ show m ++ ":\n" ++ probs
-                 case mapMaybe solve problems of
+                 solution <- firstSolution problems
+                 case solution of
                    -- No solutions; no worries!
-                   [] -> return ()
-                   (((lx,ly),varMapping,vm,problem):_) ->
+                   Nothing -> return ()
+                   Just ((lx,ly),varMapping,vm,problem) ->
                      do sol <- formatSolution varMapping vm
                         cx <- showCode (fst lx)
                         cy <- showCode (fst ly)
@@ -197,6 +199,16 @@ checkArrayUsage sharedAttr (m,p)
                                  ++ "(\"" ++ cx ++ "\" and \"" ++ cy ++ "\") could overlap"
                                  ++ if sol /= "" then " when: " ++ sol else ""
 
+    -- Solves each problem in turn, stopping at the first that has a solution:
+    firstSolution :: [(labels,vm,(EqualityProblem,InequalityProblem))] ->
+      m (Maybe (labels,vm,VariableMapping,(EqualityProblem,InequalityProblem)))
+    firstSolution [] = return Nothing
+    firstSolution (prob:probs)
+      = do sol <- solve memo prob
+           case sol of
+             Just _ -> return sol
+             Nothing -> firstSolution probs
+
     -- TODO this is surely defined elsewhere already?
     getRealName :: A.Name -> m String
     getRealName n = lookupName n >>* A.ndOrigName
@@ -247,11 +259,13 @@ formatProblem varToIndex (eq, ineq)
               _ -> show a ++ "*"
 
 -- | Solves the problem and munges the arguments and results into a useful order
-solve :: (labels,vm,(EqualityProblem,InequalityProblem)) ->
-  Maybe (labels,vm,VariableMapping,(EqualityProblem,InequalityProblem))
-solve (ls,vm,(eq,ineq)) = case solveProblem eq ineq of
-      Nothing -> Nothing
-      Just vm' -> Just (ls,vm,vm',(eq,ineq))
+solve :: MonadIO m => OmegaMemo -> (labels,vm,(EqualityProblem,InequalityProblem)) ->
+  m (Maybe (labels,vm,VariableMapping,(EqualityProblem,InequalityProblem)))
+solve memo (ls,vm,(eq,ineq))
+  = do sol <- liftIO $ solveProblemMemo memo eq ineq
+       return $ case sol of
+         Nothing -> Nothing
+         Just vm' -> Just (ls,vm,vm',(eq,ineq))
 
 -- | Formats a solution (not a problem, just the solution) ready to print it out for the user
 formatSolution :: (CSMR m, Monad m) => VarMap -> VariableMapping -> m String
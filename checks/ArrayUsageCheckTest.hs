@@ -215,6 +215,29 @@ makeConsistent eqs ineqs = (map ensure eqs', map ensure ineqs')
     largestIndex = maximum $ map (maximum . map fst) $ [[(0,0)]] ++ eqs' ++ ineqs'
 
 
+-- | Checks that the memoised solver agrees with the plain one, and that it
+-- gives the same answer for a problem with its equations reordered and
+-- duplicated.
+testOmegaMemo :: Test
+testOmegaMemo = TestLabel "testOmegaMemo" $ TestCase $
+  do memo <- newOmegaMemo
+     forM_ (zip [0..] problems) $ \(ind :: Int, (eq, ineq)) ->
+       do first <- solveProblemMemo memo eq ineq
+          again <- solveProblemMemo memo (reverse eq) (reverse ineq ++ ineq)
+          assertEqual ("testOmegaMemo " ++ show ind)
+            (isJust $ solveProblem eq ineq) (isJust first)
+          assertEqual ("testOmegaMemo " ++ show ind ++ " reordered") first again
+  where
+    problems :: [(EqualityProblem, InequalityProblem)]
+    problems = map (uncurry makeConsistent)
+      [ ([i === j], i_j_constraint 0 7)
+      , ([i ++ con 1 === j], i_j_constraint 0 7)
+      , ([2 ** i === j], i_j_constraint 0 7)
+      , ([2 ** i === 2 ** j ++ con 1], i_j_constraint 0 7)
+      , ([], [con 2 <== i, i <== con 1])
+      , ([], [con 2 <== i, i <== con 3] &&& leq [i ++ con 1, j, con 5])
+      ]
+
 -- | Returns Nothing if there is definitely no solution, or (Just ineq) if 
 -- further investigation is needed
 
@@ -1168,6 +1191,7 @@ vioqcTests v
           testArrayCheck
          ,testIndexes
          ,testMakeEquations
+         ,testOmegaMemo
          ]
         ++ map (automaticTest FrontendOccam v)
          ["testcases/automatic/usage-check-1.occ.test"
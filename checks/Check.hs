@@ -25,6 +25,7 @@ module Check (checkInitVarPass, usageCheckPass, checkUnusedVar) where
 import Control.Monad.State
 import Control.Monad.Trans
 import Data.Generics (Data)
+import qualified Data.IntSet as IntSet
 import Data.Graph.Inductive hiding (mapSnd)
 import Data.List hiding (union)
 import qualified Data.Map as Map
@@ -43,6 +44,7 @@ import FlowAlgorithms
 import FlowGraph
 import FlowUtils
 import Metadata
+import Omega (OmegaMemo, newOmegaMemo)
 import Pass
 import ShowCode
 import Traversal
@@ -52,7 +54,8 @@ import UsageCheckUtils
 import Utils
 
 usageCheckPass :: A.AST -> PassM A.AST
-usageCheckPass t = do progress "- - Building flow graph"
+usageCheckPass t = do memo <- liftIO newOmegaMemo
+                      progress "- - Building flow graph"
                       g' <- buildFlowGraph labelUsageFunctions t
                       (g, roots) <- case g' of
                         Left err -> dieP (findMeta t) err
@@ -70,15 +73,15 @@ usageCheckPass t = do progress "- - Building flow graph"
                                 Right c -> return c
                       g' <- labelMapWithNodeIdM (addBK reach cons g) g
                       progress "- - Checking flow graph for CREW"
-                      checkPar (nodeRep . snd)
+                      checkParWith runChecksInParallel (nodeRep . snd)
                         (joinCheckParFunctions
-                          (checkArrayUsage NameShared)
-                          (checkPlainVarUsage NameShared))
+                          (checkArrayUsage memo NameShared)
+                          (checkPlainVarUsage memo NameShared))
                         g'
                       progress "- - Checking parallel assignments"
-                      checkParAssignUsage g' t
+                      checkParAssignUsage memo g' t
                       progress "- - Checking PROC arguments"
-                      checkProcCallArgsUsage g' t
+                      checkProcCallArgsUsage memo g' t
 --                      mapM_ (checkInitVar (findMeta t) g) roots
                       debug "Completed usage checking"
                       return t
@@ -332,8 +335,8 @@ foldUnionVarsBK
     mkR bk = (Just bk, Nothing)
     mkW (_, bk) = (Nothing, Just bk)
 
-checkPlainVarUsage :: forall m. (MonadIO m, Die m, CSMR m) => NameAttr -> (Meta, ParItems (BK, UsageLabel)) -> m ()
-checkPlainVarUsage sharedAttr (m, p) = check p
+checkPlainVarUsage :: forall m. (MonadIO m, Die m, CSMR m) => OmegaMemo -> NameAttr -> (Meta, ParItems (BK, UsageLabel)) -> m ()
+checkPlainVarUsage memo sharedAttr (m, p) = check p
   where
     addBK :: BK -> Vars -> m VarsBK
     addBK bk vs
@@ -451,7 +454,7 @@ checkPlainVarUsage sharedAttr (m, p) = check p
       = do sol <- if null (reps p)
                      -- If there are no replicators, it's definitely dangerous:
                      then return $ Just "<always>"
-                     else findRepSolutions (reps p) (bk:bks)
+                     else findRepSolutions memo (reps p) (bk:bks)
            case sol of
              Nothing -> return ()
              Just sol' -> diePC m $ formatCode (msg ++ sol') v
@@ -470,9 +473,11 @@ checkInitVarPass = pass "checkInitVar" [] []
 checkInitVar :: CheckOptM ()
 checkInitVar = forAnyFlowNode
   (\(g, roots, _) -> sequence
-     [case flowAlgorithm (graphFuncs g) (dfs [r] g) (r, writeNode (fromJust $ lab g r)) of
-       Left err -> dieP emptyMeta err
-       Right x -> return x
+     [let ns = dfs [r] g
+          index = makeVarIndex $ Set.unions [writeNode l | Just l <- map (lab g) ns]
+       in case flowAlgorithm (graphFuncs g index) ns (r, writeBits index (lab g r)) of
+            Left err -> dieP emptyMeta err
+            Right x -> return $ Map.map (bitsToExSet index) x
      | r <- roots] >>* foldl Map.union Map.empty)
   checkInitVar'
        -- We check that for every variable read in each node, it has already been written to by then
@@ -482,22 +487,27 @@ checkInitVar = forAnyFlowNode
     readNode u = NormalSet $ readVars $ nodeVars u
   
     -- Gets all variables written-to in a particular node
-    writeNode :: Monad m => FNode m UsageLabel -> ExSet Var
-    writeNode nd = NormalSet $ Map.keysSet $ writtenVars $ nodeVars $ getNodeData nd
+    writeNode :: Monad m => FNode m UsageLabel -> Set.Set Var
+    writeNode nd = Map.keysSet $ writtenVars $ nodeVars $ getNodeData nd
+
+    -- The analysis itself works on the numbers of the variables written to
+    -- in the part of the graph reachable from the root:
+    writeBits :: Monad m => VarIndex -> Maybe (FNode m UsageLabel) -> VarBits
+    writeBits index = maybe (SomeVars IntSet.empty) (varBits index . writeNode)
     
-    -- Nothing is treated as if were the set of all possible variables:
-    nodeFunction :: Monad m => FlowGraph m UsageLabel -> (Node, EdgeLabel) -> ExSet Var -> Maybe (ExSet Var) -> ExSet Var
-    nodeFunction graph (n,_) inputVal Nothing = union inputVal (maybe emptySet writeNode (lab graph n))    
-    nodeFunction graph (n, EEndPar _) inputVal (Just prevAgg) = unions [inputVal,prevAgg,maybe emptySet writeNode (lab graph n)]
-    nodeFunction graph (n, _) inputVal (Just prevAgg) = intersection prevAgg $ union inputVal (maybe emptySet writeNode (lab graph n))
+    -- AllVars is treated as if were the set of all possible variables:
+    nodeFunction :: Monad m => FlowGraph m UsageLabel -> VarIndex -> (Node, EdgeLabel) -> VarBits -> Maybe VarBits -> VarBits
+    nodeFunction graph index (n,_) inputVal Nothing = bitsUnion inputVal (writeBits index (lab graph n))
+    nodeFunction graph index (n, EEndPar _) inputVal (Just prevAgg) = inputVal `bitsUnion` prevAgg `bitsUnion` writeBits index (lab graph n)
+    nodeFunction graph index (n, _) inputVal (Just prevAgg) = bitsIntersection prevAgg $ bitsUnion inputVal (writeBits index (lab graph n))
   
-    graphFuncs :: Monad m => FlowGraph m UsageLabel -> GraphFuncs Node EdgeLabel (ExSet Var)
-    graphFuncs graph = GF
+    graphFuncs :: Monad m => FlowGraph m UsageLabel -> VarIndex -> GraphFuncs Node EdgeLabel VarBits
+    graphFuncs graph index = GF
       {
-       nodeFunc = nodeFunction graph
+       nodeFunc = nodeFunction graph index
        ,nodesToProcess = lpre graph
        ,nodesToReAdd = lsuc graph
-       ,defVal = Everything
+       ,defVal = AllVars
        ,userErrLabel = ("for node at: " ++) . show . fmap getNodeMeta . lab graph
       }
       
@@ -530,8 +540,8 @@ findAllProcess f g t = Map.elems $ Map.intersectionWith (,) astMap nodeMap
 
 checkParAssignUsage :: forall m t. (CSMR m, Die m, MonadIO m, Data t,
   AlloyARoute (A.Structured t) (OneOpMRoute A.Process) BaseOpMRoute
-  ) => FlowGraph' m (BK, UsageLabel) t -> A.Structured t -> m ()
-checkParAssignUsage g = mapM_ checkParAssign . findAllProcess isParAssign g
+  ) => OmegaMemo -> FlowGraph' m (BK, UsageLabel) t -> A.Structured t -> m ()
+checkParAssignUsage memo g = mapM_ checkParAssign . findAllProcess isParAssign g
   where
     isParAssign :: A.Process -> Bool
     isParAssign (A.Assign _ vs _) = length vs >= 2
@@ -542,8 +552,8 @@ checkParAssignUsage g = mapM_ checkParAssign . findAllProcess isParAssign g
     checkParAssign :: (A.Process, (BK, UsageLabel)) -> m ()
     checkParAssign (A.Assign m vs _, (bk, _))
       = do debug $ "Checking assignment at: " ++ show m
-           checkPlainVarUsage NameShared (m, mockedupParItems)
-           checkArrayUsage NameShared (m, mockedupParItems)
+           checkPlainVarUsage memo NameShared (m, mockedupParItems)
+           checkArrayUsage memo NameShared (m, mockedupParItems)
       where
         mockedupParItems :: ParItems (BK, UsageLabel)
         mockedupParItems = fmap ((,) bk) $ ParItems [SeqItems [Usage Nothing Nothing Nothing
@@ -553,8 +563,8 @@ checkProcCallArgsUsage :: forall m t. (CSMR m, Die m, MonadIO m, Data t,
   AlloyARoute (A.Structured t) (OneOpMRoute A.Process)
                   BaseOpMRoute
   ) =>
-  FlowGraph' m (BK, UsageLabel) t -> A.Structured t -> m ()
-checkProcCallArgsUsage g = mapM_ checkArgs . findAllProcess isProcCall g
+  OmegaMemo -> FlowGraph' m (BK, UsageLabel) t -> A.Structured t -> m ()
+checkProcCallArgsUsage memo g = mapM_ checkArgs . findAllProcess isProcCall g
   where
     isProcCall :: A.Process -> Bool
     isProcCall (A.ProcCall {}) = True
@@ -570,8 +580,8 @@ checkProcCallArgsUsage g = mapM_ checkArgs . findAllProcess isProcCall g
            let mockedupParItems = fmap ((,) bk) $
                  ParItems [SeqItems [Usage Nothing Nothing Nothing v]
                           | v <- vars]
-           checkPlainVarUsage NameAliasesPermitted (m, mockedupParItems)
-           checkArrayUsage NameAliasesPermitted (m, mockedupParItems)
+           checkPlainVarUsage memo NameAliasesPermitted (m, mockedupParItems)
+           checkArrayUsage memo NameAliasesPermitted (m, mockedupParItems)
            debug $ "Done checking PROC call"
 
 -- This isn't actually just unused variables, it's all unused names (except PROCs)
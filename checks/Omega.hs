@@ -21,6 +21,7 @@ module Omega where
 import Control.Arrow
 import Control.Monad.State
 import Data.Array.IArray
+import Data.IORef
 import Data.List
 import qualified Data.Map as Map
 import Data.Maybe
@@ -89,9 +90,7 @@ addEqToMapping (k, subst) (VariableMapping vm) = VariableMapping $ addOldToNew v
       where
         ignoreNewVal = flip const
     
-    updateSub eq = arrayZipWith (+) (eq // [(k,0)]) $ scaleEq eq_k subst
-      where
-        eq_k = eq ! k
+    updateSub = substituteEq k subst
 
 addIneqToMapping :: (CoeffIndex, [(Integer, InequalityConstraintEquation)]
   , [(Integer, InequalityConstraintEquation)])
@@ -127,6 +126,26 @@ getCounterEqs (VariableMapping origToLast)
 scaleEq :: (IArray a e, Ix i, Num e) => e -> a i e -> a i e
 scaleEq n = amap (* n)
 
+-- | Substitutes x_k = subst into an equation: zeroes the a_k coefficient, and
+-- adds on subst scaled by the old a_k.  The equations are built directly,
+-- rather than by scaling, adding and updating arrays in turn, as this is done
+-- to every equation at each step of the solver.
+substituteEq :: CoeffIndex -> EqualityConstraintEquation -> EqualityConstraintEquation
+  -> EqualityConstraintEquation
+substituteEq k subst eq
+  = listArray bnds [(if i == k then 0 else eq ! i) + a_k * (subst ! i) | i <- range bnds]
+  where
+    bnds = bounds eq
+    a_k = eq ! k
+
+-- | Adds together two equations scaled by the given amounts, and a constant.
+combineEqs :: Integer -> InequalityConstraintEquation -> Integer -> InequalityConstraintEquation
+  -> Integer -> InequalityConstraintEquation
+combineEqs x ex y ey c
+  = listArray bnds [x * (ex ! i) + y * (ey ! i) + (if i == 0 then c else 0) | i <- range bnds]
+  where
+    bnds = bounds ex
+
 -- | Solves all the constraints in the Equality Problem (taking them to be == 0),
 -- and transforms the InequalityProblems appropriately.  It also records
 -- a variable mapping so that we can feed back the final answer to the user
@@ -175,14 +194,10 @@ solveConstraints vm p ineq
     -- | Substitutes a value for x_k into an equation.  Given k, the value for x_k in terms
     -- of coefficients of other variables (let's call it x_k_val), it subsitutes this into
     -- all the equations in the list by adding x_k_val (scaled by a_k) to each equation and
-    -- then zeroing out the a_k value.  Note that the (x_k_val ! k) value will be ignored;
-    -- it should be zero, in any case (otherwise x_k would be defined in terms of itself!).
+    -- zeroing out the a_k value.  Note that the (x_k_val ! k) value should be zero
+    -- (otherwise x_k would be defined in terms of itself!).
     substIn :: CoeffIndex -> Array CoeffIndex Integer -> (VariableMapping, EqualityProblem) -> (VariableMapping, EqualityProblem)
-    substIn k x_k_val = transformPair (addEqToMapping (k,x_k_val)) (map substIn')
-      where
-        substIn' eq = (arrayZipWith (+) eq scaled_x_k_val) // [(k,0)]
-          where
-            scaled_x_k_val = amap (* (eq ! k)) x_k_val
+    substIn k x_k_val = transformPair (addEqToMapping (k,x_k_val)) (map $ substituteEq k x_k_val)
 
     -- | Solves (i.e. removes by substitution) all unit coefficients in the given list of equations.
     solveUnits :: EqualityProblem -> StateT (VariableMapping, InequalityProblem) Maybe EqualityProblem
@@ -232,12 +247,9 @@ solveConstraints vm p ineq
                                           let (_,p') = change (undefined,p)
                                           put (mp,ineq)
                                           return p'
-                           change = transformPair (addEqToMapping (k,x_k_eq)) (map alterEquation)
-                         
-                           -- | Adds a scaled version of x_k_eq onto the current equation, after zeroing out
-                           -- the a_k coefficient in the current equation.
-                           alterEquation :: EqualityConstraintEquation -> EqualityConstraintEquation
-                           alterEquation eq = arrayZipWith (+) (eq // [(k,0)]) (amap (\x -> x * (eq ! k)) x_k_eq)
+                           -- Each equation has a scaled version of x_k_eq added on, after zeroing out
+                           -- its a_k coefficient:
+                           change = transformPair (addEqToMapping (k,x_k_eq)) (map $ substituteEq k x_k_eq)
 
                            k = findSmallestAbsCoeff e
                            a_k = e ! k
@@ -493,7 +505,7 @@ fmElimination vm ineq = fmElimination' vm (presentItems ineq) ineq
         (eqA,eqB,eqC) = splitBounds k ineqs
                 
         pairIneqs :: (Integer, InequalityConstraintEquation) -> (Integer, InequalityConstraintEquation) -> InequalityConstraintEquation
-        pairIneqs (x,ex) (y,ey) = arrayZipWith (+) (amap (* y) ex) (amap (* x) ey)
+        pairIneqs (x,ex) (y,ey) = combineEqs y ex x ey 0
 
     -- Gets the dark shadow of a given variable.  The dark shadow, for possible
     -- upper bounds (ax <= alpha) and lower bounds (beta <= bx) is the inequality
@@ -504,7 +516,7 @@ fmElimination vm ineq = fmElimination' vm (presentItems ineq) ineq
         (eqA,eqB,eqC) = splitBounds k ineqs
         
         pairIneqsDark :: (Integer, InequalityConstraintEquation) -> (Integer, InequalityConstraintEquation) -> InequalityConstraintEquation
-        pairIneqsDark (x,ex) (y,ey) = addConstant (-1*(y-1)*(x-1)) (arrayZipWith (+) (amap (* y) ex) (amap (* x) ey))
+        pairIneqsDark (x,ex) (y,ey) = combineEqs y ex x ey (-1*(y-1)*(x-1))
 
     -- Checks if eliminating the specified variable would yield an exact projection (real shadow = dark shadow):
     -- This will be the case if the coefficient on all lower bounds or on all upper bounds is 1.  We check
@@ -540,3 +552,34 @@ solveProblem eq ineq = solveProblem' (defaultMapping maxVar) eq ineq
   where
     maxVar = if null eq && null ineq then 0 else
                 if null eq then snd $ bounds $ head ineq else snd $ bounds $ head eq
+
+-- | Puts a problem into a canonical form, by sorting its equations and
+-- removing duplicates; the order of the equations doesn't affect whether there
+-- is a solution.
+canonicalProblem :: EqualityProblem -> InequalityProblem -> (EqualityProblem, InequalityProblem)
+canonicalProblem eq ineq = (canon eq, canon ineq)
+  where
+    canon = map head . group . sort
+
+-- | A table of the problems that have already been solved.  The usage checker
+-- generates many problems that are identical to each other (for example, from
+-- several PARs over the same arrays), so it's worth remembering the answers.
+newtype OmegaMemo = OmegaMemo (IORef (Map.Map (EqualityProblem, InequalityProblem) (Maybe VariableMapping)))
+
+newOmegaMemo :: IO OmegaMemo
+newOmegaMemo = liftM OmegaMemo $ newIORef Map.empty
+
+-- | Like 'solveProblem', but looks the problem up in (and adds it to) the given
+-- table.  The problem is always solved in its canonical form, so that the
+-- solution returned doesn't depend on which problems were solved before.
+solveProblemMemo :: OmegaMemo -> EqualityProblem -> InequalityProblem -> IO (Maybe VariableMapping)
+solveProblemMemo (OmegaMemo ref) eq ineq
+  =  do table <- readIORef ref
+        case Map.lookup key table of
+          Just result -> return result
+          Nothing ->
+            do let result = uncurry solveProblem key
+               result `seq` atomicModifyIORef ref (\t -> (Map.insert key result t, ()))
+               return result
+  where
+    key = canonicalProblem eq ineq
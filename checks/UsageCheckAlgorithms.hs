@@ -16,7 +16,7 @@ You should have received a copy of the GNU General Public License along
 with this program.  If not, see <http://www.gnu.org/licenses/>.
 -}
 
-module UsageCheckAlgorithms (checkPar, findConstraints, findReachDef, joinCheckParFunctions) where
+module UsageCheckAlgorithms (checkPar, checkParWith, findConstraints, findReachDef, joinCheckParFunctions) where
 
 import Control.Monad
 import Data.Graph.Inductive
@@ -39,8 +39,14 @@ joinCheckParFunctions f g x = seqPair (f x, g x)
 
 -- | Given a function to check a list of graph labels and a flow graph,
 -- checks all PAR items in the flow graph
-checkPar :: forall m a b. Monad m => (a -> Maybe (A.Name, A.Replicator)) -> ((Meta, ParItems a) -> m b) -> FlowGraph m a -> m [b]
-checkPar getRep f g = mapM f =<< allParItems
+checkPar :: Monad m => (a -> Maybe (A.Name, A.Replicator)) -> ((Meta, ParItems a) -> m b) -> FlowGraph m a -> m [b]
+checkPar = checkParWith sequence
+
+-- | Like 'checkPar', but takes the function used to run the checks for all the
+-- PAR items, which may run them in parallel.  It must return the results in
+-- the same order as the checks.
+checkParWith :: forall m a b. Monad m => ([m b] -> m [b]) -> (a -> Maybe (A.Name, A.Replicator)) -> ((Meta, ParItems a) -> m b) -> FlowGraph m a -> m [b]
+checkParWith runAll getRep f g = runAll . map f =<< allParItems
   where
     allStartParEdges :: m (Map.Map Integer (Maybe (A.Name, A.Replicator), [(Node,Node)]))
     allStartParEdges = foldM helper Map.empty parEdges
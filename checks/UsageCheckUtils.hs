@@ -16,13 +16,15 @@ You should have received a copy of the GNU General Public License along
 with this program.  If not, see <http://www.gnu.org/licenses/>.
 -}
 
-module UsageCheckUtils (Decl(..), emptyVars, flattenParItems, foldUnionVars, getVarProcCall, getVarProc, labelUsageFunctions, mapUnionVars, ParItems(..), processVarW, transformParItems, UsageLabel(..), Var(..), Vars(..), vars) where
+module UsageCheckUtils (bitsIntersection, bitsToExSet, bitsUnion, Decl(..), emptyVars, flattenParItems, foldUnionVars, getVarProcCall, getVarProc, labelUsageFunctions, mapUnionVars, ParItems(..), processVarW, transformParItems, UsageLabel(..), Var(..), VarBits(..), VarIndex, varBits, Vars(..), makeVarIndex, vars) where
 
 import Control.Applicative
 import Control.Monad.State
 import Control.Monad.Writer (tell)
+import Data.Array (Array, listArray, (!))
 import qualified Data.Foldable as F
 import Data.Generics (Data, Typeable)
+import qualified Data.IntSet as IntSet
 import Data.List
 import qualified Data.Map as Map
 import Data.Maybe
@@ -33,6 +35,7 @@ import qualified AST as A
 import CompState
 import Data.Generics.Alloy.Schemes
 import Errors
+import ExSet (ExSet(..))
 import FlowGraph
 import Intrinsics
 import Metadata
@@ -65,6 +68,46 @@ data Vars = Vars {
   ,usedVars :: Set.Set Var -- for channels, barriers, etc
 } deriving (Eq, Show)
 
+-- | A numbering of a set of variables.  Comparing two 'Var's means walking
+-- both variables in the AST, so the data-flow analyses that keep sets of
+-- variables for every node of the flow graph number the variables first and
+-- work on 'VarBits' instead.  The numbers follow the order of the variables,
+-- so converting back doesn't need any comparisons.
+data VarIndex = VarIndex (Map.Map Var Int) (Array Int Var)
+
+makeVarIndex :: Set.Set Var -> VarIndex
+makeVarIndex vs = VarIndex (Map.fromDistinctAscList $ zip vsl [0..])
+                           (listArray (0, Set.size vs - 1) vsl)
+  where
+    vsl = Set.toAscList vs
+
+-- | A set of numbered variables, which may be the set of all variables.  An
+-- 'IntSet' of small dense numbers is stored as bitmaps, so the set operations
+-- work a machine word at a time.
+data VarBits = AllVars | SomeVars IntSet.IntSet
+  deriving (Eq, Show)
+
+-- | The numbers for a set of variables.  Variables that aren't in the index
+-- are left out.
+varBits :: VarIndex -> Set.Set Var -> VarBits
+varBits (VarIndex m _) vs
+  = SomeVars $ IntSet.fromList $ mapMaybe (flip Map.lookup m) $ Set.toList vs
+
+bitsUnion :: VarBits -> VarBits -> VarBits
+bitsUnion AllVars _ = AllVars
+bitsUnion _ AllVars = AllVars
+bitsUnion (SomeVars a) (SomeVars b) = SomeVars $ IntSet.union a b
+
+bitsIntersection :: VarBits -> VarBits -> VarBits
+bitsIntersection AllVars x = x
+bitsIntersection x AllVars = x
+bitsIntersection (SomeVars a) (SomeVars b) = SomeVars $ IntSet.intersection a b
+
+bitsToExSet :: VarIndex -> VarBits -> ExSet Var
+bitsToExSet _ AllVars = Everything
+bitsToExSet (VarIndex _ arr) (SomeVars s)
+  = NormalSet $ Set.fromDistinctAscList $ map (arr !) $ IntSet.toAscList s
+
 -- | The Bool indicates whether the variable was initialised (True = yes)
 data Decl = ScopeIn Bool String | ScopeOut String deriving (Show, Eq)
 
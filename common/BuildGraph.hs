@@ -0,0 +1,112 @@
+{-
+Tock: a compiler for parallel languages
+Copyright (C) 2007, 2008, 2009  University of Kent
+
+This program is free software; you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 2 of the License, or (at your
+option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+-}
+
+-- | Support for building several occam modules at once: finding the
+-- dependencies between them, and compiling them in dependency order with
+-- several compiles running at the same time.
+module BuildGraph (BuildResult(..), findCycles, findDirectives, runBuildGraph) where
+
+import Control.Concurrent
+import Control.Exception
+import Data.Char
+import Data.Graph (SCC(..), stronglyConnComp)
+import Data.List
+import qualified Data.Map as Map
+import qualified Data.Set as Set
+
+-- | What happened to a module during a build.
+data BuildResult =
+  BuildOK
+  -- | The module's compile failed.
+  | BuildFailed
+  -- | The module wasn't compiled, because something it depends on failed or
+  -- is part of a cycle.
+  | BuildSkipped
+  -- | The module wasn't compiled, because it depends on itself, directly or
+  -- through other modules.
+  | BuildCycle
+  deriving (Show, Eq)
+
+-- | Find the files that occam source refers to with @#INCLUDE@ and @#USE@.
+-- This is only a quick scan of the text: it doesn't know about @#IF@, so it
+-- may find more files than the preprocessor would actually load.  Returns the
+-- included files and the used files.
+findDirectives :: String -> ([String], [String])
+findDirectives s = (named "#INCLUDE", named "#USE")
+  where
+    directives :: [(String, String)]
+    directives = [(d, rest) | l <- lines s
+                            , let (d, rest) = break isSpace $ dropWhile isSpace l
+                            , "#" `isPrefixOf` d]
+
+    named :: String -> [String]
+    named d = [name | (d', rest) <- directives, d == d'
+                   , Just name <- [quoted $ dropWhile isSpace rest]]
+
+    quoted :: String -> Maybe String
+    quoted ('"':rest) = case break (== '"') rest of
+                          (name, '"':_) -> Just name
+                          _ -> Nothing
+    quoted _ = Nothing
+
+-- | Find the cycles in a dependency graph (as for 'runBuildGraph'); each one
+-- is given as the modules that are part of it.  A module that depends
+-- directly on itself is a cycle on its own.
+findCycles :: Ord k => Map.Map k [k] -> [[k]]
+findCycles graph
+  = [ks | CyclicSCC ks <- stronglyConnComp [(k, k, deps) | (k, deps) <- Map.toList graph]]
+
+-- | Build a set of modules in dependency order, running up to the given
+-- number of builds at once.  The graph maps each module to the modules it
+-- depends on; dependencies that aren't themselves in the graph are assumed
+-- to have been built already.  The build function returns whether it
+-- succeeded; if it throws an exception, that counts as failure.
+runBuildGraph :: Ord k => Int -> Map.Map k [k] -> (k -> IO Bool) -> IO (Map.Map k BuildResult)
+runBuildGraph jobs graph build
+  =  do finished <- newChan
+        loop finished (Map.fromList [(k, BuildCycle) | ks <- findCycles graph, k <- ks])
+          Set.empty
+  where
+    deps k = filter (`Map.member` graph) $ Map.findWithDefault [] k graph
+
+    loop finished results running
+      =  do let waiting = [k | k <- Map.keys graph
+                             , not $ k `Map.member` results
+                             , not $ k `Set.member` running]
+                depResults k = [Map.lookup d results | d <- deps k]
+                doomed = [k | k <- waiting
+                            , any (`elem` [Just BuildFailed, Just BuildSkipped, Just BuildCycle])
+                                  (depResults k)]
+                ready = [k | k <- waiting, all (== Just BuildOK) (depResults k)]
+                toStart = take (max 1 jobs - Set.size running) ready
+            if not (null doomed)
+              then loop finished (foldr (\k -> Map.insert k BuildSkipped) results doomed) running
+              else do mapM_ (start finished) toStart
+                      let running' = running `Set.union` Set.fromList toStart
+                      if Set.null running'
+                        -- Cycles were found to start with, so this shouldn't
+                        -- happen:
+                        then return $ foldr (\k -> Map.insert k BuildSkipped) results waiting
+                        else do (k, ok) <- readChan finished
+                                loop finished
+                                  (Map.insert k (if ok then BuildOK else BuildFailed) results)
+                                  (Set.delete k running')
+
+    start finished k
+      = forkIO $ do r <- try (build k)
+                    writeChan finished (k, either (\(_ :: SomeException) -> False) id r)
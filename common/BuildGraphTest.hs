@@ -0,0 +1,125 @@
+{-
+Tock: a compiler for parallel languages
+Copyright (C) 2007, 2008, 2009  University of Kent
+
+This program is free software; you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 2 of the License, or (at your
+option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+-}
+
+-- #ignore-exports
+
+-- | Tests for 'BuildGraph'.
+
+module BuildGraphTest (tests) where
+
+import Control.Concurrent
+import Control.Monad
+import Data.List
+import qualified Data.Map as Map
+import Test.HUnit hiding (State)
+
+import BuildGraph
+
+testFindDirectives :: Test
+testFindDirectives = TestLabel "testFindDirectives" $ TestList
+    [ test 0 "" ([], [])
+    , test 1 "#USE \"course.lib\"\n" ([], ["course.lib"])
+    , test 2 "  #INCLUDE \"consts.inc\"\nPROC p ()\n  SKIP\n:\n" (["consts.inc"], [])
+    , test 3 "#INCLUDE \"a.inc\"\n#USE \"b\"\n#USE  \"c.tock.inc\"\n"
+             (["a.inc"], ["b", "c.tock.inc"])
+    , test 4 "#IF DEFINED (FOO)\n#USE \"foo\"\n#ENDIF\n" ([], ["foo"])
+    , test 5 "#DEFINE USE\n#USE foo\n#USE \"unterminated\n" ([], [])
+    , test 6 "-- #USE \"commented\"\nVAL INT x IS 0: -- #USE \"y\"\n" ([], [])
+    ]
+  where
+    test :: Int -> String -> ([String], [String]) -> Test
+    test n s exp = TestCase $ assertEqual ("testFindDirectives " ++ show n)
+                                          exp (findDirectives s)
+
+-- | Run a build graph, recording when each module starts and finishes.
+-- Returns the results and the log of events.
+runLogged :: Int -> [(String, [String])] -> [String] -> IO (Map.Map String BuildResult, [String])
+runLogged jobs graph failing
+  =  do events <- newMVar []
+        let event e = modifyMVar_ events (return . (e:))
+            build k = do event ("start " ++ k)
+                         yield
+                         event ("end " ++ k)
+                         return $ k `notElem` failing
+        results <- runBuildGraph jobs (Map.fromList graph) build
+        evs <- readMVar events
+        return (results, reverse evs)
+
+testRunBuildGraph :: Test
+testRunBuildGraph = TestLabel "testRunBuildGraph" $ TestList
+    [ testOrder 0 1 diamond
+    , testOrder 1 4 diamond
+    , testOrder 2 4 [("a", []), ("b", []), ("c", []), ("d", ["a", "b", "c"])]
+    , testOrder 3 2 [("a", ["lib"]), ("b", ["a", "elsewhere"])]
+
+    , testResults 100 1 diamond ["top"]
+        [("left", BuildOK), ("right", BuildOK), ("top", BuildFailed), ("bottom", BuildOK)]
+    , testResults 101 4 diamond ["left"]
+        [("left", BuildFailed), ("right", BuildOK), ("top", BuildSkipped), ("bottom", BuildOK)]
+    , testResults 102 4 diamond ["bottom"]
+        [("left", BuildSkipped), ("right", BuildSkipped), ("top", BuildSkipped), ("bottom", BuildFailed)]
+    , testResults 103 2 [("a", ["b"]), ("b", ["a"]), ("c", [])] []
+        [("a", BuildCycle), ("b", BuildCycle), ("c", BuildOK)]
+    , testResults 104 2 [("a", ["a"]), ("b", ["a"]), ("c", [])] []
+        [("a", BuildCycle), ("b", BuildSkipped), ("c", BuildOK)]
+    ]
+  where
+    diamond = [("top", ["left", "right"]), ("left", ["bottom"]), ("right", ["bottom"])
+              ,("bottom", [])]
+
+    -- Check that every module was built, and that nothing started before all
+    -- its dependencies had finished.
+    testOrder :: Int -> Int -> [(String, [String])] -> Test
+    testOrder n jobs graph = TestCase $
+      do (results, evs) <- runLogged jobs graph []
+         assertEqual ("testRunBuildGraph " ++ show n ++ " results")
+           (Map.fromList [(k, BuildOK) | (k, _) <- graph]) results
+         forM_ graph $ \(k, deps) ->
+           do let Just started = elemIndex ("start " ++ k) evs
+              forM_ [d | d <- deps, d `elem` map fst graph] $ \d ->
+                case elemIndex ("end " ++ d) evs of
+                  Just ended -> assertBool ("testRunBuildGraph " ++ show n ++ ": "
+                                              ++ k ++ " started before " ++ d ++ " ended")
+                                  (ended < started)
+                  Nothing -> assertFailure $ "testRunBuildGraph " ++ show n ++ ": "
+                                               ++ d ++ " never ended"
+
+    testResults :: Int -> Int -> [(String, [String])] -> [String] -> [(String, BuildResult)] -> Test
+    testResults n jobs graph failing exp = TestCase $
+      do (results, _) <- runLogged jobs graph failing
+         assertEqual ("testRunBuildGraph " ++ show n) (Map.fromList exp) results
+
+testFindCycles :: Test
+testFindCycles = TestLabel "testFindCycles" $ TestList
+    [ test 0 [("a", ["b"]), ("b", ["c"]), ("c", [])] []
+    , test 1 [("a", ["a"]), ("b", [])] [["a"]]
+    , test 2 [("a", ["b"]), ("b", ["c"]), ("c", ["a"]), ("d", ["a"])] [["a", "b", "c"]]
+    , test 3 [("a", ["b"]), ("b", ["a"]), ("c", ["d"]), ("d", ["c", "lib"])]
+             [["a", "b"], ["c", "d"]]
+    ]
+  where
+    test :: Int -> [(String, [String])] -> [[String]] -> Test
+    test n graph exp = TestCase $ assertEqual ("testFindCycles " ++ show n)
+                                              exp (sort $ map sort $ findCycles $ Map.fromList graph)
+
+tests :: Test
+tests = TestLabel "BuildGraphTest" $ TestList
+    [ testFindCycles
+    , testFindDirectives
+    , testRunBuildGraph
+    ]
@@ -0,0 +1,122 @@
+{-
+Tock: a compiler for parallel languages
+Copyright (C) 2007, 2008, 2009  University of Kent
+
+This program is free software; you can redistribute it and/or modify it
+under the terms of the GNU General Public License as published by the
+Free Software Foundation, either version 2 of the License, or (at your
+option) any later version.
+
+This program is distributed in the hope that it will be useful, but
+WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+General Public License for more details.
+
+You should have received a copy of the GNU General Public License along
+with this program.  If not, see <http://www.gnu.org/licenses/>.
+-}
+
+-- | An on-disk cache of compilation results, so that a module that hasn't
+-- changed doesn't have to go through the whole compiler again.
+--
+-- Entries are keyed by a hash of the preprocessed source (which includes
+-- everything that was @#INCLUDE@d or @#USE@d), the compiler options and the
+-- Tock version.  Each entry is a directory holding copies of the files that
+-- compiling the module produced: the generated C and header, the @.tock.inc@
+-- interface that other modules @#USE@, and (where they were built) the object
+-- file and stack sizes.
+module CompilationCache (cacheKey, hashString128, lookupCache, storeCache) where
+
+import Control.Monad
+import Data.Bits
+import Data.Char
+import Data.List
+import Data.Maybe
+import Data.Word
+import Numeric (showHex)
+import System.Directory
+import System.Random (randomRIO)
+
+import CompState
+import Paths
+import Utils
+
+-- | Hash a string to 128 bits, given as 32 hex digits.  This is two different
+-- 64-bit hashes (FNV-1a and a multiplicative hash) side by side; it doesn't
+-- need to be cryptographically strong, just unlikely to collide by accident.
+hashString128 :: String -> String
+hashString128 s = hex (fnv s) ++ hex (mult s)
+  where
+    fnv :: String -> Word64
+    fnv = foldl' (\h c -> (h `xor` fromIntegral (ord c)) * 0x100000001b3)
+            0xcbf29ce484222325
+
+    mult :: String -> Word64
+    mult = foldl' (\h c -> (h `rotateL` 5 `xor` fromIntegral (ord c)) * 0x9e3779b97f4a7c15)
+             0x2545f4914f6cdd1d
+
+    hex :: Word64 -> String
+    hex w = let h = showHex w "" in replicate (16 - length h) '0' ++ h
+
+-- | Work out the cache key for a compilation.  This takes the options, the
+-- stem of the output files (since the generated code refers to its own header
+-- by name) and the text of the preprocessed source.
+cacheKey :: CompOpts -> String -> String -> String
+cacheKey opts outputStem source
+  = hashString128 $ unlines [tockVersion, show opts', outputStem, source]
+  where
+    -- Options that don't affect the output:
+    opts' = opts { csOutputFile = ""
+                 , csOutputHeaderFile = ""
+                 , csOutputIncFile = Nothing
+                 , csOutputCodeFile = Nothing
+                 , csSymbolMapFile = Nothing
+                 , csVerboseLevel = 0
+                 , csKeepTemporaries = False
+                 , csCacheDir = Nothing
+                 , csJobs = 1
+                 , csPassFusion = True
+                 , csRecordPassStats = False
+                 , csPassStatsFile = Nothing
+                 }
+
+-- | Look for an entry in the cache.  If it's there, copy the files it holds to
+-- their destinations and return True.  The files are given as pairs of the
+-- name within the entry and the destination; files that weren't stored are
+-- skipped.
+lookupCache :: FilePath -> String -> [(String, FilePath)] -> IO Bool
+lookupCache dir key files
+  =  do let entry = dir ++ "/" ++ key
+        found <- doesDirectoryExist entry
+        if not found
+          then return False
+          else do copied <- sequence
+                    [do exists <- doesFileExist (entry ++ "/" ++ name)
+                        if exists
+                          then maybeIO (copyFile (entry ++ "/" ++ name) dest) >>* (/= Nothing)
+                          else return True
+                    | (name, dest) <- files]
+                  return $ and copied
+
+-- | Store the given files (as for 'lookupCache') in a new cache entry.  Files
+-- that don't exist are skipped.  The entry is built in a directory with a
+-- name of its own (so that concurrent compiles don't build in the same
+-- place) and then renamed into place, so that a concurrent lookup never sees
+-- half an entry.  Any failure just means the entry doesn't get stored, and
+-- the half-built directory is removed.
+storeCache :: FilePath -> String -> [(String, FilePath)] -> IO ()
+storeCache dir key files
+  =  do nonce <- randomRIO (0, maxBound :: Int)
+        let entry = dir ++ "/" ++ key
+            partial = entry ++ ".partial." ++ show nonce
+        created <- maybeIO $ do createDirectoryIfMissing True dir
+                                createDirectory partial
+        when (isJust created) $
+          do stored <- maybeIO $
+                 do sequence_ [do exists <- doesFileExist src
+                                  when exists $
+                                    copyFile src (partial ++ "/" ++ name)
+                              | (name, src) <- files]
+                    renameDirectory partial entry
+             when (isNothing stored) $
+               maybeIO (removeDirectoryRecursive partial) >> return ()
@@ -141,6 +141,7 @@ doAny extFunc = extFunc (
           `extQ` (doMap anyFunc :: Map.Map String A.NameDef -> Doc)
           `extQ` (doMap anyFunc :: Map.Map String [A.Type] -> Doc)
           `extQ` (doMap anyFunc :: Map.Map String [A.Actual] -> Doc)
+          `extQ` (doMap anyFunc :: Map.Map String Integer -> Doc)
           `extQ` (doSet anyFunc :: Set.Set String -> Doc)
           `extQ` (doSet anyFunc :: Set.Set A.Name -> Doc)
   )
@@ -606,6 +606,41 @@ isMobileType t@(A.Record n) = recordAttr (A.nameMeta n) t >>* A.mobileRecord
 isMobileType (A.ChanDataType {}) = return True
 isMobileType _ = return False
 
+-- | Should an input of these items be received as a single gathered message
+-- (see 'csGatherComms')?  This must agree with 'gatheredOutput' for the
+-- matching output, so both only look at things the two ends have in common;
+-- items whose destinations depend upon earlier items are dealt with by
+-- receiving them into temporaries (see 'SimplifyComms.transformProtocolInput').
+gatheredInput :: (CSMR m, Die m) => [A.InputItem] -> m Bool
+gatheredInput iis = gatheredComm $ mapM item iis
+  where
+    item (A.InCounted _ _ av) = astTypeOf av >>* (,) True
+    item (A.InVariable _ v) = astTypeOf v >>* (,) False
+
+-- | Should an output of these items be sent as a single gathered message?
+gatheredOutput :: (CSMR m, Die m) => [A.OutputItem] -> m Bool
+gatheredOutput ois = gatheredComm $ mapM item ois
+  where
+    item (A.OutCounted _ _ ae) = astTypeOf ae >>* (,) True
+    item (A.OutExpression _ e) = astTypeOf e >>* (,) False
+
+-- | A communication is gathered when there is more than one message to save:
+-- several items, or a counted array (which would otherwise send its count
+-- separately).  Mobiles are passed by reference, so they are left alone.
+-- The items (whether each is counted, and its type) are only looked at if
+-- the option is on.
+gatheredComm :: (CSMR m, Die m) => m [(Bool, A.Type)] -> m Bool
+gatheredComm getItems
+  = do gather <- getCompOpts >>* csGatherComms
+       if not gather
+         then return False
+         else do items <- getItems
+                 mobile <- mapM (isMobileType . elemType . snd) items >>* or
+                 return $ not mobile && (length items > 1 || any fst items)
+  where
+    elemType (A.Array _ t) = t
+    elemType t = t
+
 --}}}
 
 --{{{ sizes of types
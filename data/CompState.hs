@@ -32,6 +32,7 @@ import qualified Data.Set as Set
 import System.IO
 
 import qualified AST as A
+import CompilerCommands (cStackUsageSupported)
 import Errors (Die, dieP, ErrorReport, Warn, WarningType(..), warnP, WarningReport)
 import Metadata
 import OrdAST ()
@@ -41,7 +42,7 @@ import UnifyType
 import Utils
 
 -- | Modes that Tock can run in.
-data CompMode = ModeFlowGraph | ModeLex | ModeHTML | ModeParse | ModeCompile | ModePostC | ModeFull
+data CompMode = ModeFlowGraph | ModeLex | ModeHTML | ModeParse | ModeCompile | ModePostC | ModeFull | ModeBuild
   deriving (Show, Data, Typeable, Eq)
 
 -- | Backends that Tock can use.
@@ -52,6 +53,25 @@ data CompBackend = BackendC | BackendCPPCSP | BackendCHP | BackendDumpAST | Back
 data CompFrontend = FrontendOccam | FrontendRain
   deriving (Show, Data, Typeable, Eq)
 
+-- | Ways of finding out how much stack each C function needs.
+data StackAnalysis =
+  -- | Compile to assembly and scrape it (x86 only)
+  StackAnalysisAsm
+  -- | Read the C compiler's stack usage and call graph output
+  | StackAnalysisUsage
+  deriving (Show, Data, Typeable, Eq)
+
+-- | Kinds of instrumentation that can be compiled into the program.
+data Instrumentation =
+  -- | Measure how much of each process's workspace is used
+  InstrumentStack
+  -- | Count the messages, bytes and time at each channel input and output,
+  -- and the activations and run time of each PROC
+  | InstrumentComms
+  -- | Count how many times each runtime check is made
+  | InstrumentChecks
+  deriving (Show, Data, Typeable, Eq, Ord)
+
 -- | Preprocessor definitions.
 data PreprocDef =
   PreprocNothing
@@ -92,7 +112,10 @@ instance Ord UnifyIndex where
 -- | An entry in the map corresponding to a UnifyIndex
 type UnifyValue = TypeExp A.Type
 
-data NameAttr = NameShared | NameAliasesPermitted deriving (Typeable, Data, Eq, Show, Ord)
+data NameAttr = NameShared | NameAliasesPermitted
+  -- | A channel given a FIFO buffer with this many slots by #PRAGMA BUFFERED.
+  | NameBuffered Integer
+  deriving (Typeable, Data, Eq, Show, Ord)
 
 data ExternalType = ExternalOldStyle | ExternalOccam
   deriving (Typeable, Data, Eq, Show, Ord)
@@ -112,16 +135,42 @@ data CompOpts = CompOpts {
     csCompilerLinkFlags :: String,
     csSanityCheck :: Bool,
     csUsageChecking :: Bool,
+    -- Whether adjacent bottom-up passes may be run as one traversal:
+    csPassFusion :: Bool,
+    -- Whether a multi-item (or counted) communication is sent as a single
+    -- message listing all its items, rather than one message per item:
+    csGatherComms :: Bool,
+    -- Whether to put #line directives giving the occam source positions into
+    -- the generated code:
+    csLineDirectives :: Bool,
     csVerboseLevel :: Int,
     csOutputFile :: String,
     csOutputHeaderFile :: String,
     csOutputIncFile :: Maybe String,
+    -- The generated code file, for #line directives to point back to:
+    csOutputCodeFile :: Maybe String,
+    -- Where to write the map from generated function names to occam PROCs:
+    csSymbolMapFile :: Maybe String,
     csKeepTemporaries :: Bool,
     csEnabledWarnings :: Set WarningType,
     csRunIndent :: Bool,
     csClassicOccamMobility :: Bool,
     csUnknownStackSize :: Integer,
+    csStackAnalysis :: StackAnalysis,
+    csInstrument :: Set Instrumentation,
+    -- Measured stack sizes (in bytes) from an instrumented run:
+    csStackProfile :: Map String Integer,
+    -- Whether the measured sizes can be smaller than the static estimates:
+    csStackProfileTrust :: Bool,
+    -- Source positions of checks to leave out (from --instrument=checks):
+    csUncheckedSites :: Set String,
     csSearchPath :: [String],
+    csCacheDir :: Maybe String,
+    -- How many modules to compile at once in build mode:
+    csJobs :: Int,
+    csRecordPassStats :: Bool,
+    -- Where to write the pass statistics as JSON, if anywhere:
+    csPassStatsFile :: Maybe String,
     csImplicitModules :: [String],
 
     csDefinitions :: Map String PreprocDef
@@ -169,7 +218,24 @@ data CompState = CompState {
     csPulledItems :: [[PulledItem]],
     csParProcs :: Map A.Name ParOrFork,
     csUnifyId :: Int,
-    csWarnings :: [WarningReport]
+    csWarnings :: [WarningReport],
+
+    -- Set by runPasses (and the other phases of compilation) with --pass-stats;
+    -- in reverse order:
+    csPassStats :: [PassStats]
+  }
+  deriving (Data, Typeable, Show)
+
+-- | Statistics about a pass, or another phase of compilation.
+data PassStats = PassStats {
+    psName :: String,
+    -- Wall-clock time, in seconds:
+    psTime :: Double,
+    -- Bytes allocated (if the runtime system is collecting statistics):
+    psAllocated :: Maybe Integer,
+    -- The size of the AST (or number of tokens) before and after:
+    psSizeBefore :: Maybe Int,
+    psSizeAfter :: Maybe Int
   }
   deriving (Data, Typeable, Show)
 
@@ -183,10 +249,15 @@ emptyOpts = CompOpts {
     csCompilerLinkFlags = "",
     csSanityCheck = False,
     csUsageChecking = True,
+    csPassFusion = True,
+    csGatherComms = False,
+    csLineDirectives = False,
     csVerboseLevel = 0,
     csOutputFile = "-",
     csOutputHeaderFile = "-",
     csOutputIncFile = Nothing,
+    csOutputCodeFile = Nothing,
+    csSymbolMapFile = Nothing,
     csKeepTemporaries = False,
     csEnabledWarnings = Set.fromList
       [ WarnInternal
@@ -197,7 +268,18 @@ emptyOpts = CompOpts {
     csRunIndent = False,
     csClassicOccamMobility = False,
     csUnknownStackSize = 512,
+    csStackAnalysis = if cStackUsageSupported
+                        then StackAnalysisUsage
+                        else StackAnalysisAsm,
+    csInstrument = Set.empty,
+    csStackProfile = Map.empty,
+    csStackProfileTrust = False,
+    csUncheckedSites = Set.empty,
     csSearchPath = [".", tockIncludeDir],
+    csCacheDir = Nothing,
+    csJobs = 1,
+    csRecordPassStats = False,
+    csPassStatsFile = Nothing,
     csImplicitModules = [],
 
     csDefinitions = Map.fromList [("COMPILER.TOCK", PreprocNothing)
@@ -230,7 +312,9 @@ emptyState = CompState {
     csPulledItems = [],
     csParProcs = Map.empty,
     csUnifyId = 0,
-    csWarnings = []
+    csWarnings = [],
+
+    csPassStats = []
   }
 
 -- | Class of monads which keep a CompState.
@@ -297,6 +381,36 @@ getCompOpts = getCompState >>* csOpts
 --instance (MonadWriter [WarningReport] m) => Warn m where
 --  warnReport r = tell [r]
 
+-- | Is the given kind of instrumentation turned on?
+instrumenting :: CSMR m => Instrumentation -> m Bool
+instrumenting i = getCompOpts >>* (Set.member i . csInstrument)
+
+-- | The amount of stack (in bytes) to allow above the high-water mark recorded
+-- in a stack profile.
+stackProfileMargin :: Integer
+stackProfileMargin = 512
+
+-- | Find the stack size (in bytes) to use for the given (C) name from the
+-- stack profile, if there is an entry for it.
+profiledStackSize :: CompOpts -> String -> Maybe Integer
+profiledStackSize opts n = Map.lookup n (csStackProfile opts) >>* (+ stackProfileMargin)
+
+-- | Combine a static stack size estimate with the stack profile.  By default
+-- the profile can only make the stack bigger: a run that didn't take the
+-- deepest path mustn't shrink it below what the analysis found.  With
+-- --stack-profile-trust, the measured size replaces the estimate, so that
+-- stacks the analysis overestimates can be cut down.
+profiledStaticStackSize :: CompOpts -> String -> Integer -> Integer
+profiledStaticStackSize opts n static = maybe static combine $ profiledStackSize opts n
+  where
+    combine = if csStackProfileTrust opts then id else max static
+
+-- | Should the runtime checks at the given position be left out?
+uncheckedSite :: CSMR m => Meta -> m Bool
+uncheckedSite m
+  | isNothing (metaFile m) = return False
+  | otherwise = getCompOpts >>* (Set.member (show m) . csUncheckedSites)
+
 --{{{  name definitions
 -- | Add the definition of a name.
 defineName :: CSM m => A.Name -> A.NameDef -> m ()
@@ -314,6 +428,17 @@ modifyName n f
 lookupName :: (CSMR m, Die m) => A.Name -> m A.NameDef
 lookupName n = lookupNameOrError n (dieP (A.nameMeta n) $ "cannot find name " ++ A.nameName n)
 
+-- | The number of slots a channel was declared to buffer, if it was buffered.
+bufferedChanSize :: CSMR m => A.Name -> m (Maybe Integer)
+bufferedChanSize n
+    =  do attrs <- getCompState >>* csNameAttr >>* Map.lookup (A.nameName n)
+          return $ listToMaybe [size | NameBuffered size <- maybe [] Set.toList attrs]
+
+-- | The name of the channel that the C backend gives the reader of a buffered
+-- channel.
+bufferedReaderName :: A.Name -> A.Name
+bufferedReaderName n = n { A.nameName = A.nameName n ++ "_reader" }
+
 nameSource :: (CSMR m, Die m) => A.Name -> m A.NameSource
 nameSource n = lookupName n >>* A.ndNameSource
 
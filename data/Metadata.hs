@@ -27,10 +27,12 @@ import Numeric
 import Text.Printf
 import Text.Regex
 
+-- The line and column are strict, so that a position doesn't hold on to
+-- thunks (and takes up less space; there's one for every token).
 data Meta = Meta {
     metaFile :: Maybe String,
-    metaLine :: Int,
-    metaColumn :: Int
+    metaLine :: {-# UNPACK #-} !Int,
+    metaColumn :: {-# UNPACK #-} !Int
   }
   deriving (Typeable, Data, Ord, Eq)
 
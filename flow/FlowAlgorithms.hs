@@ -94,6 +94,13 @@ joinGraphFuncs gfA gfB
 -- processing all nodes, and if a node changes its value, re-adding all its
 -- nodes in the other direction (nodesToReAdd) to the worklist to be processed again.
 --
+-- The worklist is kept in reverse postorder of a depth-first search from the
+-- starting node along nodesToReAdd, so that (back edges aside) a node is only
+-- processed once all the nodes it takes its value from have been.  For an
+-- acyclic graph that means each node is processed once; for loops, it means
+-- that the values settle in a number of passes bounded by the loop nesting
+-- depth rather than by the size of the graph.
+--
 -- The function is agnostic as to the representation of the graph, provided
 -- it supports the two required operations (nodesToProcess and nodesToReAdd).
 --  It can also do forward or backward data flow by just swapping those two
@@ -107,7 +114,7 @@ flowAlgorithm :: forall n e result. (Ord n, Show n, Eq result) =>
                                       -- nodes to results
 flowAlgorithm funcs nodes (startNode, startVal)
   = iterate
-      nonStartNodesSet
+      (Set.fromList $ map withRank nonStartNodes)
       (Map.fromList $ (startNode, startVal):(zip nonStartNodes (repeat (defVal funcs))))
   where
     -- The nodes list, with the start node removed:
@@ -123,6 +130,32 @@ flowAlgorithm funcs nodes (startNode, startVal)
     filtNodes :: [(n,e)] -> [(n,e)]
     filtNodes = filter ((`Set.member` allNodesSet) . fst)
 
+    -- | The nodes in reverse postorder, found by a depth-first search from the
+    -- start node.  The search keeps its own stack, as the graphs for deeply
+    -- nested programs can be deep.  When a node is finished it is consed on
+    -- to the accumulator, so the first node finished ends up last.
+    reversePostOrder :: [n]
+    reversePostOrder = search [(startNode, succs startNode)] (Set.singleton startNode) []
+      where
+        succs :: n -> [n]
+        succs = map fst . filtNodes . nodesToReAdd funcs
+
+        search :: [(n, [n])] -> Set.Set n -> [n] -> [n]
+        search [] _ acc = acc
+        search ((n, []) : stack) seen acc = search stack seen (n : acc)
+        search ((n, s : ss) : stack) seen acc
+          | s `Set.member` seen = search ((n, ss) : stack) seen acc
+          | otherwise = search ((s, succs s) : (n, ss) : stack) (Set.insert s seen) acc
+
+    -- | The position of each node in 'reversePostOrder'.  Any node not reached
+    -- by the search (which shouldn't happen if the node list was made as
+    -- described above) goes to the end.
+    rank :: Map.Map n Int
+    rank = Map.fromList $ zip reversePostOrder [0..]
+
+    withRank :: n -> (Int, n)
+    withRank n = (Map.findWithDefault maxBound n rank, n)
+
     -- | Folds left, but with Either types involved.  Gives an error if there
     -- are no nodes in the given list at the start (i.e. when its second parameter
     -- is Left).  Otherwise feeds the aggregate result back round on each
@@ -164,16 +197,16 @@ flowAlgorithm funcs nodes (startNode, startVal)
     -- | Iterates the dataflow analysis.  It is given a set of nodes to process,
     -- a map from nodes to current results, and iterates until it gives back
     -- an error or the list of final results  
-    iterate :: Set.Set n -> Map.Map n result -> Either String (Map.Map n result)
+    iterate :: Set.Set (Int, n) -> Map.Map n result -> Either String (Map.Map n result)
     iterate workList vals
       -- No nodes left to process, finished:
       | Set.null workList = Right vals
       | otherwise
-               -- Pick the next node from the list and remove it:
-          = do let (node, workList') = Set.deleteFindMin workList
+               -- Pick the earliest node in the order from the list and remove it:
+          = do let ((_, node), workList') = Set.deleteFindMin workList
                -- Process that node:
                total <- foldWithEither (iterateNode vals) (Left $
-                 "Nodes still to process: " ++ show workList
+                 "Nodes still to process: " ++ show (map snd $ Set.toList workList)
                  ++ " " ++ userErrLabel funcs node)
                  (filtNodes $ nodesToProcess funcs node)
                nodeVal <- case Map.lookup node vals of
@@ -184,7 +217,7 @@ flowAlgorithm funcs nodes (startNode, startVal)
                  -- its dependents, so add all
                  -- of them back to the work list:
                  then iterate (workList' `Set.union` (Set.fromList $
-                   map fst $ filtNodes $ nodesToReAdd funcs node)) (Map.insert node total vals)
+                   map (withRank . fst) $ filtNodes $ nodesToReAdd funcs node)) (Map.insert node total vals)
                  -- If the value hasn't changed, forget it and go on to the
                  -- next one:
                  else iterate workList' vals
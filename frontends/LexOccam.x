@@ -21,6 +21,7 @@ with this program.  If not, see <http://www.gnu.org/licenses/>.
 module LexOccam where
 
 import Control.Monad.Error
+import qualified Data.ByteString.Lazy.Char8 as ByteString
 import Data.Generics (Data, Typeable)
 
 import Errors
@@ -28,7 +29,7 @@ import Metadata
 import Pass
 }
 
-%wrapper "posn"
+%wrapper "posn-bytestring"
 
 $decimalDigit = [0-9]
 $hexDigit = [0-9 a-f A-F]
@@ -176,38 +177,42 @@ instance Show TokenType where
       quote label s = label ++ " \"" ++ s ++ "\""
 
 -- | Build a lexer rule for a token.
-mkToken :: (String -> TokenType) -> Int -> AlexPosn -> String -> (Maybe Token, Int)
-mkToken cons code _ s = (Just (Token emptyMeta (cons s)), code)
+mkToken :: (String -> TokenType) -> Int -> AlexPosn -> ByteString.ByteString -> (Maybe Token, Int)
+mkToken cons code _ s = (Just (Token emptyMeta (cons $ ByteString.unpack s)), code)
 
 -- | Just switch state.
-mkState :: Int -> AlexPosn -> String -> (Maybe Token, Int)
+mkState :: Int -> AlexPosn -> ByteString.ByteString -> (Maybe Token, Int)
 mkState code _ s = (Nothing, code)
 
 -- | Run the lexer, returning a list of tokens.
 -- (This is based on the `alexScanTokens` function that Alex provides.)
-runLexer' :: Die m => (String, Int, Int) -> String -> m [Token]
-runLexer' (filename, startLine, startCol) str = go (AlexPn 0 startLine startCol, '\n', str) 0
+-- The tokens are accumulated in a list rather than built up on the way back
+-- out of the recursion, so that lexing a large file doesn't need a stack
+-- frame per token.
+runLexer' :: Die m => (String, Int, Int) -> ByteString.ByteString -> m [Token]
+runLexer' (filename, startLine, startCol) str
+    = case go [] (AlexPn 0 startLine startCol, '\n', str) 0 of
+        Left m -> dieP m "Unrecognised token"
+        Right ts -> return ts
   where
-    go inp@(pos@(AlexPn _ line col), _, str) code =
+    -- All the tokens share the same copy of the filename:
+    file = Just filename
+
+    go acc inp@(pos@(AlexPn _ line col), _, str) code =
          case alexScan inp code of
-           AlexEOF -> return []
-           AlexError _ -> dieP meta "Unrecognised token"
-           AlexSkip inp' len -> go inp' code
+           AlexEOF -> Right $ reverse acc
+           AlexError _ -> Left meta
+           AlexSkip inp' len -> go acc inp' code
            AlexToken inp' len act ->
-             do let (t, code) = act pos (take len str)
-                ts <- go inp' code
-                return $ case t of
-                           Just (Token _ tt) -> Token meta tt : ts
-                           Nothing -> ts
+             let (t, code') = act pos (ByteString.take (fromIntegral len) str)
+             in case t of
+                  Just (Token _ tt) -> go (Token meta tt : acc) inp' code'
+                  Nothing -> go acc inp' code'
 
       where
-        meta = emptyMeta {
-                 metaFile = Just filename,
-                 metaLine = line,
-                 metaColumn = col
-               }
+        meta = Meta file line col
 
-runLexer :: Die m => String -> String -> m [Token]
+runLexer :: Die m => String -> ByteString.ByteString -> m [Token]
 runLexer fn = runLexer' (fn, 1, 1)
 
 }
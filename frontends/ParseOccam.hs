@@ -21,6 +21,7 @@ module ParseOccam (parseOccamProgram) where
 
 import Control.Monad (join, liftM, when)
 import Control.Monad.State (MonadState, get, put)
+import qualified Data.ByteString.Lazy.Char8 as ByteString
 import Data.Char
 import Data.List
 import qualified Data.Map as Map
@@ -1457,7 +1458,7 @@ pragma = do m <- getPosition >>* sourcePosToMeta
               Just (Right (pragStr, prod)) -> do
                 let column = metaColumn m + fromMaybe 0 (findIndex (=='\"') rawP)
                 toks <- runLexer' (fromMaybe "<unknown(pragma)>" $ metaFile m
-                                  , metaLine m, column) pragStr
+                                  , metaLine m, column) (ByteString.pack pragStr)
                 cs <- getState
                 case runParser (do {n <- prod; s <- getState; return (n, s)}) cs "" toks of
                   Left err -> do warnP m WarnUnknownPreprocessorDirective $
@@ -1480,6 +1481,7 @@ pragma = do m <- getPosition >>* sourcePosToMeta
       (String, OccParser (Maybe NameSpec)) ) ]
     pragmas = [ ("^SHARED +(.*)", parseContents handleShared)
               , ("^PERMITALIASES +(.*)", parseContents handlePermitAliases)
+              , ("^BUFFERED +(.*)", parseContents handleBuffered)
               , ("^EXTERNAL +\"(.*)\"", parseContents $ handleExternal True)
               , ("^TOCKEXTERNAL +\"(.*)\"", parseContents $ handleExternal False)
               , ("^TOCKUNSCOPE +(.*)", simple handleUnscope)
@@ -1519,6 +1521,24 @@ pragma = do m <- getPosition >>* sourcePosToMeta
                        n (Set.singleton NameAliasesPermitted) (csNameAttr st)})
                   vars
                 return Nothing
+
+    -- #PRAGMA BUFFERED n c, d gives each of the channels an n-slot FIFO
+    -- buffer; the backends check that they're channels that can have one.
+    handleBuffered m
+           = do lit <- integer
+                size <- case lit of
+                  A.IntLiteral _ s | read s > (0 :: Integer) -> return $ read s
+                  _ -> dieP m "buffered channels must have a positive decimal number of slots"
+                vars <- sepBy1 identifier sComma
+                mapM_ (\var ->
+                  do st <- getState
+                     A.Name _ n <- case lookup var (csLocalNames st) of
+                       Nothing -> dieP m $ "name " ++ var ++ " not defined"
+                       Just (n, _, _) -> return n
+                     modifyCompState $ \st -> st {csNameAttr = Map.insertWith Set.union
+                       n (Set.singleton $ NameBuffered size) (csNameAttr st)})
+                  vars
+                return Nothing
     handleSizes m [pragStr]
            = do case metaFile m of
                   Nothing -> dieP m "PRAGMA TOCKSIZES in undeterminable file"
@@ -23,11 +23,14 @@ module PreprocessOccam (preprocessOccamProgram, preprocessOccamSource,
 
 import Control.Monad.Reader
 import Control.Monad.State
-import Data.HashTable (hashString)
+import Data.Bits
+import qualified Data.ByteString.Char8 as B
+import qualified Data.ByteString.Lazy.Char8 as BL
 import Data.Int
 import Data.List
 import qualified Data.Map as Map
 import qualified Data.Set as Set
+import Data.Word
 import Numeric
 import System.IO
 import Text.ParserCombinators.Parsec
@@ -57,10 +60,10 @@ preprocessFile m implicitMods (filename, mainFile)
                           then Set.insert (dropTockInc realFilename)
                                  . Set.delete (dropTockInc filename)
                           else id
-          s <- liftIO $ hGetContents handle
+          s <- liftIO $ B.hGetContents handle
           modifyCompState $ \cs -> cs { csUsedFiles = modFunc $ csUsedFiles cs }
           when mainFile $
-            modifyCompState $ \cs -> cs { csCompilationHash = show $ makePosInteger $ hashString s}
+            modifyCompState $ \cs -> cs { csCompilationHash = show $ makePosInteger $ hashSource s}
           local (const realFilename) $ preprocessSource m implicitMods realFilename s
           
   where
@@ -72,11 +75,15 @@ preprocessFile m implicitMods (filename, mainFile)
     makePosInteger :: Int32 -> Integer
     makePosInteger n = toInteger n + (toInteger (maxBound :: Int32))
 
+    -- A 32-bit FNV-1a hash of the source:
+    hashSource :: B.ByteString -> Int32
+    hashSource = fromIntegral . B.foldl' (\h c -> (h `xor` fromIntegral (fromEnum c)) * 16777619)
+                                         (2166136261 :: Word32)
 
 -- | Preprocesses source directly and returns its tokenised form ready for parsing.
-preprocessSource :: Meta -> [String] -> String -> String -> PreprocessM [Token]
+preprocessSource :: Meta -> [String] -> String -> B.ByteString -> PreprocessM [Token]
 preprocessSource m implicitMods realFilename s
-    =  do toks <- runLexer realFilename $ removeASM s
+    =  do toks <- runLexer realFilename $ BL.fromChunks [removeASM s]
           veryDebug $ "{{{ lexer tokens"
           veryDebug $ pshow toks
           veryDebug $ "}}}"
@@ -104,11 +111,18 @@ preprocessSource m implicitMods realFilename s
     -- To fix this, I have added this function that looks for ASM blocks, and masks
     -- out their entire content.  It does this quite simply, by looking for ASM
     -- blocks, and deleting everything following it with a (strictly) larger indent.
-    removeASM :: String -> String
-    removeASM = unlines . removeASM' . lines
+    --
+    -- Since most files don't have any ASM in them at all, we check for that
+    -- first, and only split the file into lines if we have to.
+    removeASM :: B.ByteString -> B.ByteString
+    removeASM s
+      | not (asm `B.isInfixOf` s) = if B.null s || B.last s == '\n' then s else B.snoc s '\n'
+      | otherwise = B.unlines $ removeASM' $ B.lines s
       where
+        asm = B.pack "ASM"
+
         isSpace = (== ' ')
-        numSpaces = length . takeWhile isSpace
+        numSpaces = B.length . B.takeWhile isSpace
 
         replaceWhile :: (a -> Bool) -> a -> [a] -> [a]
         replaceWhile _ _ [] = []
@@ -116,60 +130,63 @@ preprocessSource m implicitMods realFilename s
           | f x = repl : replaceWhile f repl xs
           | otherwise = x : xs
         
-        removeASM' :: [String] -> [String]
+        removeASM' :: [B.ByteString] -> [B.ByteString]
         removeASM' [] = []
         removeASM' (curLine:moreLines)
-          | "ASM" `isPrefixOf` dropWhile isSpace curLine
+          | asm `B.isPrefixOf` B.dropWhile isSpace curLine
             = let curIndent = numSpaces curLine
-                  shouldReplace l = case span isSpace l of
+                  shouldReplace l = case B.span isSpace l of
                     -- Nothing but spaces:
-                    (_,[]) -> True
-                    (spaces, _) -> length spaces > curIndent
+                    (spaces, rest) | B.null rest -> True
+                                   | otherwise -> B.length spaces > curIndent
               -- We keep the ASM directive, so that Tock at least knows some ASM
               -- used to be there (and can complain later on).  We also don't just
               -- drop the lines, because that screws up the meta tags -- instead
               -- we replace them with blanks (which should always be fine, I think):
-              in curLine : removeASM' (replaceWhile shouldReplace "" moreLines)
+              in curLine : removeASM' (replaceWhile shouldReplace B.empty moreLines)
           | otherwise = curLine : removeASM' moreLines
 
 -- | Expand 'IncludeFile' markers in a token stream.
+-- Like the other functions over token streams here, this collects its output
+-- in reverse, so that it doesn't need a stack frame per token.
 expandIncludes :: [Token] -> PreprocessM [Token]
-expandIncludes [] = return []
-expandIncludes (Token m (IncludeFile filename) : Token _ EndOfLine : ts)
-    =  do contents <- preprocessFile m [] (filename, False)
-          rest <- expandIncludes ts
-          return $ contents ++ rest
-expandIncludes (Token m (IncludeFile _) : _)
-    = error "IncludeFile token should be followed by EndOfLine"
-expandIncludes (t:ts) = expandIncludes ts >>* (t :)
+expandIncludes = expandIncludes' []
+  where
+    expandIncludes' :: [Token] -> [Token] -> PreprocessM [Token]
+    expandIncludes' acc [] = return $ reverse acc
+    expandIncludes' acc (Token m (IncludeFile filename) : Token _ EndOfLine : ts)
+        =  do contents <- preprocessFile m [] (filename, False)
+              expandIncludes' (reverse contents ++ acc) ts
+    expandIncludes' _ (Token m (IncludeFile _) : _)
+        = error "IncludeFile token should be followed by EndOfLine"
+    expandIncludes' acc (t:ts) = expandIncludes' (t : acc) ts
 
 -- | Preprocess a token stream.
 preprocessOccam :: [Token] -> PreprocessM [Token]
-preprocessOccam [] = return []
-preprocessOccam (Token m (TokPreprocessor s) : ts)
-    = handleDirective m (stripPrefix s) ts >>= preprocessOccam
+preprocessOccam = preprocessOccam' []
   where
+    preprocessOccam' :: [Token] -> [Token] -> PreprocessM [Token]
+    preprocessOccam' acc [] = return $ reverse acc
+    preprocessOccam' acc (Token m (TokPreprocessor s) : ts)
+        = handleDirective m (stripPrefix s) ts >>= preprocessOccam' acc
+    preprocessOccam' acc (Token _ (TokReserved "##") : Token m (TokIdentifier var) : ts)
+        =  do st <- get
+              case Map.lookup var (csDefinitions $ csOpts st) of
+                Just (PreprocInt num)    -> toToken $ TokIntLiteral num
+                Just (PreprocString str) -> toToken $ TokStringLiteral str
+                Just (PreprocNothing)    -> dieP m $ var ++ " is defined, but has no value"
+                Nothing                  -> dieP m $ var ++ " is not defined"
+      where
+        toToken tt = preprocessOccam' (Token m tt : acc) ts
+    preprocessOccam' _ (Token m (TokReserved "##") : _)
+        = dieP m "Invalid macro expansion syntax"
+    preprocessOccam' acc (t:ts) = preprocessOccam' (t : acc) ts
+
     stripPrefix :: String -> String
     stripPrefix (' ':cs) = stripPrefix cs
     stripPrefix ('\t':cs) = stripPrefix cs
     stripPrefix ('#':cs) = cs
     stripPrefix _ = error "bad TokPreprocessor prefix"
-preprocessOccam (Token _ (TokReserved "##") : Token m (TokIdentifier var) : ts)
-    =  do st <- get
-          case Map.lookup var (csDefinitions $ csOpts st) of
-            Just (PreprocInt num)    -> toToken $ TokIntLiteral num
-            Just (PreprocString str) -> toToken $ TokStringLiteral str
-            Just (PreprocNothing)    -> dieP m $ var ++ " is defined, but has no value"
-            Nothing                  -> dieP m $ var ++ " is not defined"
-  where
-    toToken tt
-        =  do rest <- preprocessOccam ts
-              return $ Token m tt : rest
-preprocessOccam (Token m (TokReserved "##") : _)
-    = dieP m "Invalid macro expansion syntax"
-preprocessOccam (t:ts)
-    =  do rest <- preprocessOccam ts
-          return $ t : rest
 
 --{{{  preprocessor directive handlers
 type DirectiveFunc = Meta -> [String] -> PreprocessM ([Token] -> PreprocessM [Token])
@@ -443,4 +460,4 @@ preprocessOccamProgram filename
 -- | Preprocesses occam source direct from the given String
 preprocessOccamSource :: String -> PassM [Token]
 preprocessOccamSource source
-  = runReaderT (preprocessSource emptyMeta [] "<unknown>" source) ""
+  = runReaderT (preprocessSource emptyMeta [] "<unknown>" (B.pack source)) ""
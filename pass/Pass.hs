@@ -16,19 +16,31 @@ You should have received a copy of the GNU General Public License along
 with this program.  If not, see <http://www.gnu.org/licenses/>.
 -}
 
+{-# LANGUAGE CPP #-}
+
 -- | Common definitions for passes over the AST.
 module Pass where
 
+import Control.Concurrent
+import Control.Exception (SomeException, evaluate, throwIO, try)
 import Control.Monad.Error
 import Control.Monad.Reader
 import Control.Monad.State
 import Control.Monad.Writer
-import Data.Generics (Constr, Data)
+import Data.Char
+import Data.Generics (Constr, Data, gsize)
 import Data.Generics.Alloy
 import Data.List
 import Data.Ord
 import qualified Data.Set as Set
+import Data.Time.Clock
+import GHC.Conc (numCapabilities)
+#if __GLASGOW_HASKELL__ >= 706
+-- GHC 8.2 replaced the GCStats interface with RTSStats, and 8.4 removed it.
+import GHC.Stats
+#endif
 import System.IO
+import Text.Printf
 
 import qualified AST as A
 import CompState
@@ -118,6 +130,9 @@ data Pass t = Pass {
   , passPre :: Set.Set Property
   , passPost :: Set.Set Property
   , passEnabled :: CompOpts -> Bool
+    -- | The node functions of the pass, if it's a single bottom-up traversal
+    -- that can be fused with its neighbours (see 'fusible').
+  , passFusible :: Maybe NodeTransforms
 }
 
 instance Eq (Pass t) where
@@ -126,6 +141,41 @@ instance Eq (Pass t) where
 instance Ord (Pass t) where
   compare = comparing passName
 
+-- | The functions that a simple bottom-up pass applies to each node.  Each
+-- is given a node whose children have already been transformed.
+data NodeTransforms = NodeTransforms {
+    ntProcess :: A.Process -> PassM A.Process
+  , ntSpecification :: A.Specification -> PassM A.Specification
+  , ntExpression :: A.Expression -> PassM A.Expression
+  , ntExpressionList :: A.ExpressionList -> PassM A.ExpressionList
+  , ntStructuredExpression :: A.Structured A.Expression -> PassM (A.Structured A.Expression)
+  , ntVariable :: A.Variable -> PassM A.Variable
+  }
+
+-- | Node functions that leave everything alone; override the fields you need.
+noTransforms :: NodeTransforms
+noTransforms = NodeTransforms return return return return return return
+
+-- | Apply one set of node functions and then the other to each node.
+andThenTransforms :: NodeTransforms -> NodeTransforms -> NodeTransforms
+andThenTransforms a b
+    = NodeTransforms { ntProcess = ntProcess a >=> ntProcess b
+                     , ntSpecification = ntSpecification a >=> ntSpecification b
+                     , ntExpression = ntExpression a >=> ntExpression b
+                     , ntExpressionList = ntExpressionList a >=> ntExpressionList b
+                     , ntStructuredExpression = ntStructuredExpression a >=> ntStructuredExpression b
+                     , ntVariable = ntVariable a >=> ntVariable b
+                     }
+
+-- | Mark a pass as one that can be fused with its neighbours, giving the node
+-- functions that its code applies bottom-up.  When passes are fused, each
+-- node is given to one pass's functions after the other's, so this is only
+-- safe for passes whose functions look at nothing but the node they're given
+-- (and names in the state), and that don't build new nodes for a later pass
+-- to look at other than out of the children they were given.
+fusible :: NodeTransforms -> Pass t -> Pass t
+fusible nt p = p { passFusible = Just nt }
+
 -- | A property that can be asserted and tested against the AST.
 data Property = Property {
     propName :: String
@@ -162,6 +212,7 @@ passMakerHelper f name pre post code
          , passPre = Set.fromList pre
          , passPost = Set.fromList post
          , passEnabled = f
+         , passFusible = Nothing
          }
 
 rainOnlyPass :: PassMaker t
@@ -188,14 +239,158 @@ pass = passMakerHelper (const True)
 
 -- | Compose a list of passes into a single pass by running them in the order given.
 runPasses :: [Pass A.AST] -> (A.AST -> PassM A.AST)
-runPasses [] ast = return ast
-runPasses (p:ps) ast
-    =  do debug $ "{{{ " ++ passName p
-          progress $ "- " ++ passName p
-          ast' <- passCode p ast
-          debugAST ast'
-          debug $ "}}}"
-          runPasses ps ast'
+runPasses passes ast
+    =  do recording <- getCompOpts >>* csRecordPassStats
+          runPasses' (if recording then Just (gsize ast) else Nothing) passes ast
+  where
+    runPasses' :: Maybe Int -> [Pass A.AST] -> (A.AST -> PassM A.AST)
+    runPasses' _ [] ast = return ast
+    runPasses' size (p:ps) ast
+        =  do debug $ "{{{ " ++ passName p
+              progress $ "- " ++ passName p
+              (ast', size') <- recordPhase (passName p) size (Just . gsize) $
+                                 passCode p ast
+              debugAST ast'
+              debug $ "}}}"
+              runPasses' size' ps ast'
+
+-- | Run a phase of compilation, recording how long it took and how much it
+-- allocated if --pass-stats is on.  This takes the size of the phase's input,
+-- and a function to measure its output; the output is measured (and the size
+-- fully evaluated) as part of the phase, which forces the work that the phase
+-- would otherwise have left to be done lazily by the next one.  The cost of
+-- that measurement (a full traversal of the AST, for most phases) is
+-- included in the phase's time.  Returns the output and its size (which is
+-- only worked out when statistics are being recorded).
+recordPhase :: String -> Maybe Int -> (a -> Maybe Int) -> PassM a -> PassM (a, Maybe Int)
+recordPhase name sizeBefore measure phase
+    =  do recording <- getCompOpts >>* csRecordPassStats
+          if not recording
+            then do x <- phase
+                    return (x, Nothing)
+            else do (time0, alloc0) <- liftIO readCounters
+                    x <- phase
+                    -- evaluate only gets as far as the Just:
+                    sizeAfter <- liftIO $ do size <- evaluate $ measure x
+                                             evaluate $ maybe () (`seq` ()) size
+                                             return size
+                    (time1, alloc1) <- liftIO readCounters
+                    let stats = PassStats { psName = name
+                                          , psTime = realToFrac $ diffUTCTime time1 time0
+                                          , psAllocated = liftM2 (-) alloc1 alloc0
+                                          , psSizeBefore = sizeBefore
+                                          , psSizeAfter = sizeAfter
+                                          }
+                    modifyCompState $ \cs -> cs { csPassStats = stats : csPassStats cs }
+                    return (x, sizeAfter)
+  where
+    readCounters :: IO (UTCTime, Maybe Integer)
+    readCounters
+      =  do time <- getCurrentTime
+            -- Allocation figures are only available when the program's been
+            -- run with +RTS -T (and from GHC 7.6 onwards):
+#if __GLASGOW_HASKELL__ >= 802
+            enabled <- getRTSStatsEnabled
+            alloc <- if enabled
+                       then getRTSStats >>* (Just . toInteger . allocated_bytes)
+                       else return Nothing
+#elif __GLASGOW_HASKELL__ >= 706
+            enabled <- getGCStatsEnabled
+            alloc <- if enabled
+                       then getGCStats >>* (Just . toInteger . bytesAllocated)
+                       else return Nothing
+#else
+            let alloc = Nothing
+#endif
+            return (time, alloc)
+
+-- | Like 'recordPhase', for phases where there's nothing to measure.
+recordPhase_ :: String -> PassM a -> PassM a
+recordPhase_ name phase = recordPhase name Nothing (const Nothing) phase >>* fst
+
+-- | Format pass statistics as a table, with the slowest phases first.
+formatPassStats :: [PassStats] -> String
+formatPassStats stats
+    = unlines $
+        printf "%-40s %9s %6s %12s %10s %10s" "Phase" "Time (s)" "%" "Alloc (MB)" "Before" "After"
+        : [printf "%-40s %9.3f %6.1f %12s %10s %10s"
+             (psName ps) (psTime ps) (percent $ psTime ps)
+             (maybe "-" (\a -> printf "%.1f" (fromInteger a / (1024 * 1024) :: Double)) (psAllocated ps) :: String)
+             (maybe "-" show $ psSizeBefore ps) (maybe "-" show $ psSizeAfter ps)
+          | ps <- sortBy (comparing (negate . psTime)) stats]
+        ++ [printf "%-40s %9.3f" "Total" total]
+  where
+    total = sum $ map psTime stats
+
+    percent :: Double -> Double
+    percent t = if total > 0 then 100 * t / total else 0
+
+-- | Format pass statistics as a JSON object, with the phases in the order
+-- they ran.  Figures that weren't available are given as null.
+passStatsJSON :: String -> [PassStats] -> String
+passStatsJSON source stats
+    = "{\"source\": " ++ jsonString source ++ ", \"phases\": ["
+        ++ intercalate ", " (map phase stats) ++ "]}"
+  where
+    phase :: PassStats -> String
+    phase ps = "{" ++ intercalate ", "
+                 [ field "name" $ jsonString $ psName ps
+                 , field "seconds" $ printf "%.6f" $ psTime ps
+                 , field "allocated_bytes" $ maybe "null" show $ psAllocated ps
+                 , field "size_before" $ maybe "null" show $ psSizeBefore ps
+                 , field "size_after" $ maybe "null" show $ psSizeAfter ps
+                 ] ++ "}"
+
+    field :: String -> String -> String
+    field name value = jsonString name ++ ": " ++ value
+
+    jsonString :: String -> String
+    jsonString s = "\"" ++ concatMap escape s ++ "\""
+
+    escape :: Char -> String
+    escape '"' = "\\\""
+    escape '\\' = "\\\\"
+    escape c
+      | c < ' ' = printf "\\u%04x" (ord c)
+      | otherwise = [c]
+
+-- | Run some independent checks in parallel, on as many threads as the
+-- runtime has capabilities (set with @+RTS -N@).  Each check starts from the
+-- current state, and any other changes it makes to the state are thrown away,
+-- apart from the warnings it gives.  The results, warnings and errors are
+-- dealt with in the order the checks were given, so the first error reported
+-- is the one that running the checks in sequence would have given.
+runChecksInParallel :: [PassM a] -> PassM [a]
+runChecksInParallel checks
+  | numCapabilities <= 1 || length checks <= 1 = sequence checks
+  | otherwise
+  =  do cs <- getCompState
+        let cs' = cs { csWarnings = [] }
+        results <- liftIO $ parallelIO numCapabilities [runPassM cs' c | c <- checks]
+        mapM collect results
+  where
+    collect :: Either SomeException (Either ErrorReport a, CompState) -> PassM a
+    collect (Left e) = liftIO $ throwIO e
+    collect (Right (r, cs))
+      =  do mapM_ warnReport (csWarnings cs)
+            either throwError return r
+
+-- | Run some IO actions using the given number of worker threads, returning
+-- their results (or the exceptions they threw) in the original order.
+parallelIO :: Int -> [IO a] -> IO [Either SomeException a]
+parallelIO workers acts
+  =  do results <- mapM (const newEmptyMVar) acts
+        queue <- newMVar (zip results acts)
+        let worker = do next <- modifyMVar queue $ \q -> return $ case q of
+                                  [] -> ([], Nothing)
+                                  (x:xs) -> (xs, Just x)
+                        case next of
+                          Nothing -> return ()
+                          Just (result, act) -> do r <- try act
+                                                   putMVar result r
+                                                   worker
+        replicateM_ (min workers (length acts)) $ forkIO worker
+        mapM takeMVar results
 
 -- | Print a message if above the given verbosity level.
 verboseMessage :: (CSMR m, MonadIO m) => Int -> String -> m ()
@@ -43,6 +43,7 @@ import SimplifyComms
 import SimplifyExprs
 import SimplifyProcs
 import SimplifyTypes
+import Traversal (fusePasses)
 import Unnest
 import Utils
 
@@ -62,6 +63,7 @@ commonPasses opts = concat $
   , simplifyAbbrevs
   , simplifyComms
   , simplifyExprs
+  , bufferedChannelPasses
   , simplifyProcs
   , unnest
   , enablePassesWhen csUsageChecking
@@ -83,7 +85,8 @@ nullStateBodies = Pass
   ,passName = "Remove process and function bodies from compiler state"
   ,passPre = Set.empty
   ,passPost = Set.empty
-  ,passEnabled = const True}
+  ,passEnabled = const True
+  ,passFusible = Nothing}
   where
     nullProcFuncDefs :: A.NameDef -> A.NameDef
     nullProcFuncDefs (A.NameDef m n on (A.Proc m' sm fs _) am ns pl)
@@ -94,7 +97,7 @@ nullStateBodies = Pass
     
 
 getPassList :: CompOpts -> [Pass A.AST]
-getPassList optsPS = checkList $ filterPasses optsPS $ concat
+getPassList optsPS = fuse $ checkList $ filterPasses optsPS $ concat
                                 [ [nullStateBodies]
                                 , enablePassesWhen ((== FrontendOccam) . csFrontend)
                                     occamPasses
@@ -104,6 +107,8 @@ getPassList optsPS = checkList $ filterPasses optsPS $ concat
                                 , genCPasses
                                 , genCPPCSPPasses
                                 ]
+  where
+    fuse = if csPassFusion optsPS then fusePasses else id
 
 calculatePassList :: CSMR m => m [Pass A.AST]
 calculatePassList
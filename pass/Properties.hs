@@ -388,12 +388,17 @@ mainTagged = Property "mainTagged" nocheck
 -- so there's no easy way to check if the main process has been looked for or not
 
 seqInputsFlattened :: Property
-seqInputsFlattened = Property "seqInputsFlattened" $ checkNull "seqInputsFlattened" . listify findMultipleInputs
+seqInputsFlattened = Property "seqInputsFlattened" $
+  checkNull "seqInputsFlattened" <.< (filterM notGathered . listify findMultipleInputs)
   where
     findMultipleInputs :: A.InputMode -> Bool
     findMultipleInputs (A.InputSimple _ (_:_:_) _) = True
     findMultipleInputs _ = False
 
+    -- Gathered inputs are received in one go, so they stay as they are:
+    notGathered :: A.InputMode -> PassM Bool
+    notGathered (A.InputSimple _ iis _) = gatheredInput iis >>* not
+
 arraySizesDeclared :: Property
 arraySizesDeclared = Property "arraySizesDeclared" nocheck
 
@@ -23,6 +23,7 @@ module Traversal (
   , CheckM, Check
   , ExtOpMS, ExtOpMSP, extOpMS, opMS, PassOnStruct, PassASTOnStruct
   , applyBottomUpMS, ASTStructured
+  , FusedOps, applyNodeTransforms, fusePasses
   , RecurseM, DescendM, BaseOpM, baseOpM, OneOpM, TwoOpM, BaseOpMRoute, baseOpMRoute, OneOpMRoute
   , module Data.Generics.Alloy
   , module Data.Generics.Alloy.Schemes
@@ -32,7 +33,9 @@ import Control.Monad.State
 import Data.Generics (Data)
 import Data.Generics.Alloy
 import Data.Generics.Alloy.Schemes
-
+import Data.List
+import Data.Maybe
+import qualified Data.Set as Set
 
 import qualified AST as A
 import NavAST()
@@ -178,3 +181,57 @@ type TransformStructured' ops
 type TransformStructuredM' m ops
   = (AlloyA (A.Structured t) BaseOpA ops
     ,AlloyA (A.Structured t) ops BaseOpA, Data t) => A.Structured t -> m (A.Structured t)
+
+-- | The node types that 'NodeTransforms' can change.
+type FusedOps =
+          A.Process :-*
+          A.Specification :-*
+          A.Expression :-*
+          A.ExpressionList :-*
+          (A.Structured A.Expression) :-*
+          A.Variable :-*
+          BaseOpA
+
+-- | Apply a set of node functions bottom-up, in a single traversal.
+applyNodeTransforms :: (AlloyA t FusedOps BaseOpA) => NodeTransforms -> t -> PassM t
+applyNodeTransforms nt = makeRecurseM ops
+  where
+    ops :: FusedOps PassM
+    ops = makeBottomUpM ops (ntProcess nt)
+      :-* makeBottomUpM ops (ntSpecification nt)
+      :-* makeBottomUpM ops (ntExpression nt)
+      :-* makeBottomUpM ops (ntExpressionList nt)
+      :-* makeBottomUpM ops (ntStructuredExpression nt)
+      :-* makeBottomUpM ops (ntVariable nt)
+      :-* baseOpA
+
+-- | Replace each run of adjacent 'fusible' passes with a single pass that does
+-- all of their work in one traversal of the AST.  A pass only joins a run if
+-- none of its pre-requisites are provided by the passes already in it, since
+-- a fused pass sees the tree part-way through the earlier passes' work.
+fusePasses :: [Pass A.AST] -> [Pass A.AST]
+fusePasses [] = []
+fusePasses (p:ps)
+  | isJust (passFusible p) = fuse run : fusePasses rest
+  | otherwise = p : fusePasses ps
+  where
+    (run, rest) = extend [p] ps
+
+    extend :: [Pass A.AST] -> [Pass A.AST] -> ([Pass A.AST], [Pass A.AST])
+    extend done (q:qs)
+      | isJust (passFusible q)
+          && Set.null (Set.intersection (passPre q) (Set.unions $ map passPost done))
+          = extend (done ++ [q]) qs
+    extend done qs = (done, qs)
+
+    fuse :: [Pass A.AST] -> Pass A.AST
+    fuse [q] = q
+    fuse qs = Pass { passCode = applyNodeTransforms nt
+                   , passName = intercalate "; " (map passName qs)
+                   , passPre = Set.unions $ map passPre qs
+                   , passPost = Set.unions $ map passPost qs
+                   , passEnabled = \opts -> all (`passEnabled` opts) qs
+                   , passFusible = Just nt
+                   }
+      where
+        nt = foldr1 andThenTransforms $ mapMaybe passFusible qs
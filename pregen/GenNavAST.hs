@@ -43,11 +43,13 @@ main = do
       , genMapInstance (undefined :: String) (undefined :: [AST.Actual])
       , genMapInstance (undefined :: String) (undefined :: Set.Set CompState.NameAttr)
       , genMapInstance (undefined :: AST.Name) (undefined :: CompState.ParOrFork)
+      , genMapInstance (undefined :: String) (undefined :: Integer)
       -- All the sets that are in CompState:
       , genSetInstance (undefined :: Errors.WarningType)
       , genSetInstance (undefined :: String)
       , genSetInstance (undefined :: AST.Name)
       , genSetInstance (undefined :: CompState.NameAttr)
+      , genSetInstance (undefined :: CompState.Instrumentation)
       ]
       (header False (findModuleName instFileName))
       instFileName
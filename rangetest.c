@@ -256,6 +256,93 @@ jmp_buf g_stopped;
 #define check_all_u(max,bits) check_all_b_u(max,bits,uint##bits##_t,UINT##bits)
 
 
+#ifdef OCCAM_DUINT
+// The double-word intrinsics have two implementations (see
+// tock_intrinsics_arith.h); these check that they agree, including on
+// whether they stop, for random arguments.  Half the arguments are picked from
+// the awkward values below rather than at random.
+
+static const OCCAM_INT edge_values[] = {
+	0, 1, 2, 3, -1, -2, __MAX(OCCAM_INT), __MAX(OCCAM_INT) - 1,
+	__MIN(OCCAM_INT), __MIN(OCCAM_INT) + 1, __HALF_MAX_SIGNED(OCCAM_INT),
+	-__HALF_MAX_SIGNED(OCCAM_INT)
+};
+
+static uint64_t random_state = 88172645463325252ULL;
+
+static OCCAM_UINT random_word(void)
+{
+	// xorshift64
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 7;
+	random_state ^= random_state << 17;
+	return (OCCAM_UINT) random_state;
+}
+
+static OCCAM_INT random_int(void)
+{
+	OCCAM_UINT r = random_word();
+	if (r & 1)
+		return edge_values[(r >> 1) % (sizeof edge_values / sizeof edge_values[0])];
+	else
+		return occam_sign(random_word());
+}
+
+// Call both versions of an intrinsic that returns one extra result, and
+// compare what they did.
+#define test_same(fast, portable, args...) do { \
+	OCCAM_INT r0 = 0, r1 = 0, x0 = 0, x1 = 0; \
+	volatile int stopped0 = 0, stopped1 = 0; \
+	if (setjmp(g_stopped) == 0) { \
+		r0 = fast(args, &x0, ""); \
+	} else { \
+		stopped0 = 1; \
+	} \
+	if (setjmp(g_stopped) == 0) { \
+		r1 = portable(args, &x1, ""); \
+	} else { \
+		stopped1 = 1; \
+	} \
+	if (stopped0 != stopped1 || (!stopped0 && (r0 != r1 || x0 != x1))) { \
+		failures++; \
+		if (failures <= 20) \
+			report_failure(#fast "(" #args ") failed, with arguments %llx %llx %llx: got %llx %llx (stop: %d), expected %llx %llx (stop: %d)\n", \
+			  (long long)a, (long long)b, (long long)c, (long long)r0, (long long)x0, stopped0, (long long)r1, (long long)x1, stopped1); \
+	} else { \
+		passes++; \
+	} \
+  } while (0)
+
+static void check_double_word(int *passes_out, int *failures_out)
+{
+	int passes = 0;
+	int failures = 0;
+	for (int i = 0; i < 1000000; i++) {
+		const OCCAM_INT a = random_int(), b = random_int(), c = random_int();
+		const OCCAM_INT places = random_word() % (2 * occam_INT_bits + 1);
+		test_same(occam_LONGPROD, occam_LONGPROD_portable, a, b, c);
+		test_same(occam_LONGSUM, occam_LONGSUM_portable, a, b, c);
+		test_same(occam_LONGDIFF, occam_LONGDIFF_portable, a, b, c);
+		test_same(occam_LONGDIV, occam_LONGDIV_portable, a, b, c);
+		test_same(occam_SHIFTLEFT, occam_SHIFTLEFT_portable, a, b, places);
+		test_same(occam_SHIFTRIGHT, occam_SHIFTRIGHT_portable, a, b, places);
+
+		OCCAM_INT r0, r1, h0, h1, l0, l1;
+		r0 = occam_NORMALISE(a, b, &h0, &l0, "");
+		r1 = occam_NORMALISE_portable(a, b, &h1, &l1, "");
+		if (r0 != r1 || h0 != h1 || l0 != l1) {
+			failures++;
+			if (failures <= 20)
+				report_failure("occam_NORMALISE failed, with arguments %llx %llx: got %lld %llx %llx, expected %lld %llx %llx\n",
+				  (long long)a, (long long)b, (long long)r0, (long long)h0, (long long)l0, (long long)r1, (long long)h1, (long long)l1);
+		} else {
+			passes++;
+		}
+	}
+	*passes_out += passes;
+	*failures_out += failures;
+}
+#endif
 
 // The values of various operations (REM, shifts and so on)
 // are checked by the cgtest.  All we are concerned with
@@ -264,6 +351,68 @@ jmp_buf g_stopped;
 // the cgtests do not check.  But it can't hurt that we check
 // the various corner cases at the same time.
 
+// IEEE32OP and IEEE64OP have a version for each constant rounding mode as
+// well as the general one; check they agree, that they actually round in the
+// right direction, and that they leave the mode as round-to-nearest.
+#define check_ieee_op_size(type, size) do { \
+	volatile type operands[] = {1, 3, -7, 0.1, 1e30, -1e-30, INFINITY, NAN}; \
+	const int n = sizeof operands / sizeof operands[0]; \
+	for (int i = 0; i < n; i++) { \
+	for (int j = 0; j < n; j++) { \
+	for (OCCAM_INT op = 0; op < 4; op++) { \
+		type x = operands[i], y = operands[j]; \
+		type r[4], s[4]; \
+		OCCAM_BOOL nan_r[4], nan_s[4]; \
+		for (OCCAM_INT rm = 0; rm < 4; rm++) \
+			nan_r[rm] = occam_IEEE##size##OP(x, rm, op, y, &r[rm], ""); \
+		nan_s[0] = occam_IEEE##size##OP_zero(x, op, y, &s[0], ""); \
+		nan_s[1] = occam_IEEE##size##OP_nearest(x, op, y, &s[1], ""); \
+		nan_s[2] = occam_IEEE##size##OP_up(x, op, y, &s[2], ""); \
+		nan_s[3] = occam_IEEE##size##OP_down(x, op, y, &s[3], ""); \
+		for (OCCAM_INT rm = 0; rm < 4; rm++) { \
+			if (nan_r[rm] != nan_s[rm] || (!nan_r[rm] && r[rm] != s[rm])) { \
+				failures++; \
+				report_failure("IEEE" #size "OP(%g,%d,%d,%g) failed, got %g from the specialised version, expected %g\n", \
+				  (double)x, (int)rm, (int)op, (double)y, (double)s[rm], (double)r[rm]); \
+			} else { \
+				passes++; \
+			} \
+		} \
+		if (!nan_r[2] && !(r[3] <= r[1] && r[1] <= r[2] && r[3] <= r[0] && r[0] <= r[2])) { \
+			failures++; \
+			report_failure("IEEE" #size "OP(%g,_,%d,%g) failed, rounded wrongly: %g %g %g %g\n", \
+			  (double)x, (int)op, (double)y, (double)r[0], (double)r[1], (double)r[2], (double)r[3]); \
+		} \
+		if (fegetround() != FE_TONEAREST) { \
+			failures++; \
+			report_failure("IEEE" #size "OP(%g,_,%d,%g) failed, left the rounding mode changed\n", \
+			  (double)x, (int)op, (double)y); \
+			fesetround(FE_TONEAREST); \
+		} \
+	}}} \
+  } while (0)
+
+static void check_ieee_op(int *passes_out, int *failures_out)
+{
+	int passes = 0;
+	int failures = 0;
+	check_ieee_op_size(float, 32);
+	check_ieee_op_size(double, 64);
+	// 1/3 isn't exact, so rounding up and down must differ:
+	volatile float one = 1, three = 3;
+	float up, down;
+	occam_IEEE32OP_up(one, 3, three, &up, "");
+	occam_IEEE32OP_down(one, 3, three, &down, "");
+	if (up > down) {
+		passes++;
+	} else {
+		failures++;
+		report_failure("IEEE32OP failed, 1/3 rounded up (%g) isn't above 1/3 rounded down (%g)\n", up, down);
+	}
+	*passes_out += passes;
+	*failures_out += failures;
+}
+
 int main(int argc, char** argv)
 {
 	int passes = 0;
@@ -305,6 +454,10 @@ int main(int argc, char** argv)
 	testp(INT_MIN,occam_ASHIFTLEFT(INT_MIN,0,""));
 	testp(-4,occam_ASHIFTLEFT(-1,2,""));
 
+#ifdef OCCAM_DUINT
+	check_double_word(&passes, &failures);
+#endif
+
 	//Floating point:
 	testf(occam_ABS(NAN,""));
 	testf(occam_DABS(NAN,""));
@@ -333,6 +486,8 @@ int main(int argc, char** argv)
 	testf(occam_DIVBY2(INFINITY,""));
 	testf(occam_DDIVBY2(INFINITY,""));
 
+	check_ieee_op(&passes, &failures);
+
 
 	printf("Tests complete, passed: %d, failed: %d\n", passes, failures);
 	
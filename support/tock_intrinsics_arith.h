@@ -6,24 +6,42 @@
 
 #define occam_unsign(x) ((OCCAM_UINT)(x))
 #define occam_sign(x) ((OCCAM_INT)(x))
+#define occam_INT_bits ((OCCAM_INT)(CHAR_BIT*sizeof(OCCAM_INT)))
 
+// LONGDIFF, LONGPROD, LONGSUM, NORMALISE, LONGDIV, SHIFTLEFT and SHIFTRIGHT
+// work on double-word values.  The _portable versions of them split the
+// words into halves where they need to; if the compiler has an unsigned type
+// twice the width of INT (OCCAM_DUINT), the versions at the end of this file
+// use that instead, so that the hardware can do the multiplication,
+// division and so on directly.
+#if defined(__GNUC__) && occam_INT_size == 4
+#define OCCAM_DUINT uint64_t
+#elif defined(__GNUC__) && occam_INT_size == 8 && defined(__SIZEOF_INT128__)
+#define OCCAM_DUINT unsigned __int128
+#endif
+
+OCCAM_STOP_HANDLER(occam_LONGADD_failed, (OCCAM_INT left, OCCAM_INT right, const char *pos)) {
+	occam_stop(pos, 3, "Overflow in LONGADD: %d + %d", left, right);
+}
 static inline OCCAM_INT occam_LONGADD (OCCAM_INT, OCCAM_INT, OCCAM_INT, const char *) occam_unused;
 static inline OCCAM_INT occam_LONGADD (OCCAM_INT left, OCCAM_INT right, OCCAM_INT carry_in, const char *pos) {
-	if (left == __MAX(OCCAM_INT)) {
+	if (occam_unlikely (left == __MAX(OCCAM_INT))) {
 		if (right == __MAX(OCCAM_INT)) {
-			occam_stop(pos, 3, "Overflow in LONGADD: %d + %d", left, right);
+			occam_LONGADD_failed(left, right, pos);
+			return 0;
 		} else right += carry_in & 1;
 	} else left += carry_in & 1;
 
-	if (((right<1)&&(__MIN(OCCAM_INT)-right<=left)) || ((right>=1)&&(__MAX(OCCAM_INT)-right>=left))) {
+	if (occam_likely (((right<1)&&(__MIN(OCCAM_INT)-right<=left)) || ((right>=1)&&(__MAX(OCCAM_INT)-right>=left)))) {
 		return left + right;
 	} else {
-		occam_stop(pos, 3, "Overflow in LONGADD: %d + %d", left, right);
+		occam_LONGADD_failed(left, right, pos);
+		return 0;
 	}
 }
 
-static inline OCCAM_INT occam_LONGDIFF (OCCAM_INT, OCCAM_INT, OCCAM_INT, OCCAM_INT*, const char *) occam_unused;
-static inline OCCAM_INT occam_LONGDIFF (OCCAM_INT left, OCCAM_INT right, OCCAM_INT borrow_in, OCCAM_INT* result1, const char *pos) {
+static inline OCCAM_INT occam_LONGDIFF_portable (OCCAM_INT, OCCAM_INT, OCCAM_INT, OCCAM_INT*, const char *) occam_unused;
+static inline OCCAM_INT occam_LONGDIFF_portable (OCCAM_INT left, OCCAM_INT right, OCCAM_INT borrow_in, OCCAM_INT* result1, const char *pos) {
 	OCCAM_UINT leftu = occam_unsign(left);
 	OCCAM_UINT rightu = occam_unsign(right);
 	if (leftu == 0) {
@@ -43,13 +61,13 @@ static inline OCCAM_INT occam_LONGDIFF (OCCAM_INT left, OCCAM_INT right, OCCAM_I
 	}
 }
 
-static inline OCCAM_INT occam_LONGPROD (OCCAM_INT, OCCAM_INT, OCCAM_INT, OCCAM_INT*, const char *) occam_unused;
-static inline OCCAM_INT occam_LONGPROD (OCCAM_INT left, OCCAM_INT right, OCCAM_INT carry_in, OCCAM_INT* result1, const char *pos) {
+static inline OCCAM_INT occam_LONGPROD_portable (OCCAM_INT, OCCAM_INT, OCCAM_INT, OCCAM_INT*, const char *) occam_unused;
+static inline OCCAM_INT occam_LONGPROD_portable (OCCAM_INT left, OCCAM_INT right, OCCAM_INT carry_in, OCCAM_INT* result1, const char *pos) {
 	const OCCAM_UINT leftu = occam_unsign(left);
 	const OCCAM_UINT rightu = occam_unsign(right);
 	const OCCAM_UINT carryu = occam_unsign(carry_in);
 #define HI_HALF(x) (x >> (CHAR_BIT*sizeof(OCCAM_INT)/2))
-#define LO_HALF(x) (x & ((1<<(CHAR_BIT*sizeof(OCCAM_INT)/2))-1))
+#define LO_HALF(x) (x & ((((OCCAM_UINT)1)<<(CHAR_BIT*sizeof(OCCAM_INT)/2))-1))
 #define MAKE_HI(x) (x << (CHAR_BIT*sizeof(OCCAM_INT)/2))
 	const OCCAM_UINT leftu_hi = HI_HALF(leftu);
 	const OCCAM_UINT rightu_hi = HI_HALF(rightu);
@@ -84,23 +102,28 @@ static inline OCCAM_INT occam_LONGPROD (OCCAM_INT left, OCCAM_INT right, OCCAM_I
 #undef MAKE_HI
 }
 
+OCCAM_STOP_HANDLER(occam_LONGSUB_failed, (OCCAM_INT left, OCCAM_INT right, const char *pos)) {
+	occam_stop(pos, 3, "Overflow in LONGSUB: %d - %d", left, right);
+}
 static inline OCCAM_INT occam_LONGSUB (OCCAM_INT, OCCAM_INT, OCCAM_INT, const char *) occam_unused;
 static inline OCCAM_INT occam_LONGSUB (OCCAM_INT left, OCCAM_INT right, OCCAM_INT borrow_in, const char *pos) {
-	if (left == __MIN(OCCAM_INT)) {
+	if (occam_unlikely (left == __MIN(OCCAM_INT))) {
 		if (right == __MIN(OCCAM_INT)) {
-			occam_stop(pos, 3, "Overflow in LONGSUB: %d - %d", left, right);
+			occam_LONGSUB_failed(left, right, pos);
+			return 0;
 		} else right -= borrow_in & 1;
 	} else left -= borrow_in & 1;
 
-	if (((right<1)&&(__MAX(OCCAM_INT)+right>=left)) || ((right>=1)&&(__MIN(OCCAM_INT)+right<=left))) {
+	if (occam_likely (((right<1)&&(__MAX(OCCAM_INT)+right>=left)) || ((right>=1)&&(__MIN(OCCAM_INT)+right<=left)))) {
 		return left - right;
 	} else {
-		occam_stop(pos, 3, "Overflow in LONGSUB: %d - %d", left, right);
+		occam_LONGSUB_failed(left, right, pos);
+		return 0;
 	}
 }
 
-static inline OCCAM_INT occam_LONGSUM (OCCAM_INT, OCCAM_INT, OCCAM_INT, OCCAM_INT*, const char *) occam_unused;
-static inline OCCAM_INT occam_LONGSUM (OCCAM_INT left, OCCAM_INT right, OCCAM_INT carry_in, OCCAM_INT* result1, const char *pos) {
+static inline OCCAM_INT occam_LONGSUM_portable (OCCAM_INT, OCCAM_INT, OCCAM_INT, OCCAM_INT*, const char *) occam_unused;
+static inline OCCAM_INT occam_LONGSUM_portable (OCCAM_INT left, OCCAM_INT right, OCCAM_INT carry_in, OCCAM_INT* result1, const char *pos) {
 	OCCAM_UINT leftu = occam_unsign(left);
 	OCCAM_UINT rightu = occam_unsign(right);
 	if (leftu == __MAX(OCCAM_UINT)) {
@@ -120,15 +143,15 @@ static inline OCCAM_INT occam_LONGSUM (OCCAM_INT left, OCCAM_INT right, OCCAM_IN
 	}
 }
 
-static inline OCCAM_INT occam_NORMALISE (OCCAM_INT, OCCAM_INT, OCCAM_INT*, OCCAM_INT*,const char *) occam_unused;
-static inline OCCAM_INT occam_NORMALISE (OCCAM_INT hi_in, OCCAM_INT lo_in, OCCAM_INT* result1, OCCAM_INT* result2, const char *pos) {
+static inline OCCAM_INT occam_NORMALISE_portable (OCCAM_INT, OCCAM_INT, OCCAM_INT*, OCCAM_INT*,const char *) occam_unused;
+static inline OCCAM_INT occam_NORMALISE_portable (OCCAM_INT hi_in, OCCAM_INT lo_in, OCCAM_INT* result1, OCCAM_INT* result2, const char *pos) {
 	if (hi_in == 0 && lo_in == 0) {
 		*result1 = *result2 = 0;
 		return 2*CHAR_BIT*sizeof(OCCAM_INT);
 	} else {
-		const OCCAM_INT highest_bit = __MIN(OCCAM_INT);
-		OCCAM_INT hi = hi_in;
-		OCCAM_INT lo = lo_in;
+		const OCCAM_UINT highest_bit = occam_unsign(__MIN(OCCAM_INT));
+		OCCAM_UINT hi = occam_unsign(hi_in);
+		OCCAM_UINT lo = occam_unsign(lo_in);
 		OCCAM_INT places = 0;
 		while ((hi & highest_bit) == 0) {
 			hi <<= 1;
@@ -136,16 +159,22 @@ static inline OCCAM_INT occam_NORMALISE (OCCAM_INT hi_in, OCCAM_INT lo_in, OCCAM
 			lo <<= 1;
 			places++;
 		}
-		*result1 = hi;
-		*result2 = lo;
+		*result1 = occam_sign(hi);
+		*result2 = occam_sign(lo);
 		return places;
 	}
 }
 
 //Has to go late on due to its function re-use:
 
-static inline OCCAM_INT occam_LONGDIV (OCCAM_INT, OCCAM_INT, OCCAM_INT, OCCAM_INT*, const char *) occam_unused;
-static inline OCCAM_INT occam_LONGDIV (OCCAM_INT dividend_hi, OCCAM_INT dividend_lo, OCCAM_INT divisor, OCCAM_INT* result1, const char *pos) {
+OCCAM_STOP_HANDLER(occam_LONGDIV_by_zero, (const char *pos)) {
+	occam_stop(pos, 1, "Division by zero in LONGDIV");
+}
+OCCAM_STOP_HANDLER(occam_LONGDIV_overflow, (OCCAM_INT dividend_hi, OCCAM_INT dividend_lo, OCCAM_INT divisor, const char *pos)) {
+	occam_stop(pos,4,"Overflow in LONGDIV(%d,%d,%d)", dividend_hi, dividend_lo, divisor);
+}
+static inline OCCAM_INT occam_LONGDIV_portable (OCCAM_INT, OCCAM_INT, OCCAM_INT, OCCAM_INT*, const char *) occam_unused;
+static inline OCCAM_INT occam_LONGDIV_portable (OCCAM_INT dividend_hi, OCCAM_INT dividend_lo, OCCAM_INT divisor, OCCAM_INT* result1, const char *pos) {
 	OCCAM_UINT top_hi = occam_unsign(dividend_hi);
 	OCCAM_UINT top_lo = occam_unsign(dividend_lo);
 	const OCCAM_UINT bottom = occam_unsign(divisor);
@@ -159,8 +188,9 @@ static inline OCCAM_INT occam_LONGDIV (OCCAM_INT dividend_hi, OCCAM_INT dividend
 	//quantity to Lo, and repeat the procedure, until
 	// Hi is zero.
 	
-	if (bottom == 0) {
-		occam_stop(pos, 1, "Division by zero in LONGDIV");
+	if (occam_unlikely (bottom == 0)) {
+		occam_LONGDIV_by_zero(pos);
+		return 0;
 	} else {
 		OCCAM_UINT r_hi = 0;
 		OCCAM_UINT r_lo = 0;
@@ -170,7 +200,7 @@ static inline OCCAM_INT occam_LONGDIV (OCCAM_INT dividend_hi, OCCAM_INT dividend
 		//We can work R/bot out by doing:
 		// (R/2)/bot + ((R/2)%bot + (R/2)/bot
 		const OCCAM_UINT halfR = occam_unsign(__MIN(OCCAM_INT));
-		OCCAM_UINT R_over_bot = bottom >= halfR ? 1 : (halfR/bottom + ((halfR % bottom) + halfR) / bottom);
+		OCCAM_UINT R_over_bot = bottom > halfR ? 1 : (halfR/bottom + ((halfR % bottom) + halfR) / bottom);
 		OCCAM_UINT R_mod_bot = (__MAX(OCCAM_UINT)%bottom) == bottom - 1 ? 0 : 1+(__MAX(OCCAM_UINT)%bottom);
 
 		while (top_hi != 0) {
@@ -179,30 +209,37 @@ static inline OCCAM_INT occam_LONGDIV (OCCAM_INT dividend_hi, OCCAM_INT dividend
 			top_lo %= bottom;
 			top_hi %= bottom;
 			amount_extra_R_over_bot += top_hi;
-			top_hi = occam_unsign(occam_LONGPROD(occam_sign(top_hi),occam_sign(R_mod_bot),occam_sign(top_lo),(OCCAM_INT*)&top_lo,pos));
+			top_hi = occam_unsign(occam_LONGPROD_portable(occam_sign(top_hi),occam_sign(R_mod_bot),occam_sign(top_lo),(OCCAM_INT*)&top_lo,pos));
 		}
 
 		//long-add the results from top_lo/bottom to r_hi,r_lo:
-		r_hi += occam_unsign(occam_LONGSUM(occam_sign(r_lo),occam_sign(top_lo/bottom),0,(OCCAM_INT*)&r_lo,pos));
+		r_hi += occam_unsign(occam_LONGSUM_portable(occam_sign(r_lo),occam_sign(top_lo/bottom),0,(OCCAM_INT*)&r_lo,pos));
 		//Save the remainder for later:
 		const OCCAM_UINT rem = top_lo%bottom;
 		
 		//Finally, add on R_over_bot * amount_extra_R_over_bot
-		top_hi = occam_unsign(occam_LONGPROD(occam_sign(R_over_bot), occam_sign(amount_extra_R_over_bot), 0, (OCCAM_INT*)&top_lo,pos));
-		r_hi += top_hi + occam_unsign(occam_LONGSUM(occam_sign(r_lo), occam_sign(top_lo), 0, (OCCAM_INT*)&r_lo, pos));
+		top_hi = occam_unsign(occam_LONGPROD_portable(occam_sign(R_over_bot), occam_sign(amount_extra_R_over_bot), 0, (OCCAM_INT*)&top_lo,pos));
+		r_hi += top_hi + occam_unsign(occam_LONGSUM_portable(occam_sign(r_lo), occam_sign(top_lo), 0, (OCCAM_INT*)&r_lo, pos));
 		
-		if (r_hi == 0) {
+		if (occam_likely (r_hi == 0)) {
 			*result1 = occam_sign(rem);
 			return occam_sign(r_lo);
 		} else {
-			occam_stop(pos,4,"Overflow in LONGDIV(%d,%d,%d)", dividend_hi, dividend_lo, divisor);
+			occam_LONGDIV_overflow(dividend_hi, dividend_lo, divisor, pos);
+			return 0;
 		}	
 	}
 }
 
-static inline OCCAM_INT occam_SHIFTLEFT (OCCAM_INT, OCCAM_INT, OCCAM_INT, OCCAM_INT*, const char *) occam_unused;
-static inline OCCAM_INT occam_SHIFTLEFT (OCCAM_INT hi_in, OCCAM_INT lo_in, OCCAM_INT places, OCCAM_INT* result1, const char *pos) {
-	if (places >= (OCCAM_INT)(CHAR_BIT*sizeof(OCCAM_INT))) {
+static inline OCCAM_INT occam_SHIFTLEFT_portable (OCCAM_INT, OCCAM_INT, OCCAM_INT, OCCAM_INT*, const char *) occam_unused;
+static inline OCCAM_INT occam_SHIFTLEFT_portable (OCCAM_INT hi_in, OCCAM_INT lo_in, OCCAM_INT places, OCCAM_INT* result1, const char *pos) {
+	if (places == 0) {
+		*result1 = lo_in;
+		return hi_in;
+	} else if (places >= 2 * occam_INT_bits) {
+		*result1 = 0;
+		return 0;
+	} else if (places >= (OCCAM_INT)(CHAR_BIT*sizeof(OCCAM_INT))) {
 		*result1 = 0;
 		return occam_sign(occam_unsign(lo_in) << (places - CHAR_BIT*sizeof(OCCAM_INT)));
 	} else {
@@ -213,9 +250,15 @@ static inline OCCAM_INT occam_SHIFTLEFT (OCCAM_INT hi_in, OCCAM_INT lo_in, OCCAM
 	}
 }
 
-static inline OCCAM_INT occam_SHIFTRIGHT (OCCAM_INT, OCCAM_INT, OCCAM_INT, OCCAM_INT*, const char *) occam_unused;
-static inline OCCAM_INT occam_SHIFTRIGHT (OCCAM_INT hi_in, OCCAM_INT lo_in, OCCAM_INT places, OCCAM_INT* result1, const char *pos) {
-	if (places >= (OCCAM_INT)(CHAR_BIT*sizeof(OCCAM_INT))) {
+static inline OCCAM_INT occam_SHIFTRIGHT_portable (OCCAM_INT, OCCAM_INT, OCCAM_INT, OCCAM_INT*, const char *) occam_unused;
+static inline OCCAM_INT occam_SHIFTRIGHT_portable (OCCAM_INT hi_in, OCCAM_INT lo_in, OCCAM_INT places, OCCAM_INT* result1, const char *pos) {
+	if (places == 0) {
+		*result1 = lo_in;
+		return hi_in;
+	} else if (places >= 2 * occam_INT_bits) {
+		*result1 = 0;
+		return 0;
+	} else if (places >= (OCCAM_INT)(CHAR_BIT*sizeof(OCCAM_INT))) {
 		*result1 = occam_sign(occam_unsign(hi_in) >> (places - CHAR_BIT*sizeof(OCCAM_INT)));
 		return 0;
 	} else {
@@ -231,19 +274,24 @@ static inline OCCAM_INT occam_ASHIFTRIGHT (OCCAM_INT x, OCCAM_INT places, const
 	return x >> places;
 }
 
+OCCAM_STOP_HANDLER(occam_ASHIFTLEFT_failed, (OCCAM_INT x, OCCAM_INT places, const char *pos)) {
+	occam_stop(pos,3,"Overflow in ASHIFTLEFT(%d,%d)",x,places);
+}
 static inline OCCAM_INT occam_ASHIFTLEFT (OCCAM_INT, OCCAM_INT, const char *) occam_unused;
 static inline OCCAM_INT occam_ASHIFTLEFT (OCCAM_INT x, OCCAM_INT places, const char *pos) {
 	//Overflows if positive and 1 bits are shifted out or highest bit ends as 1,
 	//or negative and 0 bits are shifted out or highest bit ends as 0
-	if (places > (OCCAM_INT)(CHAR_BIT*sizeof(OCCAM_INT))
+	if (occam_unlikely (places > (OCCAM_INT)(CHAR_BIT*sizeof(OCCAM_INT))
 	    || places < 0
-	    || (places == (OCCAM_INT)(CHAR_BIT*sizeof(OCCAM_INT)) && x != 0)) {
-		occam_stop(pos,3,"Overflow in ASHIFTLEFT(%d,%d)",x,places);
+	    || (places == (OCCAM_INT)(CHAR_BIT*sizeof(OCCAM_INT)) && x != 0))) {
+		occam_ASHIFTLEFT_failed(x, places, pos);
+		return 0;
 	}
-	else if (places != (OCCAM_INT)(CHAR_BIT*sizeof(OCCAM_INT)) && places != 0 &&
+	else if (occam_unlikely (places != (OCCAM_INT)(CHAR_BIT*sizeof(OCCAM_INT)) && places != 0 &&
 	      (occam_unsign(x) >> (CHAR_BIT*sizeof(OCCAM_INT)-places-1) != 
-	       occam_unsign(x < 0 ? (OCCAM_INT)-1 : (OCCAM_INT)0) >> (CHAR_BIT*sizeof(OCCAM_INT)-places-1))) {
-		occam_stop(pos,3,"Overflow in ASHIFTLEFT(%d,%d)",x,places);
+	       occam_unsign(x < 0 ? (OCCAM_INT)-1 : (OCCAM_INT)0) >> (CHAR_BIT*sizeof(OCCAM_INT)-places-1)))) {
+		occam_ASHIFTLEFT_failed(x, places, pos);
+		return 0;
 	} else {
 		return (x << places);
 	}
@@ -259,4 +307,108 @@ static inline OCCAM_INT occam_ROTATELEFT (OCCAM_INT x, OCCAM_INT places, const c
 	return (x << places) | (OCCAM_INT)((OCCAM_UINT)x >> (CHAR_BIT*sizeof(OCCAM_INT) - places));
 }
 
+#ifdef OCCAM_DUINT
+//{{{ double-width versions
+#define occam_dword(hi, lo) ((((OCCAM_DUINT) occam_unsign(hi)) << occam_INT_bits) | occam_unsign(lo))
+#define occam_dword_hi(d) occam_sign((OCCAM_UINT) ((d) >> occam_INT_bits))
+#define occam_dword_lo(d) occam_sign((OCCAM_UINT) (d))
+
+static inline OCCAM_INT occam_LONGDIFF (OCCAM_INT, OCCAM_INT, OCCAM_INT, OCCAM_INT*, const char *) occam_unused;
+static inline OCCAM_INT occam_LONGDIFF (OCCAM_INT left, OCCAM_INT right, OCCAM_INT borrow_in, OCCAM_INT* result1, const char *pos) {
+	// The borrow can be worked out a word at a time, which is quicker than
+	// subtracting double words when they're wider than a register.
+	const OCCAM_UINT diff = occam_unsign(left) - occam_unsign(right);
+	const OCCAM_UINT lo = diff - (borrow_in & 1);
+	*result1 = occam_sign(lo);
+	return (diff > occam_unsign(left)) + (lo > diff);
+}
+
+static inline OCCAM_INT occam_LONGPROD (OCCAM_INT, OCCAM_INT, OCCAM_INT, OCCAM_INT*, const char *) occam_unused;
+static inline OCCAM_INT occam_LONGPROD (OCCAM_INT left, OCCAM_INT right, OCCAM_INT carry_in, OCCAM_INT* result1, const char *pos) {
+	const OCCAM_DUINT d = (OCCAM_DUINT) occam_unsign(left) * occam_unsign(right) + occam_unsign(carry_in);
+	*result1 = occam_dword_lo(d);
+	return occam_dword_hi(d);
+}
+
+static inline OCCAM_INT occam_LONGSUM (OCCAM_INT, OCCAM_INT, OCCAM_INT, OCCAM_INT*, const char *) occam_unused;
+static inline OCCAM_INT occam_LONGSUM (OCCAM_INT left, OCCAM_INT right, OCCAM_INT carry_in, OCCAM_INT* result1, const char *pos) {
+	// As with LONGDIFF, the carry is worked out a word at a time.
+	const OCCAM_UINT sum = occam_unsign(left) + occam_unsign(right);
+	const OCCAM_UINT lo = sum + (carry_in & 1);
+	*result1 = occam_sign(lo);
+	return (sum < occam_unsign(left)) + (lo < sum);
+}
+
+static inline OCCAM_INT occam_NORMALISE (OCCAM_INT, OCCAM_INT, OCCAM_INT*, OCCAM_INT*,const char *) occam_unused;
+static inline OCCAM_INT occam_NORMALISE (OCCAM_INT hi_in, OCCAM_INT lo_in, OCCAM_INT* result1, OCCAM_INT* result2, const char *pos) {
+	if (hi_in == 0 && lo_in == 0) {
+		*result1 = *result2 = 0;
+		return 2 * occam_INT_bits;
+	} else {
+#if occam_INT_size == 4
+#define occam_clz(x) __builtin_clz (x)
+#else
+#define occam_clz(x) __builtin_clzll (x)
+#endif
+		const OCCAM_INT places = hi_in != 0 ? occam_clz (occam_unsign(hi_in)) : occam_INT_bits + occam_clz (occam_unsign(lo_in));
+#undef occam_clz
+		const OCCAM_DUINT d = occam_dword(hi_in, lo_in) << places;
+		*result1 = occam_dword_hi(d);
+		*result2 = occam_dword_lo(d);
+		return places;
+	}
+}
+
+static inline OCCAM_INT occam_LONGDIV (OCCAM_INT, OCCAM_INT, OCCAM_INT, OCCAM_INT*, const char *) occam_unused;
+static inline OCCAM_INT occam_LONGDIV (OCCAM_INT dividend_hi, OCCAM_INT dividend_lo, OCCAM_INT divisor, OCCAM_INT* result1, const char *pos) {
+	if (occam_unlikely (divisor == 0)) {
+		occam_LONGDIV_by_zero(pos);
+		return 0;
+	} else if (occam_unlikely (occam_unsign(dividend_hi) >= occam_unsign(divisor))) {
+		// The quotient wouldn't fit in a word.
+		occam_LONGDIV_overflow(dividend_hi, dividend_lo, divisor, pos);
+		return 0;
+	} else {
+		const OCCAM_DUINT top = occam_dword(dividend_hi, dividend_lo);
+		*result1 = occam_sign((OCCAM_UINT) (top % occam_unsign(divisor)));
+		return occam_sign((OCCAM_UINT) (top / occam_unsign(divisor)));
+	}
+}
+
+static inline OCCAM_INT occam_SHIFTLEFT (OCCAM_INT, OCCAM_INT, OCCAM_INT, OCCAM_INT*, const char *) occam_unused;
+static inline OCCAM_INT occam_SHIFTLEFT (OCCAM_INT hi_in, OCCAM_INT lo_in, OCCAM_INT places, OCCAM_INT* result1, const char *pos) {
+	if (places >= 2 * occam_INT_bits) {
+		*result1 = 0;
+		return 0;
+	} else {
+		const OCCAM_DUINT d = occam_dword(hi_in, lo_in) << places;
+		*result1 = occam_dword_lo(d);
+		return occam_dword_hi(d);
+	}
+}
+
+static inline OCCAM_INT occam_SHIFTRIGHT (OCCAM_INT, OCCAM_INT, OCCAM_INT, OCCAM_INT*, const char *) occam_unused;
+static inline OCCAM_INT occam_SHIFTRIGHT (OCCAM_INT hi_in, OCCAM_INT lo_in, OCCAM_INT places, OCCAM_INT* result1, const char *pos) {
+	if (places >= 2 * occam_INT_bits) {
+		*result1 = 0;
+		return 0;
+	} else {
+		const OCCAM_DUINT d = occam_dword(hi_in, lo_in) >> places;
+		*result1 = occam_dword_lo(d);
+		return occam_dword_hi(d);
+	}
+}
 
+#undef occam_dword
+#undef occam_dword_hi
+#undef occam_dword_lo
+//}}}
+#else
+#define occam_LONGDIFF occam_LONGDIFF_portable
+#define occam_LONGPROD occam_LONGPROD_portable
+#define occam_LONGSUM occam_LONGSUM_portable
+#define occam_NORMALISE occam_NORMALISE_portable
+#define occam_LONGDIV occam_LONGDIV_portable
+#define occam_SHIFTLEFT occam_SHIFTLEFT_portable
+#define occam_SHIFTRIGHT occam_SHIFTRIGHT_portable
+#endif
@@ -10,26 +10,6 @@ static inline OCCAM_INT ADD_PREFIX(IEEECOMPARE) (REAL X, REAL Y, const char* pos
 		return 0;
 	}
 }
-static inline OCCAM_BOOL SPLICE_SIZE(occam_IEEE,OP) (REAL, OCCAM_INT, OCCAM_INT, REAL, REAL*, const char*) occam_unused;
-static inline OCCAM_BOOL SPLICE_SIZE(occam_IEEE,OP) (REAL X, OCCAM_INT Rm, OCCAM_INT Op, REAL Y, REAL* result1, const char* pos) {
-	REAL R;
-	int prevRm = fegetround();
-	switch (Rm) {
-		case 0: fesetround(FE_TOWARDZERO); break;
-		case 1: fesetround(FE_TONEAREST); break;
-		case 2: fesetround(FE_UPWARD); break;
-		case 3: fesetround(FE_DOWNWARD); break;
-	}
-	switch (Op) {
-		case 0: R = X + Y; break;
-		case 1: R = X - Y; break;
-		case 2: R = X * Y; break;
-		case 3: R = X / Y; break;
-	}	
-	fesetround(prevRm);
-	*result1 = R;
-	return (isnan(R));
-}
 static inline OCCAM_BOOL SPLICE_SIZE(occam_IEEE,REM) (REAL, REAL, REAL*, const char*) occam_unused;
 static inline OCCAM_BOOL SPLICE_SIZE(occam_IEEE,REM) (REAL X, REAL Y, REAL* result1, const char* pos) {
 	*result1 = F(remainder)(X,Y);
@@ -57,6 +37,53 @@ static inline REAL SPLICE_SIZE(occam_REAL,REM) (REAL, REAL, const char*) occam_u
 static inline REAL SPLICE_SIZE(occam_REAL,REM) (REAL X, REAL Y, const char* pos) {
 	return F(remainder)(X,Y);
 }
+//{{{ IEEE32OP/IEEE64OP
+// Changing the rounding mode is slow (it serialises the FPU), so it's only
+// done if the operation needs a mode other than the current one.
+static inline OCCAM_BOOL SPLICE_SIZE(occam_IEEE,OP) (REAL, OCCAM_INT, OCCAM_INT, REAL, REAL*, const char*) occam_unused;
+static inline OCCAM_BOOL SPLICE_SIZE(occam_IEEE,OP) (REAL X, OCCAM_INT Rm, OCCAM_INT Op, REAL Y, REAL* result1, const char* pos) {
+	const int prevRm = fegetround();
+	const int newRm = occam_rounding_mode(Rm, prevRm);
+	REAL R;
+	if (occam_likely (newRm == prevRm)) {
+		R = SPLICE_SIZE(occam_REAL,OP)(X, Op, Y, pos);
+	} else {
+		fesetround(newRm);
+		occam_fp_barrier(X);
+		occam_fp_barrier(Y);
+		R = SPLICE_SIZE(occam_REAL,OP)(X, Op, Y, pos);
+		occam_fp_barrier(R);
+		fesetround(prevRm);
+	}
+	*result1 = R;
+	return (isnan(R));
+}
+// The compiler uses these instead when Rm is a constant.  Since the mode is
+// round-to-nearest everywhere else, they don't need to ask what it was
+// before, and the round-to-nearest version needn't change it at all.
+static inline OCCAM_BOOL SPLICE_SIZE(occam_IEEE,OP_nearest) (REAL, OCCAM_INT, REAL, REAL*, const char*) occam_unused;
+static inline OCCAM_BOOL SPLICE_SIZE(occam_IEEE,OP_nearest) (REAL X, OCCAM_INT Op, REAL Y, REAL* result1, const char* pos) {
+	*result1 = SPLICE_SIZE(occam_REAL,OP)(X, Op, Y, pos);
+	return (isnan(*result1));
+}
+#define MAKE_IEEEOP(name, mode) \
+	static inline OCCAM_BOOL name (REAL, OCCAM_INT, REAL, REAL*, const char*) occam_unused; \
+	static inline OCCAM_BOOL name (REAL X, OCCAM_INT Op, REAL Y, REAL* result1, const char* pos) { \
+		REAL R; \
+		fesetround(mode); \
+		occam_fp_barrier(X); \
+		occam_fp_barrier(Y); \
+		R = SPLICE_SIZE(occam_REAL,OP)(X, Op, Y, pos); \
+		occam_fp_barrier(R); \
+		fesetround(FE_TONEAREST); \
+		*result1 = R; \
+		return (isnan(R)); \
+	}
+MAKE_IEEEOP(SPLICE_SIZE(occam_IEEE,OP_zero), FE_TOWARDZERO)
+MAKE_IEEEOP(SPLICE_SIZE(occam_IEEE,OP_up), FE_UPWARD)
+MAKE_IEEEOP(SPLICE_SIZE(occam_IEEE,OP_down), FE_DOWNWARD)
+#undef MAKE_IEEEOP
+//}}}
 #if SPLICE_SIZE(4,1) == 4321
 static inline OCCAM_BOOL occam_ARGUMENT_REDUCE (float, float, float, int32_t*, float*, const char*) occam_unused;
 static inline OCCAM_BOOL occam_ARGUMENT_REDUCE (float X, float Y, float Y_err, int32_t* result1, float* result2, const char* pos) {
@@ -81,12 +108,16 @@ static inline OCCAM_BOOL occam_DARGUMENT_REDUCE (double X, double Y, double Y_er
 	}
 }
 
+OCCAM_STOP_HANDLER(ADD_PREFIX(stop_real), (const char *func, const char *problem, REAL X, const char* pos)) {
+	occam_stop(pos,4,"Called %s on %s: %f",func,problem,X);
+}
 static inline REAL ADD_PREFIX(ABS) (REAL, const char*) occam_unused;
 static inline REAL ADD_PREFIX(ABS) (REAL X, const char* pos) {
-	if (isfinite(X)) {
+	if (occam_likely (isfinite(X))) {
 		return F(fabs)(X);
 	} else {
-		occam_stop(pos,2,"Called (D)ABS on non-finite value: %f",X);
+		ADD_PREFIX(stop_real)("(D)ABS", "non-finite value", X, pos);
+		return X;
 	}
 }
 static inline REAL ADD_PREFIX(COPYSIGN) (REAL, REAL, const char*) occam_unused;
@@ -95,10 +126,11 @@ static inline REAL ADD_PREFIX(COPYSIGN) (REAL X, REAL Y, const char* pos) {
 }
 static inline REAL ADD_PREFIX(DIVBY2) (REAL, const char*) occam_unused;
 static inline REAL ADD_PREFIX(DIVBY2) (REAL X, const char* pos) {
-	if (isfinite(X)) {
+	if (occam_likely (isfinite(X))) {
 		return F(scalbln)(X,-1);
 	} else {
-		occam_stop(pos,2,"Called (D)DIVBY2 on non-finite value: %f", X);
+		ADD_PREFIX(stop_real)("(D)DIVBY2", "non-finite value", X, pos);
+		return X;
 	}
 }
 static inline OCCAM_INT ADD_PREFIX(FLOATING_UNPACK) (REAL, REAL*, const char*) occam_unused;
@@ -155,10 +187,11 @@ static inline REAL ADD_PREFIX(MINUSX) (REAL X, const char* pos) {
 }
 static inline REAL ADD_PREFIX(MULBY2) (REAL, const char*) occam_unused;
 static inline REAL ADD_PREFIX(MULBY2) (REAL X, const char* pos) {
-	if (isfinite(X)) {
+	if (occam_likely (isfinite(X))) {
 		return F(scalbln)(X,1);
 	} else {
-		occam_stop(pos,2,"Called (D)MULBY2 on non-finite value: %f", X);
+		ADD_PREFIX(stop_real)("(D)MULBY2", "non-finite value", X, pos);
+		return X;
 	}
 }
 static inline REAL ADD_PREFIX(NEXTAFTER) (REAL, REAL, const char*) occam_unused;
@@ -175,18 +208,20 @@ static inline OCCAM_BOOL ADD_PREFIX(ORDERED) (REAL X, REAL Y, const char* pos) {
 }
 static inline REAL ADD_PREFIX(SCALEB) (REAL, OCCAM_INT, const char*) occam_unused;
 static inline REAL ADD_PREFIX(SCALEB) (REAL X, OCCAM_INT n, const char* pos) {
-	if (isfinite(X)) {
+	if (occam_likely (isfinite(X))) {
 		return F(scalbln)(X,n);
 	} else {
-		occam_stop(pos,2,"Called (D)SCALEB on non-finite value: %f", X);
+		ADD_PREFIX(stop_real)("(D)SCALEB", "non-finite value", X, pos);
+		return X;
 	}
 }
 static inline REAL ADD_PREFIX(SQRT) (REAL, const char*) occam_unused;
 static inline REAL ADD_PREFIX(SQRT) (REAL X, const char* pos) {
-	if (isfinite(X) && X >= 0) {
+	if (occam_likely (isfinite(X) && X >= 0)) {
 		return F(sqrt)(X);
 	} else {
-		occam_stop(pos,2,"Called (D)SQRT on invalid input: %f", X);
+		ADD_PREFIX(stop_real)("(D)SQRT", "invalid input", X, pos);
+		return X;
 	}
 }
 
@@ -57,10 +57,23 @@
 #ifdef __GNUC__
 #define occam_struct_packed __attribute__ ((packed))
 #define occam_unused __attribute__ ((unused))
+#define occam_likely(x) __builtin_expect (!!(x), 1)
+#define occam_unlikely(x) __builtin_expect (!!(x), 0)
+#define occam_cold __attribute__ ((cold, noinline))
+#define occam_noreturn __attribute__ ((noreturn))
+// GCC doesn't know that changing the rounding mode affects floating-point
+// arithmetic, and will move calculations across fesetround (or work them out
+// just once for several modes); this stops it moving them past this point.
+#define occam_fp_barrier(x) __asm__ __volatile__ ("" : "+m" (x) : : "memory")
 #else
 #warning No PACKED (or other compiler specials) implementation for this compiler
 #define occam_struct_packed
 #define occam_unused
+#define occam_likely(x) (x)
+#define occam_unlikely(x) (x)
+#define occam_cold
+#define occam_noreturn
+#define occam_fp_barrier(x)
 #endif
 //}}}
 
@@ -88,43 +101,87 @@
 #define OCCAM_BOOL _Bool
 #endif
 
+//{{{ out-of-line stops
+// The code that reports a failed check (formatting a message, or building and
+// throwing an exception) is kept out of line in cold handlers, so that all
+// that's left in the checked operation is a compare and a branch that's
+// predicted not to be taken.  A handler is defined with
+// OCCAM_STOP_HANDLER(name, (params)) { ... }.
+//
+// If occam_stop never returns (it throws, say), the backend can define
+// OCCAM_STOP_NORETURN before including this header to tell the compiler so.
+#ifdef OCCAM_STOP_NORETURN
+#define occam_stop_handler occam_cold occam_noreturn occam_unused
+#else
+#define occam_stop_handler occam_cold occam_unused
+#endif
+#define OCCAM_STOP_HANDLER(name, params) \
+	static void name params occam_stop_handler; \
+	static void name params
+
+// The argument to pass on to a function taking occam_extra_param.
+#ifndef occam_extra_arg
+#define occam_extra_arg
+#endif
+
+// A stop with a fixed message; this is also what generated code uses for STOP.
+OCCAM_STOP_HANDLER(occam_stop_cold, (occam_extra_param const char *pos, const char *message)) {
+	occam_stop (pos, 2, "%s", message);
+}
+//}}}
+
 
 //{{{ runtime check functions
+OCCAM_STOP_HANDLER(occam_check_slice_failed, (int start, int end, int limit, const char *pos)) {
+	occam_stop (pos, 4, "invalid array slice from %d to %d (should be 0 <= i <= %d)", start, end, limit);
+}
 static inline int occam_check_slice (int, int, int, const char *) occam_unused;
 static inline int occam_check_slice (int start, int count, int limit, const char *pos) {
 	int end = start + count;
-	if (count != 0 && (start < 0 || start >= limit
-	                   || end < 0 || end > limit
-	                   || count < 0)) {
-		occam_stop (pos, 4, "invalid array slice from %d to %d (should be 0 <= i <= %d)", start, end, limit);
+	if (occam_unlikely (count != 0 && (start < 0 || start >= limit
+	                                   || end < 0 || end > limit
+	                                   || count < 0))) {
+		occam_check_slice_failed (start, end, limit, pos);
 	}
 	return start;
 }
+OCCAM_STOP_HANDLER(occam_check_index_failed, (int i, int limit, const char *pos)) {
+	occam_stop (pos, 3, "invalid array index %d (should be 0 <= i < %d)", i, limit);
+}
 static inline int occam_check_index (int, int, const char *) occam_unused;
 static inline int occam_check_index (int i, int limit, const char *pos) {
-	if (i < 0 || i >= limit) {
-		occam_stop (pos, 3, "invalid array index %d (should be 0 <= i < %d)", i, limit);
+	if (occam_unlikely (i < 0 || i >= limit)) {
+		occam_check_index_failed (i, limit, pos);
 	}
 	return i;
 }
+OCCAM_STOP_HANDLER(occam_check_index_lower_failed, (int i, const char *pos)) {
+	occam_stop (pos, 2, "invalid array index %d (should be 0 <= i)", i);
+}
 static inline int occam_check_index_lower (int, const char *) occam_unused;
 static inline int occam_check_index_lower (int i, const char *pos) {
-	if (i < 0) {
-		occam_stop (pos, 2, "invalid array index %d (should be 0 <= i)", i);
+	if (occam_unlikely (i < 0)) {
+		occam_check_index_lower_failed (i, pos);
 	}
 	return i;
 }
+OCCAM_STOP_HANDLER(occam_check_index_upper_failed, (int i, int limit, const char *pos)) {
+	occam_stop (pos, 3, "invalid array index %d (should be i < %d)", i, limit);
+}
 static inline int occam_check_index_upper (int, int, const char *) occam_unused;
 static inline int occam_check_index_upper (int i, int limit, const char *pos) {
-	if (i >= limit) {
-		occam_stop (pos, 3, "invalid array index %d (should be i < %d)", i, limit);
+	if (occam_unlikely (i >= limit)) {
+		occam_check_index_upper_failed (i, limit, pos);
 	}
 	return i;
 }
+OCCAM_STOP_HANDLER(occam_check_retype_failed, (int src, int dest, const char *pos)) {
+	occam_stop (pos, 3, "invalid size for RETYPES/RESHAPES (%d does not divide into %d)", dest, src);
+}
 static inline int occam_check_retype (int, int, const char *) occam_unused;
 static inline int occam_check_retype (int src, int dest, const char *pos) {
-	if (src % dest != 0) {
-		occam_stop (pos, 3, "invalid size for RETYPES/RESHAPES (%d does not divide into %d)", dest, src);
+	if (occam_unlikely (src % dest != 0)) {
+		occam_check_retype_failed (src, dest, pos);
 	}
 	return src / dest;
 }
@@ -132,10 +189,13 @@ static inline int occam_check_retype (int src, int dest, const char *pos) {
 
 //{{{ type-specific arithmetic ops and runtime checks
 #define MAKE_RANGE_CHECK(type, format) \
+	OCCAM_STOP_HANDLER(occam_range_check_##type##_failed, (type lower, type upper, type n, const char *pos)) { \
+		occam_stop (pos, 4, "invalid value in conversion " format " (should be " format " <= i <= " format ")", n, lower, upper); \
+	} \
 	static inline type occam_range_check_##type (type, type, type, const char *) occam_unused; \
 	static inline type occam_range_check_##type (type lower, type upper, type n, const char *pos) { \
-		if (n < lower || n > upper) { \
-			occam_stop (pos, 4, "invalid value in conversion " format " (should be " format " <= i <= " format ")", n, lower, upper); \
+		if (occam_unlikely (n < lower || n > upper)) { \
+			occam_range_check_##type##_failed (lower, upper, n, pos); \
 		} \
 		return n; \
 	}
@@ -149,39 +209,50 @@ static inline int occam_check_retype (int src, int dest, const char *pos) {
 #define __MAX(type) ((type)~__MIN(type))
 
 #define MAKE_ADD(type, otypes, format) \
+	OCCAM_STOP_HANDLER(occam_add_##otypes##_failed, (occam_extra_param type a, type b, const char *pos)) { \
+		occam_stop(pos, 3, "integer overflow when doing " format " + " format, a, b); \
+	} \
 	static inline type occam_add_##otypes (occam_extra_param type, type, const char *) occam_unused; \
 	static inline type occam_add_##otypes (occam_extra_param type a, type b, const char *pos) { \
-		if (((b<1)&&(__MIN(type)-b<=a)) || ((b>=1)&&(__MAX(type)-b>=a))) {return a + b;} \
-		else { occam_stop(pos, 3, "integer overflow when doing " format " + " format, a, b); return 0; } \
+		if (occam_likely (((b<1)&&(__MIN(type)-b<=a)) || ((b>=1)&&(__MAX(type)-b>=a)))) {return a + b;} \
+		else { occam_add_##otypes##_failed(occam_extra_arg a, b, pos); return 0; } \
 	}
 #define MAKE_ADDF(type, otypes) \
 	static inline type occam_add_##otypes (occam_extra_param type, type, const char *) occam_unused; \
 	static inline type occam_add_##otypes (occam_extra_param type a, type b, const char *pos) { return a + b;}
 #define MAKE_SUBTR(type, otypes, format) \
+	OCCAM_STOP_HANDLER(occam_subtr_##otypes##_failed, (occam_extra_param type a, type b, const char *pos)) { \
+		occam_stop(pos, 3, "integer overflow when doing " format " - " format, a, b); \
+	} \
 	static inline type occam_subtr_##otypes (occam_extra_param type, type, const char *) occam_unused; \
 	static inline type occam_subtr_##otypes (occam_extra_param type a, type b, const char *pos) { \
-		if (((b<1)&&(__MAX(type)+b>=a)) || ((b>=1)&&(__MIN(type)+b<=a))) {return a - b;} \
-		else { occam_stop(pos, 3, "integer overflow when doing " format " - " format, a, b); } \
+		if (occam_likely (((b<1)&&(__MAX(type)+b>=a)) || ((b>=1)&&(__MIN(type)+b<=a)))) {return a - b;} \
+		else { occam_subtr_##otypes##_failed(occam_extra_arg a, b, pos); return 0; } \
 	}
 #define MAKE_SUBTRF(type, otypes) \
 	static inline type occam_subtr_##otypes (occam_extra_param type, type, const char *) occam_unused; \
 	static inline type occam_subtr_##otypes (occam_extra_param type a, type b, const char *pos) { return a - b;}
 
 #define MAKE_MUL(type, otypes, format) \
+	OCCAM_STOP_HANDLER(occam_mul_##otypes##_failed, (occam_extra_param type a, type b, const char *pos)) { \
+		occam_stop(pos, 3, "integer overflow when doing " format " * " format, a, b); \
+	} \
 	static inline type occam_mul_##otypes (occam_extra_param type, type, const char *) occam_unused; \
 	static inline type occam_mul_##otypes (occam_extra_param const type a, const type b, const char *pos) { \
 		if (sizeof(type) < sizeof(long)) /*should be statically known*/ { \
 			const long r = (long)a * (long) b; \
-			if (r < (long)__MIN(type) || r > (long)__MAX(type)) { \
-				occam_stop(pos, 3, "integer overflow when doing " format " * " format, a, b); \
+			if (occam_unlikely (r < (long)__MIN(type) || r > (long)__MAX(type))) { \
+				occam_mul_##otypes##_failed(occam_extra_arg a, b, pos); \
+				return 0; \
 			} else { \
 				return (type)r; \
 			} \
 		} else { \
 			/* Taken from: http://www.mail-archive.com/debian-bugs-dist@lists.debian.org/msg326431.html */ \
         	const type r = a * b; \
-   	    	if (b != 0 && r / b != a) { \
-       			occam_stop(pos, 3, "integer overflow when doing "format " * " format, a, b); \
+   	    	if (occam_unlikely (b != 0 && r / b != a)) { \
+       			occam_mul_##otypes##_failed(occam_extra_arg a, b, pos); \
+				return 0; \
        		} else { \
         		return r; \
 			} \
@@ -194,11 +265,13 @@ static inline int occam_check_retype (int src, int dest, const char *pos) {
 #define MAKE_DIV(type, otypes) \
 	static inline type occam_div_##otypes (occam_extra_param type, type, const char *) occam_unused; \
 	static inline type occam_div_##otypes (occam_extra_param type a, type b, const char *pos) { \
-		if (b == 0) { \
-			occam_stop (pos, 1, "divide by zero"); \
+		if (occam_unlikely (b == 0)) { \
+			occam_stop_cold (occam_extra_arg pos, "divide by zero"); \
+			return 0; \
 		} \
-		else if (b == -1 && a == __MIN(type)) /* only overflow I can think of */ { \
-			occam_stop (pos, 1, "overflow in division"); \
+		else if (occam_unlikely (b == -1 && a == __MIN(type))) /* only overflow I can think of */ { \
+			occam_stop_cold (occam_extra_arg pos, "overflow in division"); \
+			return 0; \
 		} else { return a / b; } \
 	}
 #define MAKE_DIVF(type, otypes) \
@@ -207,8 +280,9 @@ static inline int occam_check_retype (int src, int dest, const char *pos) {
 #define MAKE_NEGATE(type, otype) \
 	static inline type occam_subtr_##otype (occam_extra_param type, const char *) occam_unused; \
 	static inline type occam_subtr_##otype (occam_extra_param type a, const char *pos) { \
-		if (a == __MIN(type)) { \
-			occam_stop (pos, 1, "overflow in negation"); \
+		if (occam_unlikely (a == __MIN(type))) { \
+			occam_stop_cold (occam_extra_arg pos, "overflow in negation"); \
+			return 0; \
 		} else {return - a;} \
 	}
 #define MAKE_NEGATEF(type, otype) \
@@ -221,8 +295,9 @@ static inline int occam_check_retype (int src, int dest, const char *pos) {
 #define MAKE_REM(type, otypes) \
 	static inline type occam_rem_##otypes (occam_extra_param type, type, const char *) occam_unused; \
 	static inline type occam_rem_##otypes (occam_extra_param type a, type b, const char *pos) { \
-		if (b == 0) { \
-			occam_stop (pos, 1, "modulo by zero"); \
+		if (occam_unlikely (b == 0)) { \
+			occam_stop_cold (occam_extra_arg pos, "modulo by zero"); \
+			return 0; \
 		} else if (a == __MIN(type)) { \
 			return a % (b < 0 ? -b : b); \
 		} else if (a < 0) { \
@@ -238,8 +313,9 @@ static inline int occam_check_retype (int src, int dest, const char *pos) {
 #define MAKE_DUMB_REM(type, otypes) \
 	static inline type occam_rem_##otypes (occam_extra_param type, type, const char *) occam_unused; \
 	static inline type occam_rem_##otypes (occam_extra_param type a, type b, const char *pos) { \
-		if (b == 0) { \
-			occam_stop (pos, 1, "modulo by zero"); \
+		if (occam_unlikely (b == 0)) { \
+			occam_stop_cold (occam_extra_arg pos, "modulo by zero"); \
+			return 0; \
 		} \
 		type i = round (a / b); \
 		return a - (i * b); \
@@ -248,8 +324,9 @@ static inline int occam_check_retype (int src, int dest, const char *pos) {
 #define MAKE_SHIFT(utype, type, otype) \
 	static inline type occam_lshift_##otype##_INT (occam_extra_param type, OCCAM_INT, const char*) occam_unused; \
 	static inline type occam_lshift_##otype##_INT (occam_extra_param type a, OCCAM_INT b, const char* pos) { \
-		if (b < 0 || b > (int)(sizeof(type) * CHAR_BIT)) { \
-			occam_stop (pos, 1, "left shift by negative value or value (strictly) greater than number of bits in type"); \
+		if (occam_unlikely (b < 0 || b > (int)(sizeof(type) * CHAR_BIT))) { \
+			occam_stop_cold (occam_extra_arg pos, "left shift by negative value or value (strictly) greater than number of bits in type"); \
+			return 0; \
 		} else if (b == (int)(sizeof(type) * CHAR_BIT)) { \
 			return 0; \
 		} else { \
@@ -258,8 +335,9 @@ static inline int occam_check_retype (int src, int dest, const char *pos) {
 	} \
 	static inline type occam_rshift_##otype##_INT (occam_extra_param type, OCCAM_INT, const char*) occam_unused; \
 	static inline type occam_rshift_##otype##_INT (occam_extra_param type a, OCCAM_INT b, const char* pos) { \
-		if (b < 0 || b > (int)(sizeof(type) * CHAR_BIT)) { \
-			occam_stop (pos, 1, "right shift by negative value or value (strictly) greater than number of bits in type"); \
+		if (occam_unlikely (b < 0 || b > (int)(sizeof(type) * CHAR_BIT))) { \
+			occam_stop_cold (occam_extra_arg pos, "right shift by negative value or value (strictly) greater than number of bits in type"); \
+			return 0; \
 		} else if (b == (int)(sizeof(type) * CHAR_BIT)) { \
 			return 0; \
 		} else { \
@@ -415,8 +493,9 @@ MAKE_ALL_BITWISE(uint8_t,BYTE)
 // occam's only unsigned type, so we can use % directly.
 static inline uint8_t occam_rem_BYTE_BYTE (occam_extra_param uint8_t, uint8_t, const char *) occam_unused;
 static inline uint8_t occam_rem_BYTE_BYTE (occam_extra_param uint8_t a, uint8_t b, const char *pos) {
-	if (b == 0) {
-		occam_stop (pos, 1, "modulo by zero");
+	if (occam_unlikely (b == 0)) {
+		occam_stop_cold (occam_extra_arg pos, "modulo by zero");
+		return 0;
 	}
 	return a % b;
 }
@@ -561,11 +640,282 @@ static int64_t occam_convert_double_int64_t_trunc (double v, const char *pos) {
 
 //}}}
 
+//{{{ gathered communications
+// With --gather-comms, all the items of a sequential protocol output (and
+// the count and data of a counted array) go in a single communication.  The
+// sender builds an array of these on its stack and passes a pointer to it;
+// the receiver keeps the sender blocked (using an extended input) while it
+// copies each item out in turn.  The byte counts are the sender's, which is
+// what makes counted arrays work.
+typedef struct {
+	const void *data;
+	size_t bytes;
+} occam_gather_item;
+
+// Copy the next item into dest, and move on to the one after.
+static inline void occam_scatter (const occam_gather_item **, void *) occam_unused;
+static inline void occam_scatter (const occam_gather_item **items, void *dest) {
+	memcpy (dest, (*items)->data, (*items)->bytes);
+	++*items;
+}
+//}}}
+
+//{{{ profiling
+#if defined(TOCK_COMMS_PROFILE) || defined(TOCK_CHECK_PROFILE)
+// Each profiler keeps its counters on a list shared between all the compiled
+// modules in the program.  A counter is added to the front of the list by
+// whichever thread first counts it, and its next pointer doesn't change once
+// it's there, so the list can be walked from a snapshot of its head while
+// other threads are still adding to it.
+#define TOCK_PROFILE_COUNT(list, c) \
+	do { \
+		if (__sync_fetch_and_add (&(c)->count, 1) == 0) { \
+			do { \
+				(c)->next = (list); \
+			} while (!__sync_bool_compare_and_swap (&(list), (c)->next, (c))); \
+		} \
+	} while (0)
+
+// Called from main.  The profile goes to the file named by the environment
+// variable env if it's set, or to the program name plus suffix otherwise;
+// the name is worked out here so that dump needn't call getenv.
+static void tock_profile_init (char *, const char *, const char *, const char *, void (*) (void)) occam_unused;
+static void tock_profile_init (char *filename, const char *env, const char *progname, const char *suffix, void (*dump) (void)) {
+	const char *fn = getenv (env);
+	if (fn != NULL)
+		snprintf (filename, FILENAME_MAX, "%s", fn);
+	else
+		snprintf (filename, FILENAME_MAX, "%s%s", progname, suffix);
+	atexit (dump);
+}
+#endif
+//}}}
+
+//{{{ communication profiling
+#ifdef TOCK_COMMS_PROFILE
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+
+// With --instrument=comms, each channel input and output in the program has
+// one of these, counting the messages and bytes it's carried and the time
+// spent in it (which is mostly time spent blocked waiting for the other
+// end); each PROC has one counting its activations and the time from its
+// start to its end.  A counter goes on the list the first time it's used,
+// and the list is written out as JSON when the program exits, or when it
+// gets SIGUSR1.
+typedef struct tock_comms_counter {
+	const char *pos;
+	const char *kind;
+	const char *name;
+	uint64_t count;
+	uint64_t bytes;
+	uint64_t ns;
+	struct tock_comms_counter *next;
+} tock_comms_counter;
+
+#define TOCK_COMMS_COUNTER_INIT(pos, kind, name) { pos, kind, name, 0, 0, 0, NULL }
+
+// These are shared between all the compiled modules in the program.
+tock_comms_counter *tock_comms_counters __attribute__ ((weak)) = NULL;
+char tock_comms_filename[FILENAME_MAX] __attribute__ ((weak));
+
+static inline uint64_t tock_comms_now (void) occam_unused;
+static inline uint64_t tock_comms_now (void) {
+	struct timespec ts;
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ((uint64_t) ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+static inline void tock_comms_record (tock_comms_counter *, uint64_t, uint64_t) occam_unused;
+static inline void tock_comms_record (tock_comms_counter *c, uint64_t bytes, uint64_t ns) {
+	TOCK_PROFILE_COUNT (tock_comms_counters, c);
+	__sync_fetch_and_add (&c->bytes, bytes);
+	__sync_fetch_and_add (&c->ns, ns);
+}
+
+// These may be called from a signal handler, so they stick to write.
+static void tock_comms_write_string (int, const char *) occam_unused;
+static void tock_comms_write_string (int fd, const char *s) {
+	ssize_t r = write (fd, "\"", 1);
+	for (; *s != '\0'; s++) {
+		if (*s == '"' || *s == '\\')
+			r = write (fd, "\\", 1);
+		r = write (fd, s, 1);
+	}
+	r = write (fd, "\"", 1);
+	(void) r;
+}
+
+static void tock_comms_write_number (int, uint64_t) occam_unused;
+static void tock_comms_write_number (int fd, uint64_t n) {
+	char buf[20];
+	size_t i = sizeof buf;
+	do {
+		buf[--i] = '0' + n % 10;
+		n /= 10;
+	} while (n != 0);
+	ssize_t r = write (fd, buf + i, sizeof buf - i);
+	(void) r;
+}
+
+// Write out the counters to the file chosen by tock_comms_profile_init.  This
+// is called from the SIGUSR1 handler as well as at exit, so it only uses
+// functions that are safe in a signal handler.  Counters added after the
+// snapshot of the list is taken are in the next dump.
+static void tock_comms_dump (void) occam_unused;
+static void tock_comms_dump (void) {
+	__sync_synchronize ();
+	tock_comms_counter *head = tock_comms_counters;
+
+	int fd = open (tock_comms_filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (fd < 0)
+		return;
+	ssize_t r = write (fd, "[\n", 2);
+	for (tock_comms_counter *c = head; c != NULL; c = c->next) {
+		r = write (fd, "{\"pos\":", 7);
+		tock_comms_write_string (fd, c->pos);
+		r = write (fd, ",\"kind\":", 8);
+		tock_comms_write_string (fd, c->kind);
+		if (c->name != NULL) {
+			r = write (fd, ",\"name\":", 8);
+			tock_comms_write_string (fd, c->name);
+		}
+		r = write (fd, ",\"count\":", 9);
+		tock_comms_write_number (fd, c->count);
+		r = write (fd, ",\"bytes\":", 9);
+		tock_comms_write_number (fd, c->bytes);
+		r = write (fd, ",\"ns\":", 6);
+		tock_comms_write_number (fd, c->ns);
+		if (c->next != NULL)
+			r = write (fd, "},\n", 3);
+		else
+			r = write (fd, "}\n", 2);
+	}
+	r = write (fd, "]\n", 2);
+	(void) r;
+	close (fd);
+}
+
+static void tock_comms_signal (int) occam_unused;
+static void tock_comms_signal (int sig) {
+	int saved_errno = errno;
+	tock_comms_dump ();
+	errno = saved_errno;
+}
+
+// Called from main.  The counters are written to the file named by
+// $TOCK_COMMS_PROFILE if it's set, or to the program name plus ".comms.json"
+// otherwise.
+static void tock_comms_profile_init (const char *) occam_unused;
+static void tock_comms_profile_init (const char *progname) {
+	tock_profile_init (tock_comms_filename, "TOCK_COMMS_PROFILE", progname, ".comms.json", tock_comms_dump);
+	signal (SIGUSR1, tock_comms_signal);
+}
+#endif
+//}}}
+
+//{{{ check profiling
+#ifdef TOCK_CHECK_PROFILE
+// With --instrument=checks, the position given to each runtime check goes
+// through TOCK_CHECK_SITE, which counts the times the check is made.  When
+// the program exits, the checks that were made are written out one per line,
+// most frequent first, as:
+//   position count kind code
+// Positions are what --unchecked-sites reads, so a cut-down copy of the file
+// can be given back to Tock to compile those checks out.
+typedef struct tock_check_counter {
+	const char *pos;
+	const char *kind;
+	const char *text;
+	uint64_t count;
+	struct tock_check_counter *next;
+} tock_check_counter;
+
+// These are shared between all the compiled modules in the program.
+tock_check_counter *tock_check_counters __attribute__ ((weak)) = NULL;
+char tock_check_filename[FILENAME_MAX] __attribute__ ((weak));
+
+static inline void tock_check_record (tock_check_counter *) occam_unused;
+static inline void tock_check_record (tock_check_counter *c) {
+	TOCK_PROFILE_COUNT (tock_check_counters, c);
+}
+
+// This is a GNU statement expression, so that each check gets a counter of
+// its own and the position can still be passed wherever it was before.
+#define TOCK_CHECK_SITE(pos, kind, text) \
+	({ static tock_check_counter tock_check_site_ = { pos, kind, text, 0, NULL }; \
+	   tock_check_record (&tock_check_site_); \
+	   pos; })
+
+static int tock_check_compare (const void *, const void *) occam_unused;
+static int tock_check_compare (const void *a, const void *b) {
+	uint64_t ca = (*(const tock_check_counter **) a)->count;
+	uint64_t cb = (*(const tock_check_counter **) b)->count;
+	return ca < cb ? 1 : ca > cb ? -1 : 0;
+}
+
+// Write out the counts to the file chosen by tock_check_profile_init.
+static void tock_check_dump (void) occam_unused;
+static void tock_check_dump (void) {
+	const char *fn = tock_check_filename;
+	size_t n = 0;
+	for (tock_check_counter *c = tock_check_counters; c != NULL; c = c->next)
+		n++;
+	tock_check_counter **sorted = (tock_check_counter **) malloc ((n + 1) * sizeof *sorted);
+	FILE *f = fopen (fn, "w");
+	if (sorted == NULL || f == NULL) {
+		fprintf (stderr, "Cannot write check profile to %s\n", fn);
+		free (sorted);
+		if (f != NULL)
+			fclose (f);
+		return;
+	}
+	n = 0;
+	for (tock_check_counter *c = tock_check_counters; c != NULL; c = c->next)
+		sorted[n++] = c;
+	qsort (sorted, n, sizeof *sorted, tock_check_compare);
+
+	fprintf (f, "# position count kind code\n");
+	for (size_t i = 0; i < n; i++)
+		fprintf (f, "%s %llu %s %s\n", sorted[i]->pos,
+		         (unsigned long long) sorted[i]->count, sorted[i]->kind, sorted[i]->text);
+	fclose (f);
+	free (sorted);
+}
+
+// Called from main.  The counts are written to the file named by
+// $TOCK_CHECK_PROFILE if it's set, or to the program name plus ".checkprof"
+// otherwise.
+static void tock_check_profile_init (const char *) occam_unused;
+static void tock_check_profile_init (const char *progname) {
+	tock_profile_init (tock_check_filename, "TOCK_CHECK_PROFILE", progname, ".checkprof", tock_check_dump);
+}
+#endif
+//}}}
+
 
 //{{{ intrinsics
 // FIXME These should do range checks.
 
 #include "tock_intrinsics_arith.h"
+
+// The rounding modes for IEEE32OP and IEEE64OP, in the order of their Rm
+// argument; an invalid mode leaves the current one alone.  occam code always
+// runs in round-to-nearest mode, and the IEEE*OP functions change the mode
+// only for the one operation they do.
+static inline int occam_rounding_mode (OCCAM_INT, int) occam_unused;
+static inline int occam_rounding_mode (OCCAM_INT Rm, int current) {
+	switch (Rm) {
+		case 0: return FE_TOWARDZERO;
+		case 1: return FE_TONEAREST;
+		case 2: return FE_UPWARD;
+		case 3: return FE_DOWNWARD;
+		default: return current;
+	}
+}
+
 #define REAL float
 #define RINT int32_t
 #define ADD_PREFIX(a) occam_##a
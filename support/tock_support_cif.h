@@ -39,9 +39,108 @@
 //}}}
 
 #define occam_extra_param Workspace wptr,
+#define occam_extra_arg wptr,
 
 #include <tock_support.h>
 
+//{{{ Stack profiling
+#ifdef TOCK_STACK_PROFILE
+// When stack profiling is turned on, the unused part of each workspace is
+// filled with a canary value when it is allocated, and when the process has
+// finished we look to see how much of it has been overwritten.  The high-water
+// marks are collected per PROC, and written out at the end of the program in
+// a form that can be given back to Tock with --stack-profile.
+
+#define TOCK_STACK_CANARY ((word) 0x57AC57AC)
+
+typedef struct tock_stack_profile {
+	const char *name;
+	word high_water;
+	word budget;
+	word runs;
+	// Only used for processes that are allocated once (see below):
+	word *bottom;
+	word *top;
+	struct tock_stack_profile *next;
+} tock_stack_profile;
+
+#define TOCK_STACK_PROFILE_INIT(name) { name, 0, 0, 0, NULL, NULL, NULL }
+
+// This is shared between all the compiled modules in the program.
+tock_stack_profile *tock_stack_profiles __attribute__ ((weak)) = NULL;
+
+static inline void tock_stack_profile_paint (word *, word *) occam_unused;
+static inline void tock_stack_profile_paint (word *bottom, word *top) {
+	for (word *p = bottom; p < top; p++)
+		*p = TOCK_STACK_CANARY;
+}
+
+static inline void tock_stack_profile_record (tock_stack_profile *, word *, word *) occam_unused;
+static inline void tock_stack_profile_record (tock_stack_profile *prof, word *bottom, word *top) {
+	word *p = bottom;
+	while (p < top && *p == TOCK_STACK_CANARY)
+		p++;
+	word used = top - p;
+
+	if (__sync_fetch_and_add (&prof->runs, 1) == 0) {
+		do {
+			prof->next = tock_stack_profiles;
+		} while (!__sync_bool_compare_and_swap (&tock_stack_profiles, prof->next, prof));
+	}
+	word old;
+	while ((old = prof->high_water) < used
+	       && !__sync_bool_compare_and_swap (&prof->high_water, old, used))
+		;
+	prof->budget = top - bottom;
+}
+
+// For processes that are only allocated once, and not by TockProcAlloc (the
+// top-level process and its handlers), the bounds are kept in the profile.
+static inline void tock_stack_profile_start_once (tock_stack_profile *, Workspace, word) occam_unused;
+static inline void tock_stack_profile_start_once (tock_stack_profile *prof, Workspace ws, word args) {
+	prof->bottom = ws + args;
+	prof->top = ws + ws[StackPtr];
+	tock_stack_profile_paint (prof->bottom, prof->top);
+}
+
+static inline void tock_stack_profile_end_once (tock_stack_profile *) occam_unused;
+static inline void tock_stack_profile_end_once (tock_stack_profile *prof) {
+	tock_stack_profile_record (prof, prof->bottom, prof->top);
+}
+
+// Write out the profile, to the file named by $TOCK_STACK_PROFILE if it's set,
+// or to the program name plus ".stackprof" otherwise.
+static void tock_stack_profile_dump (const char *) occam_unused;
+static void tock_stack_profile_dump (const char *progname) {
+	char default_name[FILENAME_MAX];
+	const char *fn = getenv ("TOCK_STACK_PROFILE");
+	if (fn == NULL) {
+		snprintf (default_name, sizeof default_name, "%s.stackprof", progname);
+		fn = default_name;
+	}
+
+	FILE *f = fopen (fn, "w");
+	if (f == NULL) {
+		fprintf (stderr, "Cannot write stack profile to %s\n", fn);
+		return;
+	}
+	// Sizes are given in bytes, like Tock's static stack size estimates.
+	fprintf (f, "# name high-water-bytes budget-bytes runs\n");
+	for (tock_stack_profile *prof = tock_stack_profiles; prof != NULL; prof = prof->next)
+		fprintf (f, "%s %ld %ld %ld\n", prof->name,
+		         (long) (prof->high_water * sizeof (word)),
+		         (long) (prof->budget * sizeof (word)), (long) prof->runs);
+	fclose (f);
+}
+
+// Words stored before the process words in a TockProcAlloc'd workspace: the
+// profile, the number of arguments, and the total size of the block.
+#define TOCK_PROFILE_WORDS 3
+#else
+#define TOCK_PROFILE_WORDS 0
+#endif
+//}}}
+
 //{{{ Process starting and stopping
 
 // This is a version of the CCSP function that uses malloc.  We should replace this eventually, preferably using LightProcAlloc.
@@ -50,19 +149,48 @@ static inline Workspace TockProcAlloc (Workspace wptr, word args, word stack)
     Workspace ws;
     word words = WORKSPACE_SIZE (args, stack);
 
-    ws = malloc(words*sizeof(word));
+    ws = malloc((TOCK_PROFILE_WORDS + words)*sizeof(word));
 
-    ws += CIF_PROCESS_WORDS;
+    ws += TOCK_PROFILE_WORDS + CIF_PROCESS_WORDS;
     ws[BarrierPtr] = (word) NULL;
     ws[StackPtr] = words - CIF_PROCESS_WORDS;
 
+#ifdef TOCK_STACK_PROFILE
+    word *block = ws - CIF_PROCESS_WORDS - TOCK_PROFILE_WORDS;
+    block[0] = (word) NULL;
+    block[1] = args;
+    block[2] = words;
+#endif
+
     return ws;
 }
 
+#ifdef TOCK_STACK_PROFILE
+//As TockProcAlloc, but records the high-water mark against the given profile
+//when the workspace is freed.
+static inline Workspace TockProcAllocProfiled (Workspace wptr, word args, word stack, tock_stack_profile *prof)
+{
+    Workspace ws = TockProcAlloc (wptr, args, stack);
+    word *block = ws - CIF_PROCESS_WORDS - TOCK_PROFILE_WORDS;
+
+    block[0] = (word) prof;
+    tock_stack_profile_paint (ws + args, block + TOCK_PROFILE_WORDS + block[2]);
+
+    return ws;
+}
+#endif
+
 //The corresponding version that frees the workspace
 static inline void TockProcFree(Workspace wptr, Workspace ws)
 {
-	ws -= CIF_PROCESS_WORDS;
+	ws -= CIF_PROCESS_WORDS + TOCK_PROFILE_WORDS;
+#ifdef TOCK_STACK_PROFILE
+	if (ws[0] != (word) NULL) {
+		Workspace base = ws + TOCK_PROFILE_WORDS + CIF_PROCESS_WORDS;
+		tock_stack_profile_record ((tock_stack_profile *) ws[0],
+		                           base + ws[1], ws + TOCK_PROFILE_WORDS + ws[2]);
+	}
+#endif
 	free(ws);
 }
 //}}}
@@ -76,6 +204,158 @@ static inline void tock_init_chan_array (Channel *pointTo, Channel **pointFrom,
 }
 //}}}
 
+//{{{ ALT polling
+// Is a process already waiting to output on the channel, so that an input
+// from it wouldn't block?  Only the channel's reader may ask, and not while
+// it's in the middle of an ALT: then nothing else can take the waiting
+// process off the channel.
+static inline bool tock_chan_ready (Channel *) occam_unused;
+static inline bool tock_chan_ready (Channel *c) {
+	return *(volatile Channel *) c != NotProcess_p;
+}
+//}}}
+
+//{{{ gathered communications
+// See occam_gather_item.  The sender sends a pointer to its list of items;
+// the receiver takes it with an extended input, and must ChanXEnd once it
+// has scattered all the items.
+static inline void tock_chan_out_gather (Workspace, Channel *, const occam_gather_item *) occam_unused;
+static inline void tock_chan_out_gather (Workspace wptr, Channel *c, const occam_gather_item *items) {
+	ChanOut (wptr, c, &items, sizeof items);
+}
+
+static inline const occam_gather_item *tock_chan_in_gather (Workspace, Channel *) occam_unused;
+static inline const occam_gather_item *tock_chan_in_gather (Workspace wptr, Channel *c) {
+	const occam_gather_item *items;
+	ChanXAble (wptr, c);
+	ChanXIn (wptr, c, &items, sizeof items);
+	return items;
+}
+//}}}
+
+//{{{ buffered channels
+// A channel declared with #PRAGMA BUFFERED has a second channel for its
+// reader, and a pair of helper processes between the two: a store that
+// holds up to slots items in a ring, and a prompter that takes the oldest
+// item from the store and offers it to the reader.  The reader's end is an
+// ordinary channel, so it can be used in ALTs.  (The prompter holds one item
+// while it's offering it, so the writer can get slots + 1 items ahead.)
+typedef struct {
+	Channel *in, *out;
+	Channel req, reply, stop, kill, done;
+	LightProcBarrier barrier;
+	Workspace ws[2];
+	word slots, bytes;
+	// slots items of ring, then one for the prompter and one for draining.
+	uint8_t *data;
+} tock_buffered_chan;
+
+#define TOCK_BUFFER_STACK 1024
+
+static void tock_buffer_store (Workspace wptr) occam_unused;
+static void tock_buffer_store (Workspace wptr) {
+	tock_buffered_chan *b = ProcGetParam (wptr, 0, tock_buffered_chan *);
+	word head = 0, count = 0;
+	bool token;
+
+	while (true) {
+		enum { STORE_REQ, STORE_IN, STORE_KILL } kinds[3];
+		Channel *guards[4];
+		int n = 0;
+
+		if (count > 0) {
+			kinds[n] = STORE_REQ;
+			guards[n++] = &b->req;
+		}
+		if (count < b->slots) {
+			kinds[n] = STORE_IN;
+			guards[n++] = b->in;
+		}
+		kinds[n] = STORE_KILL;
+		guards[n++] = &b->kill;
+		guards[n] = NULL;
+
+		switch (kinds[ProcPriAltList (wptr, guards)]) {
+			case STORE_REQ:
+				ChanIn (wptr, &b->req, &token, sizeof token);
+				ChanOut (wptr, &b->reply, b->data + head * b->bytes, b->bytes);
+				head = (head + 1) % b->slots;
+				count--;
+				break;
+			case STORE_IN:
+				ChanIn (wptr, b->in, b->data + ((head + count) % b->slots) * b->bytes, b->bytes);
+				count++;
+				break;
+			case STORE_KILL:
+				// Any items left will never be read.  Wait for the
+				// prompter to ask for another, and stop it instead.
+				ChanIn (wptr, &b->kill, &token, sizeof token);
+				ChanIn (wptr, &b->req, &token, sizeof token);
+				ChanOut (wptr, &b->stop, &token, sizeof token);
+				return;
+		}
+	}
+}
+
+static void tock_buffer_prompt (Workspace wptr) occam_unused;
+static void tock_buffer_prompt (Workspace wptr) {
+	tock_buffered_chan *b = ProcGetParam (wptr, 0, tock_buffered_chan *);
+	uint8_t *item = b->data + b->slots * b->bytes;
+	bool token = true;
+
+	while (true) {
+		ChanOut (wptr, &b->req, &token, sizeof token);
+		if (ProcAlt (wptr, &b->reply, &b->stop, NULL) == 1) {
+			ChanIn (wptr, &b->stop, &token, sizeof token);
+			ChanOut (wptr, &b->done, &token, sizeof token);
+			return;
+		}
+		ChanIn (wptr, &b->reply, item, b->bytes);
+		ChanOut (wptr, b->out, item, b->bytes);
+	}
+}
+
+static inline void tock_buffered_chan_init (Workspace, tock_buffered_chan *, Channel *, Channel *, word, word) occam_unused;
+static inline void tock_buffered_chan_init (Workspace wptr, tock_buffered_chan *b, Channel *in, Channel *out, word slots, word bytes) {
+	b->in = in;
+	b->out = out;
+	b->slots = slots;
+	b->bytes = bytes;
+	b->data = malloc ((slots + 2) * bytes);
+	ChanInit (wptr, &b->req);
+	ChanInit (wptr, &b->reply);
+	ChanInit (wptr, &b->stop);
+	ChanInit (wptr, &b->kill);
+	ChanInit (wptr, &b->done);
+
+	LightProcBarrierInit (wptr, &b->barrier, 2);
+	b->ws[0] = TockProcAlloc (wptr, 1, TOCK_BUFFER_STACK);
+	ProcParam (wptr, b->ws[0], 0, b);
+	LightProcStart (wptr, &b->barrier, b->ws[0], tock_buffer_store);
+	b->ws[1] = TockProcAlloc (wptr, 1, TOCK_BUFFER_STACK);
+	ProcParam (wptr, b->ws[1], 0, b);
+	LightProcStart (wptr, &b->barrier, b->ws[1], tock_buffer_prompt);
+}
+
+// Called when the channel goes out of scope, so the writer and reader have
+// both finished.  The prompter may still be trying to offer an item to the
+// reader, so that gets thrown away here.
+static inline void tock_buffered_chan_free (Workspace, tock_buffered_chan *) occam_unused;
+static inline void tock_buffered_chan_free (Workspace wptr, tock_buffered_chan *b) {
+	bool token = true;
+
+	ChanOut (wptr, &b->kill, &token, sizeof token);
+	while (ProcAlt (wptr, b->out, &b->done, NULL) == 0)
+		ChanIn (wptr, b->out, b->data + (b->slots + 1) * b->bytes, b->bytes);
+	ChanIn (wptr, &b->done, &token, sizeof token);
+
+	LightProcBarrierWait (wptr, &b->barrier);
+	TockProcFree (wptr, b->ws[0]);
+	TockProcFree (wptr, b->ws[1]);
+	free (b->data);
+}
+//}}}
+
 //{{{ mobile intrinsics
 static inline void occam_RESIZE_MOBILE_ARRAY_1D (Workspace wptr, const int element_size, mt_array_t ** pptr, const int count) occam_unused;
 static inline void occam_RESIZE_MOBILE_ARRAY_1D (Workspace wptr, const int element_size, mt_array_t ** pptr, const int count) {
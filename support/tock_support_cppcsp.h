@@ -37,6 +37,7 @@ public:
         snprintf(buffer, sizeof(buffer), "Program stopped at %s: " format "\n", pos, ##args); \
         throw StopException(buffer); \
     } while (0)
+#define OCCAM_STOP_NORETURN
 
 #define occam_extra_param
 
@@ -93,7 +94,14 @@ protected:
 			while (true)
 			{
 				in >> c;
-				out << c;
+				if (c == 255)
+				{
+					out.flush();
+				}
+				else
+				{
+					out << c;
+				}
 			}
 		}
 		catch (csp::PoisonException& e)
@@ -205,6 +213,74 @@ inline void tockRecvArrayOfBytes(const csp::Chanin<tockSendableArrayOfBytes>& c,
 	c >> b;
 }
 
+///Gathered communications (see occam_gather_item) send a pointer to the sender's list of items.
+///The receiver holds on to the sender with an extended input for as long as the tockScatter is in scope,
+///and takes the items out in order with the () operator.
+inline void tockSendGather(const csp::Chanout<tockSendableArrayOfBytes>& c, const occam_gather_item* items)
+{
+	c << tockSendableArrayOfBytes(&items);
+}
+
+class tockScatter
+{
+private:
+	const occam_gather_item* items;
+	tockSendableArrayOfBytes dest;
+	csp::ScopedExtInput<tockSendableArrayOfBytes> ext;
+public:
+	inline explicit tockScatter(const csp::Chanin<tockSendableArrayOfBytes>& c)
+		:	items(NULL),dest(sizeof(items),&items),ext(c,&dest)
+	{
+	}
+	
+	inline void operator()(void* p)
+	{
+		occam_scatter(&items,p);
+	}
+};
+
+///Fixed-size arrays go over channels the same way, but with the size known at compile time.
+template <typename T, unsigned N>
+class tockSendableArray
+{
+private:
+	union
+	{
+		const T* sp;
+		T* dp;
+	};
+public:
+	///For the sender:
+	inline explicit tockSendableArray(const T* p)
+		:	sp(p)
+	{
+	}
+	
+	///For the receiver:
+	inline explicit tockSendableArray(T* p)
+		:	dp(p)
+	{
+	}
+	
+	inline void operator=(const tockSendableArray& _src)
+	{
+		memcpy(dp,_src.sp,N * sizeof(T));
+	}
+};
+
+template <typename T, unsigned N>
+inline void tockSendArray(const csp::Chanout< tockSendableArray<T,N> >& c, const T* p)
+{
+	c << tockSendableArray<T,N>(p);
+}
+
+template <typename T, unsigned N>
+inline void tockRecvArray(const csp::Chanin< tockSendableArray<T,N> >& c, T* p)
+{
+	tockSendableArray<T,N> b(p);
+	c >> b;
+}
+
 template <typename T>
 inline void tockInitChanArray(T* pointTo,T** pointFrom,int count)
 {
@@ -0,0 +1,396 @@
+// Microbenchmarks for the primitives in the support headers: the checked
+// arithmetic, shifts and conversions in tock_support.h, and the intrinsics in
+// tock_intrinsics_arith.h and tock_intrinsics_float.h.
+//
+// Each primitive is timed three ways:
+//  - throughput: many independent calls, as in a loop over an array;
+//  - latency: a chain of calls where each takes the result of the last, as
+//    in a long expression;
+//  - stop: calls that fail their check, including the longjmp back out
+//    (only for primitives that can stop).
+//
+// The output is a table of nanoseconds per call, one line per primitive and
+// type; with -t it is tab-separated instead, for keeping and comparing with
+// later runs (e.g. with "join" or a spreadsheet) when the headers change.
+// "supportbench NAME..." runs just the primitives whose names start with one
+// of the NAMEs; -n gives the number of calls to time for each.
+
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Stops only return to the benchmark when one is expected; any other stop
+// means the benchmark's operands are wrong.
+jmp_buf g_stopped;
+volatile int g_expect_stop = 0;
+#define occam_stop(pos, nargs, format, args...) \
+	do { \
+		if (!g_expect_stop) { \
+			fprintf(stderr, "supportbench: unexpected stop: %s\n", format); \
+			exit(1); \
+		} \
+		longjmp(g_stopped, 1); \
+	} while (0)
+
+#define occam_INT_size SIZEOF_VOIDP
+#define occam_extra_param
+#include "support/tock_support.h"
+
+static long iters = 10000000;
+static int tabular = 0;
+static int n_selected = 0;
+static char **selected = NULL;
+
+// Results are stored here so that the compiler can't throw the calls away:
+static volatile uint8_t sink_uint8_t;
+static volatile int8_t sink_int8_t;
+static volatile int16_t sink_int16_t;
+static volatile int32_t sink_int32_t;
+static volatile int64_t sink_int64_t;
+static volatile float sink_float;
+static volatile double sink_double;
+
+static double now_ns(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (double)t.tv_sec * 1e9 + (double)t.tv_nsec;
+}
+
+static int wanted(const char *name) {
+	if (n_selected == 0)
+		return 1;
+	for (int i = 0; i < n_selected; i++)
+		if (strncmp(name, selected[i], strlen(selected[i])) == 0)
+			return 1;
+	return 0;
+}
+
+static void report(const char *name, const char *type, double throughput, double latency, double stop) {
+	char s[32];
+	if (stop < 0)
+		strcpy(s, "-");
+	else
+		snprintf(s, sizeof s, "%.2f", stop);
+	if (tabular)
+		printf("%s\t%s\t%.2f\t%.2f\t%s\n", name, type, throughput, latency, s);
+	else
+		printf("%-20s %-8s %12.2f %12.2f %12s\n", name, type, throughput, latency, s);
+}
+
+// Run body n times with i counting up, giving the time per run in ns:
+#define TIME_LOOP(n, body) ({ \
+	double _start = now_ns(); \
+	for (long i = 0; i < (n); i++) { body; } \
+	(now_ns() - _start) / (n); })
+
+// Run a call that stops n times, giving the time per call in ns.  The
+// counter is volatile since it's live across the setjmp.
+#define TIME_STOP(n, call) ({ \
+	g_expect_stop = 1; \
+	double _start = now_ns(); \
+	for (volatile long _j = 0; _j < (n); _j++) { \
+		if (setjmp(g_stopped) == 0) { call; } \
+	} \
+	g_expect_stop = 0; \
+	(now_ns() - _start) / (n); })
+
+// The stop path is much slower, so it isn't run as many times:
+#define STOP_ITERS (iters / 10)
+
+// Each benchmark is a separate function, named after the primitive and the
+// type.  They mustn't be inlined into main, since GCC may then merge the
+// setjmps from different benchmarks, and a stop in one would return into
+// another.
+#define BENCH_FUNC(name, tname) \
+	static void __attribute__ ((noinline)) bench_##name##_##tname (void)
+
+// A primitive taking two values of the same type.  The throughput loop uses
+// small varying left operands with y_tput on the right; the latency chain
+// starts at x_lat and keeps using y_lat; the stop case uses stop_x and
+// stop_y.  Operands are read through volatiles so that they aren't folded;
+// the latency chain reads y_lat afresh each time so that the compiler can't
+// work out the whole chain at once (e.g. turning repeated addition into a
+// multiplication).
+#define DEFINE_BINARY(name, type, tname, f, y_tput, x_lat, y_lat, can_stop, stop_x, stop_y) \
+	BENCH_FUNC(name, tname) { \
+		volatile type vy = (y_tput), vx = (x_lat), vly = (y_lat), vsx = (stop_x), vsy = (stop_y); \
+		type y = vy, sx = vsx, sy = vsy, x = vx; \
+		double tput = TIME_LOOP(iters, sink_##type = f((type)(i & 7), y, "")); \
+		double lat = TIME_LOOP(iters, x = f(x, vly, "")); \
+		sink_##type = x; \
+		double stop = -1; \
+		if (can_stop) \
+			stop = TIME_STOP(STOP_ITERS, sink_##type = f(sx, sy, "")); \
+		report(#name, #tname, tput, lat, stop); \
+	}
+
+// A primitive taking one value.  The latency chain starts at 1.
+#define DEFINE_UNARY(name, type, tname, f, can_stop, stop_x) \
+	BENCH_FUNC(name, tname) { \
+		volatile type vsx = (stop_x), vx = 1; \
+		type sx = vsx, x = vx; \
+		double tput = TIME_LOOP(iters, sink_##type = f((type)(i & 7), "")); \
+		double lat = TIME_LOOP(iters, x = f(x, "")); \
+		sink_##type = x; \
+		double stop = -1; \
+		if (can_stop) \
+			stop = TIME_STOP(STOP_ITERS, sink_##type = f(sx, "")); \
+		report(#name, #tname, tput, lat, stop); \
+	}
+
+// A shift of a value by an INT.
+#define DEFINE_SHIFT(name, type, tname, f) \
+	BENCH_FUNC(name, tname) { \
+		volatile OCCAM_INT vs = 1, vbad = 1000; \
+		volatile type vx = 1; \
+		OCCAM_INT s = vs, bad = vbad; \
+		type x = vx; \
+		double tput = TIME_LOOP(iters, sink_##type = f((type)(i & 7), s, "")); \
+		double lat = TIME_LOOP(iters, x = f(x, vs, "") | 1); \
+		sink_##type = x; \
+		double stop = TIME_STOP(STOP_ITERS, sink_##type = f(x, bad, "")); \
+		report(#name, #tname, tput, lat, stop); \
+	}
+
+#define DEFINE_BENCH(kind, ...) DEFINE_##kind(__VA_ARGS__)
+#define RUN_BENCH(kind, name, type, tname, ...) \
+	if (wanted(#name)) \
+		bench_##name##_##tname();
+
+// The benchmarks for an integer type, whose range is min to max.  X is
+// DEFINE_BENCH or RUN_BENCH.
+#define INTEGER_BENCHMARKS(X, type, otype, min, max) \
+	X(BINARY, add, type, otype, occam_add_##otype##_##otype, 1, 1, 0, 1, max, 1) \
+	X(BINARY, subtr, type, otype, occam_subtr_##otype##_##otype, 0, 1, 0, 1, min, 1) \
+	X(BINARY, mul, type, otype, occam_mul_##otype##_##otype, 3, 1, 1, 1, max, 2) \
+	X(BINARY, div, type, otype, occam_div_##otype##_##otype, 3, 5, 1, 1, 1, 0) \
+	X(BINARY, rem, type, otype, occam_rem_##otype##_##otype, 3, 1, 3, 1, 1, 0) \
+	X(BINARY, plus, type, otype, occam_plus_##otype##_##otype, 1, 1, 1, 0, 0, 0) \
+	X(BINARY, minus, type, otype, occam_minus_##otype##_##otype, 1, 1, 1, 0, 0, 0) \
+	X(BINARY, times, type, otype, occam_times_##otype##_##otype, 3, 1, 3, 0, 0, 0) \
+	X(SHIFT, lshift, type, otype, occam_lshift_##otype##_INT) \
+	X(SHIFT, rshift, type, otype, occam_rshift_##otype##_INT) \
+	X(BINARY, range_check, type, otype, range_check_##otype, 0, 1, 0, 1, max, 0)
+
+// The signed types also have negation.
+#define SIGNED_BENCHMARKS(X, type, otype, min, max) \
+	INTEGER_BENCHMARKS(X, type, otype, min, max) \
+	X(UNARY, negate, type, otype, occam_subtr_##otype, 1, min)
+
+// The range check as a binary operation: checking a value against 0..y+7.
+#define MAKE_RANGE_CHECK_BENCH(type, otype) \
+	static inline type range_check_##otype(type n, type y, const char *pos) { \
+		return occam_range_check_##type(0, y + 7, n, pos); \
+	}
+MAKE_RANGE_CHECK_BENCH(uint8_t, BYTE)
+MAKE_RANGE_CHECK_BENCH(int8_t, INT8)
+MAKE_RANGE_CHECK_BENCH(int16_t, INT16)
+MAKE_RANGE_CHECK_BENCH(int32_t, INT32)
+MAKE_RANGE_CHECK_BENCH(int64_t, INT64)
+
+// The benchmarks for a real type; prefix is empty or D for the intrinsics,
+// and size is 32 or 64.
+#define REAL_BENCHMARKS(X, type, otype, size, prefix) \
+	X(BINARY, add, type, otype, occam_add_##otype##_##otype, 1, 1, 0, 0, 0, 0) \
+	X(BINARY, mul, type, otype, occam_mul_##otype##_##otype, 3, 1, 1, 0, 0, 0) \
+	X(BINARY, div, type, otype, occam_div_##otype##_##otype, 3, 1, 1, 0, 0, 0) \
+	X(BINARY, rem, type, otype, occam_rem_##otype##_##otype, 3, 1, 3, 1, 1, 0) \
+	X(BINARY, REALOP, type, otype, realop_##size, 3, 1, 1, 0, 0, 0) \
+	X(BINARY, IEEEOP, type, otype, ieeeop_##size, 3, 1, 1, 0, 0, 0) \
+	X(BINARY, IEEEOP_up, type, otype, ieeeop_up_##size, 3, 1, 1, 0, 0, 0) \
+	X(BINARY, IEEEOP_nearest_const, type, otype, occam_IEEE##size##OP_nearest_const, 3, 1, 1, 0, 0, 0) \
+	X(BINARY, IEEEOP_up_const, type, otype, occam_IEEE##size##OP_up_const, 3, 1, 1, 0, 0, 0) \
+	X(BINARY, interval, type, otype, interval_##size, 3, 1, 1, 0, 0, 0) \
+	X(BINARY, interval_const, type, otype, interval_const_##size, 3, 1, 1, 0, 0, 0) \
+	X(UNARY, SQRT, type, otype, occam_##prefix##SQRT, 0, 0) \
+	X(UNARY, FPINT, type, otype, occam_##prefix##FPINT, 0, 0)
+
+// REALxxOP and IEEExxOP as binary operations, doing multiplication.  The
+// IEEE ones round to nearest (the current mode) or up, with the mode either
+// passed at runtime or fixed (the _const versions, which the compiler uses for a
+// constant mode).  The interval benchmarks are a step of interval arithmetic:
+// the product of two intervals (here both points), with the lower bound
+// rounded down and the upper bound rounded up.
+static volatile OCCAM_INT rm_nearest = 1, rm_up = 2, rm_down = 3;
+#define MAKE_REALOP_BENCH(type, size) \
+	static inline type realop_##size(type x, type y, const char *pos) { \
+		return occam_REAL##size##OP(x, 2, y, pos); \
+	} \
+	static inline type ieeeop_##size(type x, type y, const char *pos) { \
+		type r; \
+		occam_IEEE##size##OP(x, rm_nearest, 2, y, &r, pos); \
+		return r; \
+	} \
+	static inline type ieeeop_up_##size(type x, type y, const char *pos) { \
+		type r; \
+		occam_IEEE##size##OP(x, rm_up, 2, y, &r, pos); \
+		return r; \
+	} \
+	static inline type occam_IEEE##size##OP_nearest_const(type x, type y, const char *pos) { \
+		type r; \
+		occam_IEEE##size##OP_nearest(x, 2, y, &r, pos); \
+		return r; \
+	} \
+	static inline type occam_IEEE##size##OP_up_const(type x, type y, const char *pos) { \
+		type r; \
+		occam_IEEE##size##OP_up(x, 2, y, &r, pos); \
+		return r; \
+	} \
+	static inline type interval_##size(type x, type y, const char *pos) { \
+		type lo, hi; \
+		occam_IEEE##size##OP(x, rm_down, 2, y, &lo, pos); \
+		occam_IEEE##size##OP(x, rm_up, 2, y, &hi, pos); \
+		return (lo + hi) * (type) 0.5; \
+	} \
+	static inline type interval_const_##size(type x, type y, const char *pos) { \
+		type lo, hi; \
+		occam_IEEE##size##OP_down(x, 2, y, &lo, pos); \
+		occam_IEEE##size##OP_up(x, 2, y, &hi, pos); \
+		return (lo + hi) * (type) 0.5; \
+	}
+MAKE_REALOP_BENCH(float, 32)
+MAKE_REALOP_BENCH(double, 64)
+
+// The conversions from reals to integers and back, as unary operations:
+static inline float real32_int64(float x, const char *pos) {
+	return (float)occam_convert_float_int64_t_round(x, pos);
+}
+static inline double real64_int64(double x, const char *pos) {
+	return (double)occam_convert_double_int64_t_trunc(x, pos);
+}
+static inline double real64_real32(double x, const char *pos) {
+	return (double)occam_convert_double_float_round(x, pos);
+}
+
+// The LONG intrinsics, keeping the most significant word as the chained
+// value:
+static inline OCCAM_INT longprod(OCCAM_INT x, OCCAM_INT y, const char *pos) {
+	OCCAM_INT lo;
+	OCCAM_INT hi = occam_LONGPROD(x, y, 0, &lo, pos);
+	return hi ^ lo;
+}
+static inline OCCAM_INT longdiv(OCCAM_INT x, OCCAM_INT y, const char *pos) {
+	OCCAM_INT rem;
+	OCCAM_INT q = occam_LONGDIV(0, x, y, &rem, pos);
+	return q + rem;
+}
+static inline OCCAM_INT longadd(OCCAM_INT x, OCCAM_INT y, const char *pos) {
+	return occam_LONGADD(x, y, 0, pos);
+}
+static inline OCCAM_INT longsum(OCCAM_INT x, OCCAM_INT y, const char *pos) {
+	OCCAM_INT lo;
+	OCCAM_INT carry = occam_LONGSUM(x, y, 0, &lo, pos);
+	return carry + lo;
+}
+static inline OCCAM_INT longdiff(OCCAM_INT x, OCCAM_INT y, const char *pos) {
+	OCCAM_INT lo;
+	OCCAM_INT borrow = occam_LONGDIFF(x, y, 0, &lo, pos);
+	return borrow + lo;
+}
+static inline OCCAM_INT normalise(OCCAM_INT x, const char *pos) {
+	OCCAM_INT hi, lo;
+	OCCAM_INT places = occam_NORMALISE(0, x, &hi, &lo, pos);
+	return places + (hi ^ lo);
+}
+static inline OCCAM_INT shiftleft(OCCAM_INT x, OCCAM_INT y, const char *pos) {
+	OCCAM_INT lo;
+	OCCAM_INT hi = occam_SHIFTLEFT(x, x, y, &lo, pos);
+	return hi ^ lo;
+}
+static inline OCCAM_INT ashiftleft(OCCAM_INT x, OCCAM_INT y, const char *pos) {
+	return occam_ASHIFTLEFT(x, y, pos);
+}
+static inline OCCAM_INT rotateleft(OCCAM_INT x, OCCAM_INT y, const char *pos) {
+	return occam_ROTATELEFT(x, y, pos);
+}
+
+// TOSTRING and STRINGTO, chaining through the length or value:
+static inline OCCAM_INT inttostring(OCCAM_INT x, const char *pos) {
+	unsigned char buf[32];
+	OCCAM_INT len;
+	occam_INTTOSTRING(&len, buf, x);
+	return len;
+}
+static inline OCCAM_INT hextostring(OCCAM_INT x, const char *pos) {
+	unsigned char buf[32];
+	OCCAM_INT len;
+	occam_HEXTOSTRING(&len, buf, x);
+	return len;
+}
+static inline OCCAM_INT stringtoint(OCCAM_INT x, const char *pos) {
+	static const unsigned char *strings[] = { (const unsigned char *) "12345", (const unsigned char *) "-42" };
+	OCCAM_BOOL error;
+	OCCAM_INT n;
+	occam_STRINGTOINT(&error, &n, strings[x & 1]);
+	return n + error;
+}
+
+#if occam_INT_size == 4
+#define sink_OCCAM_INT sink_int32_t
+#define MOSTNEG_INT INT32_MIN
+#define MOSTPOS_INT INT32_MAX
+MAKE_RANGE_CHECK_BENCH(int32_t, INT)
+#else
+#define sink_OCCAM_INT sink_int64_t
+#define MOSTNEG_INT INT64_MIN
+#define MOSTPOS_INT INT64_MAX
+MAKE_RANGE_CHECK_BENCH(int64_t, INT)
+#endif
+
+// Every benchmark, in the order they're run:
+#define ALL_BENCHMARKS(X) \
+	INTEGER_BENCHMARKS(X, uint8_t, BYTE, 0, UINT8_MAX) \
+	SIGNED_BENCHMARKS(X, int8_t, INT8, INT8_MIN, INT8_MAX) \
+	SIGNED_BENCHMARKS(X, int16_t, INT16, INT16_MIN, INT16_MAX) \
+	SIGNED_BENCHMARKS(X, int32_t, INT32, INT32_MIN, INT32_MAX) \
+	SIGNED_BENCHMARKS(X, int64_t, INT64, INT64_MIN, INT64_MAX) \
+	SIGNED_BENCHMARKS(X, OCCAM_INT, INT, MOSTNEG_INT, MOSTPOS_INT) \
+	REAL_BENCHMARKS(X, float, REAL32, 32, ) \
+	REAL_BENCHMARKS(X, double, REAL64, 64, D) \
+	X(UNARY, convert_int64, float, REAL32, real32_int64, 1, 1e30f) \
+	X(UNARY, convert_int64, double, REAL64, real64_int64, 1, 1e300) \
+	X(UNARY, convert_real32, double, REAL64, real64_real32, 0, 0) \
+	X(BINARY, LONGADD, OCCAM_INT, INT, longadd, 1, 1, 0, 1, MOSTPOS_INT, 1) \
+	X(BINARY, LONGSUM, OCCAM_INT, INT, longsum, 1, 1, 0, 0, 0, 0) \
+	X(BINARY, LONGDIFF, OCCAM_INT, INT, longdiff, 1, 1, 0, 0, 0, 0) \
+	X(BINARY, LONGPROD, OCCAM_INT, INT, longprod, 3, 1, 1, 0, 0, 0) \
+	X(BINARY, LONGDIV, OCCAM_INT, INT, longdiv, 3, 5, 1, 1, 1, 0) \
+	X(UNARY, NORMALISE, OCCAM_INT, INT, normalise, 0, 0) \
+	X(BINARY, SHIFTLEFT, OCCAM_INT, INT, shiftleft, 1, 1, 1, 0, 0, 0) \
+	X(BINARY, ASHIFTLEFT, OCCAM_INT, INT, ashiftleft, 1, 1, 0, 1, MOSTPOS_INT, 1) \
+	X(BINARY, ROTATELEFT, OCCAM_INT, INT, rotateleft, 1, 1, 1, 0, 0, 0) \
+	X(UNARY, INTTOSTRING, OCCAM_INT, INT, inttostring, 0, 0) \
+	X(UNARY, HEXTOSTRING, OCCAM_INT, INT, hextostring, 0, 0) \
+	X(UNARY, STRINGTOINT, OCCAM_INT, INT, stringtoint, 0, 0)
+
+ALL_BENCHMARKS(DEFINE_BENCH)
+
+int main(int argc, char **argv) {
+	int opt;
+	while ((opt = getopt(argc, argv, "tn:")) != -1) {
+		switch (opt) {
+		case 't':
+			tabular = 1;
+			break;
+		case 'n':
+			iters = atol(optarg);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-t] [-n CALLS] [NAME...]\n", argv[0]);
+			return 1;
+		}
+	}
+	selected = argv + optind;
+	n_selected = argc - optind;
+
+	if (tabular)
+		printf("primitive\ttype\tthroughput_ns\tlatency_ns\tstop_ns\n");
+	else
+		printf("%-20s %-8s %12s %12s %12s\n", "Primitive", "Type", "Throughput", "Latency", "Stop");
+
+	ALL_BENCHMARKS(RUN_BENCH)
+
+	return 0;
+}
@@ -19,6 +19,7 @@ with this program.  If not, see <http://www.gnu.org/licenses/>.
 -- | Contains test for various shared passes.
 module PassTest (tests) where
 
+import Control.Concurrent (yield)
 import Control.Monad.State hiding (guard)
 import Data.Generics (cast, Data, Typeable)
 import qualified Data.Map as Map
@@ -28,11 +29,13 @@ import qualified AST as A
 import CompState
 import Metadata
 import OccamEDSL
+import Pass (NodeTransforms(..), Pass(..), Property(..), PassM, fusible, noTransforms, parallelIO, pass, runPassM)
 import Pattern
 import SimplifyComms
 import SimplifyExprs
 import TagAST
 import TestUtils
+import Traversal (applyBottomUpM, fusePasses)
 import TreeUtils
 import Types
 import Unnest
@@ -577,8 +580,35 @@ testTransformProtocolInput = TestList
         A.Seq emptyMeta $ A.Several emptyMeta $ map onlySingle [ii1,ii2] ++ [A.Only emptyMeta $ A.Skip emptyMeta])
       transformProtocolInput (A.Alt emptyMeta False $ A.Only emptyMeta $ altItems [ii0, ii1, ii2])
       (return ())
+
+   -- A gathered input is left alone, unless an item's destination depends on
+   -- an earlier item:
+   ,TestCase $ testPass "testTransformProtocolInput5"
+      (seqItems [ii0, ii2])
+      transformProtocolInput (seqItems [ii0, ii2])
+      gatherState
+   ,TestCase $ testPass "testTransformProtocolInput6"
+      (tag2 A.Seq emptyMeta $ tag3 A.Spec emptyMeta (tag3 A.Specification DontCare temp DontCare) $
+        tag2 A.Only emptyMeta $ tag3 A.Input emptyMeta (variable "c") $
+          tag3 A.InputSimple emptyMeta [mkPattern ii0, tag2 A.InVariable emptyMeta tempV] $
+            mkPattern $ Just $ tag2 A.Seq emptyMeta $ tag2 A.Several emptyMeta
+              [tag2 A.Only emptyMeta $ tag3 A.Assign emptyMeta [mkPattern ax] $
+                 tag2 A.ExpressionList emptyMeta [tag2 A.ExprVariable emptyMeta tempV]])
+      transformProtocolInput (seqItems [ii0, A.InVariable emptyMeta ax])
+      gatherState
   ]
   where
+   temp = Named "temp" DontCare
+   tempV = tag2 A.Variable emptyMeta temp
+   ax = A.SubscriptedVariable emptyMeta
+          (A.Subscript emptyMeta A.NoCheck $ A.ExprVariable emptyMeta $ variable "x")
+          (variable "a")
+
+   gatherState
+     = do modify $ \cs -> cs { csOpts = (csOpts cs) { csGatherComms = True } }
+          defineName (simpleName "x") $ simpleDefDecl "x" A.Int
+          defineName (simpleName "a") $ simpleDefDecl "a" (A.Array [A.Dimension $ intLiteral 4] A.Int)
+
    ii0 = A.InVariable emptyMeta (variable "x")
    ii1 = A.InCounted emptyMeta (variable "y") (variable "z")
    ii2 = A.InVariable emptyMeta (variable "a")
@@ -698,6 +728,87 @@ testRemoveNesting = TestList
 
 
 --Returns the list of tests:
+-- | Test that adjacent fusible passes are combined, and that running the
+-- combined passes gives the same result as running them one at a time.
+testFusePasses :: Test
+testFusePasses = TestLabel "testFusePasses" $ TestList
+    [ test 0 [rename "a" "b" [] [], rename "b" "c" [] []]
+             ["rename a to b; rename b to c"]
+    , test 1 [rename "a" "b" [] [], unfused, rename "b" "c" [] []]
+             ["rename a to b", "unfused", "rename b to c"]
+      -- The second pass needs the first to have finished:
+    , test 2 [rename "a" "b" [] [prop], rename "b" "c" [prop] []]
+             ["rename a to b", "rename b to c"]
+    , test 3 [rename "a" "b" [] [prop], rename "c" "d" [] [], rename "b" "c" [prop] []]
+             ["rename a to b; rename c to d", "rename b to c"]
+    , test 4 [unfused, rename "c" "a" [] [], rename "a" "b" [] [], unfused]
+             ["unfused", "rename c to a; rename a to b", "unfused"]
+    ]
+  where
+    test :: Int -> [Pass A.AST] -> [String] -> Test
+    test n ps expNames = TestCase $
+      do let fused = fusePasses ps
+         assertEqual ("testFusePasses " ++ show n ++ " names") expNames (map passName fused)
+         exp <- run ps
+         act <- run fused
+         assertEqual ("testFusePasses " ++ show n ++ " result") exp act
+
+    run :: [Pass A.AST] -> IO A.AST
+    run ps
+      =  do (r, _) <- runPassM emptyState $ foldM (flip passCode) src ps
+            case r of
+              Left err -> assertFailure (show err) >> return src
+              Right ast -> return ast
+
+    src :: A.AST
+    src = A.Several m [abbrev "x" "a", abbrev "y" "b", abbrev "z" "c"]
+      where
+        abbrev n v = A.Spec m (A.Specification m (simpleName n)
+                                 (A.Is m A.Abbrev A.Int $ A.ActualVariable $ variable v))
+                              (A.Several m [])
+
+    rename :: String -> String -> [Property] -> [Property] -> Pass A.AST
+    rename from to pre post
+      = fusible (noTransforms { ntVariable = doVariable }) $
+          pass ("rename " ++ from ++ " to " ++ to) pre post (applyBottomUpM doVariable)
+      where
+        doVariable :: A.Variable -> PassM A.Variable
+        doVariable (A.Variable vm n)
+          | A.nameName n == from = return $ A.Variable vm n { A.nameName = to }
+        doVariable v = return v
+
+    unfused :: Pass A.AST
+    unfused = pass "unfused" [] [] return
+
+    prop :: Property
+    prop = Property "prop" (const $ return ())
+
+-- | Test that parallelIO gives back the results in order, with exceptions in
+-- the right places.
+testParallelIO :: Test
+testParallelIO = TestLabel "testParallelIO" $ TestList
+    [ test 0 1 10
+    , test 1 3 20
+    , test 2 8 3
+    , test 3 4 0
+    ]
+  where
+    test :: Int -> Int -> Int -> Test
+    test n workers count = TestCase $
+      do results <- parallelIO workers [act i | i <- [0 .. count - 1]]
+         assertEqual ("testParallelIO " ++ show n)
+           [if failing i then Nothing else Just (i * i) | i <- [0 .. count - 1]]
+           (map (either (const Nothing) Just) results)
+
+    act :: Int -> IO Int
+    act i
+      | failing i = error "testParallelIO"
+      | otherwise = do replicateM_ (i `mod` 3) yield
+                       return (i * i)
+
+    failing :: Int -> Bool
+    failing i = i `mod` 7 == 3
+
 tests :: Test
 tests = TestLabel "PassTest" $ TestList
  [
@@ -712,6 +823,8 @@ tests = TestLabel "PassTest" $ TestList
    ,testRemoveNesting
    ,testTransformConstr0
    ,testTransformProtocolInput
+   ,testFusePasses
+   ,testParallelIO
  ]
 
 
@@ -20,11 +20,13 @@ with this program.  If not, see <http://www.gnu.org/licenses/>.
 module SimplifyComms where
 
 import Control.Monad.State
+import Data.Generics (listify)
 import Data.List
 import Data.Maybe
 
 import qualified AST as A
 import CompState
+import Errors
 import Metadata
 import Pass
 import qualified Properties as Prop
@@ -229,18 +231,91 @@ transformProtocolInput = pass "Flatten sequential protocol inputs into multiple
   (applyBottomUpM2 doProcess doAlternative)
   where
     doProcess :: A.Process -> PassM A.Process
-    doProcess (A.Input m v (A.InputSimple m' iis@(_:_:_) mp))
-      = return $ A.Seq m $ A.Several m $ map (A.Only m . A.Input m v) $ flatten m' iis mp
+    -- Inputs that the backend will receive as one gathered message are left
+    -- as one input (see receiveInOrder):
+    doProcess p@(A.Input m v (A.InputSimple m' iis@(_:_:_) mp))
+      = do gathered <- gatheredInput iis
+           if gathered
+             then do (specs, iis', mp') <- receiveInOrder m' iis mp
+                     return $ if null specs
+                       then p
+                       else A.Seq m $ foldr (A.Spec m) (A.Only m $ A.Input m v $ A.InputSimple m' iis' mp') specs
+             else return $ A.Seq m $ A.Several m $ map (A.Only m . A.Input m v) $ flatten m' iis mp
+    doProcess (A.Alt m pri s)
+      = do s' <- transformOnly doGathered s
+           return $ A.Alt m pri s'
+      where
+        doGathered :: Meta -> A.Alternative -> PassM (A.Structured A.Alternative)
+        doGathered m' a@(A.Alternative ma cond v (A.InputSimple mi iis@(_:_:_) mp) body)
+          = do gathered <- gatheredInput iis
+               if gathered
+                 then do (specs, iis', mp') <- receiveInOrder mi iis mp
+                         return $ foldr (A.Spec m') (A.Only m' $
+                           A.Alternative ma cond v (A.InputSimple mi iis' mp') body) specs
+                 else return $ A.Only m' a
+        doGathered m' a = return $ A.Only m' a
     doProcess p = return p
 
+    -- A gathered input works out its destinations as the items are copied
+    -- out of the message, but anything that a later pass pulls out of a
+    -- destination (such as a FUNCTION call in a subscript) ends up before the
+    -- whole input.  So an item whose destination mentions a variable that an
+    -- earlier item is received into is received into a temporary instead,
+    -- and assigned to its destination before the extended process, in the
+    -- order the flattened inputs would have done it.  The message itself is
+    -- unchanged, so it still matches the gathered output at the other end.
+    receiveInOrder :: Meta -> [A.InputItem] -> Maybe A.Process
+                   -> PassM ([A.Specification], [A.InputItem], Maybe A.Process)
+    receiveInOrder m iis mp
+      = do (specs, iis', assigns) <- mapM receive (zip (inits $ map written iis) iis) >>* unzip3
+           return $ if null (concat specs)
+             then ([], iis, mp)
+             else (concat specs, iis',
+                   Just $ A.Seq m $ A.Several m $ map (A.Only m) $ catMaybes assigns ++ maybeToList mp)
+      where
+        receive :: ([[String]], A.InputItem) -> PassM ([A.Specification], A.InputItem, Maybe A.Process)
+        receive (earlier, A.InVariable m' v)
+          | dependsOn earlier v
+            = do t <- astTypeOf v
+                 case t of
+                   A.Array ds _ | A.UnknownDimension `elem` ds ->
+                     dieP m' "Cannot receive an array of unknown size after an item its destination depends on in a gathered input; compile without --gather-comms"
+                   _ -> return ()
+                 spec@(A.Specification _ n _) <- makeNonceVariable "gathered_item" m' t A.Original
+                 let temp = A.Variable m' n
+                 return ([spec], A.InVariable m' temp,
+                         Just $ A.Assign m' [v] $ A.ExpressionList m' [A.ExprVariable m' temp])
+        receive (earlier, A.InCounted m' cv av)
+          | dependsOn earlier cv || dependsOn earlier av
+            = dieP m' "Cannot receive a counted array after an item its destination depends on in a gathered input; compile without --gather-comms"
+        receive (_, ii) = return ([], ii, Nothing)
+
+        dependsOn :: [[String]] -> A.Variable -> Bool
+        dependsOn earlier v = any (`elem` concat earlier) [A.nameName n | n <- listify (const True) v]
+
+        -- The variables that an item is received into.
+        written :: A.InputItem -> [String]
+        written (A.InCounted _ cv av) = [root cv, root av]
+        written (A.InVariable _ v) = [root v]
+
+        root :: A.Variable -> String
+        root (A.Variable _ n) = A.nameName n
+        root (A.SubscriptedVariable _ _ v) = root v
+        root (A.DirectedVariable _ _ v) = root v
+        root (A.DerefVariable _ v) = root v
+        root (A.VariableSizes _ v) = root v
+
     -- We put the extended input on the final input:
     flatten :: Meta -> [A.InputItem] -> Maybe A.Process -> [A.InputMode]
     flatten m [ii] mp = [A.InputSimple m [ii] mp]
     flatten m (ii:iis) mp = A.InputSimple m [ii] Nothing : flatten m iis mp
 
     doAlternative :: A.Alternative -> PassM A.Alternative
-    doAlternative (A.Alternative m cond v (A.InputSimple m' (firstII:(otherIIS@(_:_))) mp) body)
-      = return $ A.Alternative m cond v (A.InputSimple m' [firstII] Nothing) $ A.Seq m' $ A.Several m' $
-             (map (A.Only m' . A.Input m' v) $ flatten m' otherIIS mp)
-             ++ [A.Only m' body]
+    doAlternative a@(A.Alternative m cond v (A.InputSimple m' iis@(firstII:(otherIIS@(_:_))) mp) body)
+      = do gathered <- gatheredInput iis
+           return $ if gathered
+             then a
+             else A.Alternative m cond v (A.InputSimple m' [firstII] Nothing) $ A.Seq m' $ A.Several m' $
+                    (map (A.Only m' . A.Input m' v) $ flatten m' otherIIS mp)
+                    ++ [A.Only m' body]
     doAlternative s = return s
@@ -101,7 +101,9 @@ functionsToProcs = pass "Convert FUNCTIONs to PROCs"
 -- | Convert AFTER expressions to the equivalent using MINUS (which is how the
 -- occam 3 manual defines AFTER).
 removeAfter :: PassOn2 A.Expression A.ExpressionList
-removeAfter = pass "Convert AFTER to MINUS"
+removeAfter = fusible (noTransforms { ntExpression = doExpression
+                                   , ntExpressionList = doExpressionList }) $
+  pass "Convert AFTER to MINUS"
   [Prop.expressionTypesChecked]
   [Prop.afterRemoved]
   (applyBottomUpM2 doExpression doExpressionList)
@@ -140,7 +142,8 @@ removeAfter = pass "Convert AFTER to MINUS"
 -- | For array literals that include other arrays, burst them into their
 -- elements.
 expandArrayLiterals :: PassOn (A.Structured A.Expression)
-expandArrayLiterals = pass "Expand array literals"
+expandArrayLiterals = fusible (noTransforms { ntStructuredExpression = doArrayElem }) $
+  pass "Expand array literals"
   [Prop.expressionTypesChecked, Prop.processTypesChecked]
   [Prop.arrayLiteralsExpanded]
   (applyBottomUpM doArrayElem)